@@ -0,0 +1,283 @@
+#include <sys/syscalls.h>
+#include <string.h>
+#include <common/util.h>
+
+#include <channel.h>
+
+#define CHANNEL_CACHE_LINE 64
+
+//lives at the start of the shared buffer, the slots follow it
+struct channel_header
+{
+	uint32_t slot_size;
+	uint32_t slot_stride;
+	uint32_t num_slots;
+	uint32_t flags;
+	uint32_t total_size;
+
+	//the two sides write to their own cache lines
+	alignas(CHANNEL_CACHE_LINE) uint32_t head; //messages sent
+	uint32_t readers_waiting;
+	uint32_t send_lock;
+
+	alignas(CHANNEL_CACHE_LINE) uint32_t tail; //messages received
+	uint32_t writers_waiting;
+	uint32_t receive_lock;
+};
+
+static size_t buffer_pages(size_t size)
+{
+	return (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
+}
+
+//0 is unlocked, 1 locked, 2 locked with someone waiting,
+//only xchg is used since the 386 doesn't have cmpxchg
+static void lock_word(uint32_t* l)
+{
+	if(__sync_lock_test_and_set(l, 1) == 0)
+		return;
+
+	while(__sync_lock_test_and_set(l, 2) != 0)
+	{
+		futex_wait(l, 2);
+	}
+}
+
+//at worst this costs the holder a needless wake
+static bool try_lock_word(uint32_t* l)
+{
+	return __sync_lock_test_and_set(l, 2) == 0;
+}
+
+static void unlock_word(uint32_t* l)
+{
+	if(__sync_lock_test_and_set(l, 0) == 2)
+		futex_wake(l, 1);
+}
+
+//the flag is set before the kernel checks the counter, so a change can't be missed
+static void wait_for_change(uint32_t* counter, uint32_t seen, uint32_t* waiting)
+{
+	__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+	futex_wait(counter, seen);
+}
+
+//only makes the syscall if the other side went to sleep
+static void wake_waiting(uint32_t* counter, uint32_t* waiting)
+{
+	if(__atomic_load_n(waiting, __ATOMIC_SEQ_CST) && __sync_lock_test_and_set(waiting, 0))
+		futex_wake(counter, ~(size_t)0);
+}
+
+channel::channel(std::string_view name, size_t slot_size, size_t num_slots, int flags)
+{
+	//a power of 2, so the counters can wrap around
+	size_t rounded = 1;
+	while(rounded < num_slots)
+	{
+		rounded <<= 1;
+	}
+	num_slots = rounded;
+
+	//each slot is the message size followed by the message
+	const size_t stride = align_addr(sizeof(uint32_t) + slot_size, sizeof(uint64_t));
+	const size_t size	= sizeof(channel_header) + num_slots * stride;
+
+	m_handle = create_shared_buffer(name.data(), name.size(), size);
+	if(!m_handle)
+		return;
+
+	m_header = (channel_header*)map_shared_buffer(m_handle, size, PAGE_RW);
+	if(!m_header)
+	{
+		close_shared_buffer(m_handle);
+		m_handle = 0;
+		return;
+	}
+
+	m_mapped_size = size;
+
+	*m_header = channel_header{
+		.slot_size	 = (uint32_t)slot_size,
+		.slot_stride = (uint32_t)stride,
+		.num_slots	 = (uint32_t)num_slots,
+		.flags		 = (uint32_t)flags,
+		.total_size	 = (uint32_t)size,
+
+		.head			 = 0,
+		.readers_waiting = 0,
+		.send_lock		 = 0,
+
+		.tail			 = 0,
+		.writers_waiting = 0,
+		.receive_lock	 = 0,
+	};
+}
+
+channel::channel(std::string_view name)
+{
+	m_handle = open_shared_buffer(name.data(), name.size());
+	if(!m_handle)
+		return;
+
+	//the size is only known once the header can be read
+	auto header = (channel_header*)map_shared_buffer(m_handle, sizeof(channel_header), PAGE_RW);
+	if(header)
+	{
+		const size_t size = header->total_size;
+		unmap_pages(header, buffer_pages(sizeof(channel_header)));
+
+		m_header	  = (channel_header*)map_shared_buffer(m_handle, size, PAGE_RW);
+		m_mapped_size = size;
+	}
+
+	if(!m_header)
+	{
+		close_shared_buffer(m_handle);
+		m_handle = 0;
+	}
+}
+
+channel::~channel()
+{
+	if(!m_header)
+		return;
+
+	unmap_pages(m_header, buffer_pages(m_mapped_size));
+	close_shared_buffer(m_handle);
+}
+
+size_t channel::slot_size() const
+{
+	return m_header->slot_size;
+}
+
+uint8_t* channel::slot(uint32_t index) const
+{
+	return (uint8_t*)m_header + sizeof(channel_header) +
+		   (index & (m_header->num_slots - 1)) * m_header->slot_stride;
+}
+
+void* channel::begin_send(bool wait)
+{
+	auto& h = *m_header;
+
+	if(h.flags & CHANNEL_MPMC)
+	{
+		if(wait)
+			lock_word(&h.send_lock);
+		else if(!try_lock_word(&h.send_lock))
+			return nullptr;
+	}
+
+	//nobody else moves head while we're the sender
+	const uint32_t head = h.head;
+	while(true)
+	{
+		const uint32_t tail = __atomic_load_n(&h.tail, __ATOMIC_ACQUIRE);
+		if(head - tail < h.num_slots)
+			return slot(head) + sizeof(uint32_t);
+
+		if(!wait)
+			break;
+
+		wait_for_change(&h.tail, tail, &h.writers_waiting);
+	}
+
+	if(h.flags & CHANNEL_MPMC)
+		unlock_word(&h.send_lock);
+
+	return nullptr;
+}
+
+void channel::end_send(size_t size)
+{
+	auto& h = *m_header;
+
+	const uint32_t head	   = h.head;
+	*(uint32_t*)slot(head) = (uint32_t)size;
+
+	__atomic_store_n(&h.head, head + 1, __ATOMIC_SEQ_CST);
+
+	if(h.flags & CHANNEL_MPMC)
+		unlock_word(&h.send_lock);
+
+	wake_waiting(&h.head, &h.readers_waiting);
+}
+
+const void* channel::begin_receive(size_t* size, bool wait)
+{
+	auto& h = *m_header;
+
+	if(h.flags & CHANNEL_MPMC)
+	{
+		if(wait)
+			lock_word(&h.receive_lock);
+		else if(!try_lock_word(&h.receive_lock))
+			return nullptr;
+	}
+
+	const uint32_t tail = h.tail;
+	while(true)
+	{
+		const uint32_t head = __atomic_load_n(&h.head, __ATOMIC_ACQUIRE);
+		if(head != tail)
+		{
+			*size = *(uint32_t*)slot(tail);
+			return slot(tail) + sizeof(uint32_t);
+		}
+
+		if(!wait)
+			break;
+
+		wait_for_change(&h.head, head, &h.readers_waiting);
+	}
+
+	if(h.flags & CHANNEL_MPMC)
+		unlock_word(&h.receive_lock);
+
+	return nullptr;
+}
+
+void channel::end_receive()
+{
+	auto& h = *m_header;
+
+	__atomic_store_n(&h.tail, h.tail + 1, __ATOMIC_SEQ_CST);
+
+	if(h.flags & CHANNEL_MPMC)
+		unlock_word(&h.receive_lock);
+
+	wake_waiting(&h.tail, &h.writers_waiting);
+}
+
+bool channel::send(const void* msg, size_t size, bool wait)
+{
+	if(size > slot_size())
+		return false;
+
+	void* dst = begin_send(wait);
+	if(!dst)
+		return false;
+
+	memcpy(dst, msg, size);
+	end_send(size);
+
+	return true;
+}
+
+size_t channel::receive(void* dst, size_t max_size, bool wait)
+{
+	size_t size;
+	const void* src = begin_receive(&size, wait);
+	if(!src)
+		return 0;
+
+	if(size > max_size)
+		size = max_size;
+
+	memcpy(dst, src, size);
+	end_receive();
+
+	return size;
+}
@@ -0,0 +1,58 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <sys/syscalls.h>
+#include <string_view>
+
+enum channel_flags
+{
+	//one sending and one receiving task, no locks at all
+	CHANNEL_SPSC = 0,
+	//any number of either, each side is serialized by a lock in the buffer
+	CHANNEL_MPMC = 1,
+};
+
+struct channel_header;
+
+//a ring of fixed size message slots in a named shared buffer,
+//a side that can't go on sleeps in futex_wait until the other one catches up
+class channel
+{
+public:
+	//creates a new channel, num_slots is rounded up to a power of 2
+	channel(std::string_view name, size_t slot_size, size_t num_slots, int flags);
+	//opens a channel another process created
+	explicit channel(std::string_view name);
+
+	channel(const channel&) = delete;
+	~channel();
+
+	bool is_open() const
+	{
+		return m_header != nullptr;
+	}
+
+	size_t slot_size() const;
+
+	//copies a message of up to slot_size bytes in, returns false if it's too big,
+	//or if the ring is full and wait is false
+	bool send(const void* msg, size_t size, bool wait = true);
+	//copies the next message out, returns its size or 0 if there's none and wait is false
+	size_t receive(void* dst, size_t max_size, bool wait = true);
+
+	//zero copy versions, the slot returned by begin stays valid until the matching end
+	void* begin_send(bool wait = true);
+	void end_send(size_t size);
+
+	const void* begin_receive(size_t* size, bool wait = true);
+	void end_receive();
+
+private:
+	uint8_t* slot(uint32_t index) const;
+
+	uintptr_t m_handle = 0;
+	channel_header* m_header = nullptr;
+	size_t m_mapped_size = 0;
+};
+
+#endif
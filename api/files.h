@@ -35,6 +35,25 @@ typedef struct
 	char full_path[MAX_PATH];
 } file_info;
 
+//the most buffers or segments one vectored read or write takes
+#define FILE_MAX_IOVECS 256
+
+//one buffer of a readv or writev, they follow each other in the file
+typedef struct
+{
+	void* buf;
+	size_t len;
+} file_iovec;
+
+//one read of a pread_multi, done is set to how many bytes were read into buf
+typedef struct
+{
+	file_size_t offset;
+	void* buf;
+	size_t len;
+	size_t done;
+} file_segment;
+
 #ifdef __cplusplus
 }
 
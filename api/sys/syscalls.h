@@ -9,6 +9,9 @@
 #include <common/display_mode.h>
 #include <common/input_event.h>
 #include <common/task_data.h>
+#include <common/memory_info.h>
+#include <common/io_ring.h>
+#include <common/disk_stats.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -61,6 +64,22 @@ enum syscall_indices
 	SYSCALL_DIAGNOSTIC_MESSAGE	 = 38,
 	SYSCALL_CURRENT_PROCESS_INFO = 39,
 	SYSCALL_SET_TLS_ADDR		 = 40,
+	SYSCALL_FORK				 = 41,
+	SYSCALL_MAP_FILE			 = 42,
+	SYSCALL_SYNC_FILE_PAGES		 = 43,
+	SYSCALL_WAIT_MEMORY_PRESSURE = 44,
+	SYSCALL_PROCESS_MEM_INFO	 = 45,
+	SYSCALL_SET_PROCESS_MEM_LIMIT = 46,
+	SYSCALL_FUTEX_WAIT			 = 47,
+	SYSCALL_FUTEX_WAKE			 = 48,
+	SYSCALL_SYNC_FILE			 = 49,
+	SYSCALL_SYNC				 = 50,
+	SYSCALL_READV				 = 51,
+	SYSCALL_WRITEV				 = 52,
+	SYSCALL_PREAD_MULTI			 = 53,
+	SYSCALL_IO_RING_SETUP		 = 54,
+	SYSCALL_IO_RING_ENTER		 = 55,
+	SYSCALL_GET_DISK_STATS		 = 56,
 };
 
 struct file_handle;
@@ -188,6 +207,24 @@ static inline int close(file_stream* file)
 	return (int)do_syscall_1(SYSCALL_CLOSE, (uint32_t)file);
 }
 
+//writes what's been written to file so far out to the disk, returns 0 when it's there
+static inline int sync_file(file_stream* file)
+{
+	return (int)do_syscall_1(SYSCALL_SYNC_FILE, (uint32_t)file);
+}
+
+//writes everything waiting in the disk caches out
+static inline int sync_disks(void)
+{
+	return (int)do_syscall_0(SYSCALL_SYNC);
+}
+
+//fills stats for the index'th disk, returns -1 once there are no more
+static inline int get_disk_stats(size_t index, disk_stats* stats)
+{
+	return (int)do_syscall_2(SYSCALL_GET_DISK_STATS, (uint32_t)index, (uint32_t)stats);
+}
+
 static inline size_t read(file_size_t offset, void* dst, size_t len,
 						  file_stream* file)
 {
@@ -204,6 +241,30 @@ static inline size_t write(file_size_t offset, const void* dst, size_t len,
 								   (uint32_t)file);
 }
 
+//reads the file from offset into each buffer in turn, returns how many bytes were read
+static inline size_t readv(file_size_t offset, const file_iovec* iov, size_t count,
+						   file_stream* file)
+{
+	return (size_t)do_syscall_4_0l(SYSCALL_READV, (uint64_t)offset,
+								   (uint32_t)iov, (uint32_t)count,
+								   (uint32_t)file);
+}
+
+static inline size_t writev(file_size_t offset, const file_iovec* iov, size_t count,
+							file_stream* file)
+{
+	return (size_t)do_syscall_4_0l(SYSCALL_WRITEV, (uint64_t)offset,
+								   (uint32_t)iov, (uint32_t)count,
+								   (uint32_t)file);
+}
+
+//does each of the reads, setting their done, and returns how many bytes were read in all
+static inline size_t pread_multi(file_segment* segments, size_t count, file_stream* file)
+{
+	return (size_t)do_syscall_3(SYSCALL_PREAD_MULTI, (uint32_t)segments,
+								(uint32_t)count, (uint32_t)file);
+}
+
 static inline task_id spawn_process(const file_handle* file,
 									const void* arg_ptr,
 									size_t args_size, int flags)
@@ -401,6 +462,76 @@ static inline void set_tls_addr(void* tls_ptr)
 	do_syscall_1(SYSCALL_SET_TLS_ADDR, (uintptr_t)tls_ptr);
 }
 
+//returns the child's id in the parent and 0 in the child
+static inline task_id fork_process(int flags)
+{
+	return (task_id)do_syscall_1(SYSCALL_FORK, (uint32_t)flags);
+}
+
+//maps length bytes of the file at a page aligned offset, pass FILE_WRITE for a writable mapping
+//pages are read on first access, release them with free_pages which writes back changes
+static inline void* map_file(file_stream* file, file_size_t offset, size_t length, int flags)
+{
+	return (void*)do_syscall_4_0l(SYSCALL_MAP_FILE, (uint64_t)offset,
+								  (uint32_t)length, (uint32_t)flags,
+								  (uint32_t)file);
+}
+
+//write the changes made to mapped file pages back to the file
+static inline int sync_file_pages(void* address, size_t num_pages)
+{
+	return (int)do_syscall_2(SYSCALL_SYNC_FILE_PAGES, (uint32_t)address, (uint32_t)num_pages);
+}
+
+//blocks until memory is at least as tight as level, one of the MEMORY_PRESSURE values,
+//and returns the level it got to, MEMORY_PRESSURE_NONE returns the current level right away
+static inline int wait_memory_pressure(int level)
+{
+	return (int)do_syscall_1(SYSCALL_WAIT_MEMORY_PRESSURE, (uint32_t)level);
+}
+
+//fills info for the process with the lowest pid at or after pid and returns its pid,
+//or INVALID_TASK_ID once there are no more
+static inline task_id get_process_mem_info(task_id pid, process_mem_info* info)
+{
+	return (task_id)do_syscall_2(SYSCALL_PROCESS_MEM_INFO, (uint32_t)pid, (uint32_t)info);
+}
+
+//limits are in pages, 0 removes the limit, only works on this process and its children
+static inline int set_process_mem_limit(task_id pid, size_t max_resident_pages,
+										size_t max_virtual_pages)
+{
+	return (int)do_syscall_3(SYSCALL_SET_PROCESS_MEM_LIMIT, (uint32_t)pid,
+							 (uint32_t)max_resident_pages, (uint32_t)max_virtual_pages);
+}
+
+//blocks until futex_wake is called on address, unless the word there isn't expected anymore,
+//then it returns 1 right away, address can be in a shared buffer mapped by other processes
+static inline int futex_wait(const uint32_t* address, uint32_t expected)
+{
+	return (int)do_syscall_2(SYSCALL_FUTEX_WAIT, (uint32_t)address, expected);
+}
+
+//wakes up to num_waiters tasks blocked on address, returns how many it woke
+static inline int futex_wake(const uint32_t* address, size_t num_waiters)
+{
+	return (int)do_syscall_2(SYSCALL_FUTEX_WAKE, (uint32_t)address, (uint32_t)num_waiters);
+}
+
+//gives the process its submission and completion rings, entries is rounded up to a power of 2,
+//submissions are only taken in io_ring_enter, returns null on failure
+static inline io_ring_header* io_ring_setup(size_t entries, int flags)
+{
+	return (io_ring_header*)do_syscall_2(SYSCALL_IO_RING_SETUP, (uint32_t)entries, (uint32_t)flags);
+}
+
+//has the kernel do up to to_submit submissions, with IO_RING_POLL it keeps taking queued ones
+//until there are min_complete completions, returns how many it did or -1
+static inline int io_ring_enter(size_t to_submit, size_t min_complete)
+{
+	return (int)do_syscall_2(SYSCALL_IO_RING_ENTER, (uint32_t)to_submit, (uint32_t)min_complete);
+}
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <terminal/terminal.h>
+#include <sys/syscalls.h>
+#include <channel.h>
+
+terminal s_term{"terminal_1"};
+
+#define NUM_MESSAGES 1000
+#define NUM_PRODUCERS 2
+
+//the child checks every message arrives once and in order
+static void spsc_test()
+{
+	channel ch{"chan_spsc", sizeof(uint32_t), 16, CHANNEL_SPSC};
+	channel reply{"chan_spsc_reply", sizeof(uint32_t), 1, CHANNEL_SPSC};
+	if(!ch.is_open() || !reply.is_open())
+	{
+		printf("couldn't create the spsc channel\n");
+		return;
+	}
+
+	if(fork_process(0) == 0)
+	{
+		channel rx{"chan_spsc"};
+		channel tx{"chan_spsc_reply"};
+
+		uint32_t expected = 0;
+		for(; expected < NUM_MESSAGES; expected++)
+		{
+			uint32_t msg;
+			if(rx.receive(&msg, sizeof(msg)) != sizeof(msg) || msg != expected)
+				break;
+		}
+
+		uint32_t result = expected;
+		tx.send(&result, sizeof(result));
+		sys_exit(0);
+	}
+
+	for(uint32_t i = 0; i < NUM_MESSAGES; i++)
+	{
+		ch.send(&i, sizeof(i));
+	}
+
+	uint32_t received = 0;
+	reply.receive(&received, sizeof(received));
+
+	printf("spsc: %d of %d messages in order\n", received, NUM_MESSAGES);
+}
+
+//each producer sends its own numbers, the sums show whether any went missing
+static void mpmc_test()
+{
+	channel ch{"chan_mpmc", sizeof(uint32_t) * 2, 16, CHANNEL_MPMC};
+	if(!ch.is_open())
+	{
+		printf("couldn't create the mpmc channel\n");
+		return;
+	}
+
+	for(uint32_t p = 0; p < NUM_PRODUCERS; p++)
+	{
+		if(fork_process(0) == 0)
+		{
+			channel tx{"chan_mpmc"};
+
+			for(uint32_t i = 0; i < NUM_MESSAGES; i++)
+			{
+				uint32_t msg[2] = {p, i};
+				tx.send(msg, sizeof(msg));
+			}
+
+			sys_exit(0);
+		}
+	}
+
+	uint32_t counts[NUM_PRODUCERS] = {};
+	uint32_t sums[NUM_PRODUCERS]   = {};
+
+	for(size_t i = 0; i < NUM_PRODUCERS * NUM_MESSAGES; i++)
+	{
+		uint32_t msg[2];
+		if(ch.receive(msg, sizeof(msg)) != sizeof(msg) || msg[0] >= NUM_PRODUCERS)
+		{
+			printf("mpmc: bad message\n");
+			return;
+		}
+
+		counts[msg[0]]++;
+		sums[msg[0]] += msg[1];
+	}
+
+	const uint32_t expected_sum = NUM_MESSAGES * (NUM_MESSAGES - 1) / 2;
+	for(uint32_t p = 0; p < NUM_PRODUCERS; p++)
+	{
+		printf("mpmc: producer %d sent %d messages, %s\n", p, counts[p],
+			   sums[p] == expected_sum ? "all there" : "some missing");
+	}
+}
+
+int main(int argc, char** argv)
+{
+	set_stdout(
+		[](const char* buf, size_t size, void* impl)
+		{
+			s_term.print(buf, size);
+			return size;
+		});
+
+	spsc_test();
+	mpmc_test();
+
+	return 0;
+}
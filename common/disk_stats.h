@@ -0,0 +1,49 @@
+#ifndef DISK_STATS_H
+#define DISK_STATS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//transfers are counted by how long they took, bucket i is under 2^i ms, the last one the rest
+#define DISK_LATENCY_BUCKETS 12
+
+typedef struct
+{
+	size_t block_size;
+	size_t num_blocks;
+
+	//the block cache, entry_size bytes per entry
+	size_t cache_entries;
+	size_t cache_entry_size;
+	size_t cached_entries;
+	size_t dirty_entries;
+
+	size_t cache_hits;
+	size_t cache_misses;
+	//valid entries thrown out for another block, and dirty ones written back first for it
+	size_t evictions;
+	size_t dirty_evictions;
+	//dirty entries the flusher or a sync wrote back
+	size_t written_back;
+
+	//what went through the request queue, and how many transfers that was after merging
+	size_t read_requests;
+	size_t write_requests;
+	size_t read_transfers;
+	size_t write_transfers;
+	size_t blocks_read;
+	size_t blocks_written;
+
+	//from a transfer going to the driver until the queue sees it completed
+	size_t latency[DISK_LATENCY_BUCKETS];
+} disk_stats;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//the most entries either ring can have
+#define IO_RING_MAX_ENTRIES 4096
+
+//io_ring_enter takes every queued submission it needs for min_complete, not only to_submit
+#define IO_RING_POLL 0x01
+
+enum io_ring_op
+{
+	IO_RING_NOP	  = 0,
+	IO_RING_READ  = 1,
+	IO_RING_WRITE = 2,
+	IO_RING_OPEN  = 3,
+	IO_RING_CLOSE = 4,
+	IO_RING_SYNC  = 5,
+};
+
+//an operation for the kernel, which fields are used depends on op
+typedef struct
+{
+	uint32_t op;
+	//open
+	int mode;
+	struct directory_stream* dir;
+	//read and write, file is also what close and sync work on
+	uint64_t offset;
+	struct file_stream* file;
+	//the path for open
+	void* buf;
+	size_t len;
+	//handed back in the completion
+	uint64_t user_data;
+} io_ring_sqe;
+
+//what became of a submission
+typedef struct
+{
+	uint64_t user_data;
+	//bytes moved for read and write, the file for open, 0 for close and sync,
+	//failures are 0 for read, write and open, and -1 otherwise
+	uintptr_t result;
+} io_ring_cqe;
+
+//The start of the memory shared with the kernel, the rings follow at their offsets.
+//Userspace moves sq_tail and cq_head, the kernel sq_head and cq_tail. They only count
+//up and are masked with the number of entries, a power of 2, to index the rings.
+typedef struct
+{
+	uint32_t sq_head;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t cq_tail;
+
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+	uint32_t flags;
+
+	uint32_t sq_offset;
+	uint32_t cq_offset;
+} io_ring_header;
+
+static inline io_ring_sqe* io_ring_sq(io_ring_header* r)
+{
+	return (io_ring_sqe*)((uint8_t*)r + r->sq_offset);
+}
+
+static inline io_ring_cqe* io_ring_cq(io_ring_header* r)
+{
+	return (io_ring_cqe*)((uint8_t*)r + r->cq_offset);
+}
+
+//the next free submission, or null if the ring is full, io_ring_submit hands it over
+static inline io_ring_sqe* io_ring_get_sqe(io_ring_header* r)
+{
+	const uint32_t head = __atomic_load_n(&r->sq_head, __ATOMIC_ACQUIRE);
+	if(r->sq_tail - head == r->sq_entries)
+		return (io_ring_sqe*)0;
+
+	return &io_ring_sq(r)[r->sq_tail & (r->sq_entries - 1)];
+}
+
+static inline void io_ring_submit(io_ring_header* r)
+{
+	__atomic_store_n(&r->sq_tail, r->sq_tail + 1, __ATOMIC_RELEASE);
+}
+
+//the oldest completion, or null if there are none, io_ring_seen frees it
+static inline io_ring_cqe* io_ring_peek_cqe(io_ring_header* r)
+{
+	if(__atomic_load_n(&r->cq_tail, __ATOMIC_ACQUIRE) == r->cq_head)
+		return (io_ring_cqe*)0;
+
+	return &io_ring_cq(r)[r->cq_head & (r->cq_entries - 1)];
+}
+
+static inline void io_ring_seen(io_ring_header* r)
+{
+	__atomic_store_n(&r->cq_head, r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
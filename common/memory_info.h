@@ -0,0 +1,35 @@
+#ifndef MEMORY_INFO_H
+#define MEMORY_INFO_H
+
+#include <stddef.h>
+#include <common/task_data.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//how short the system is on physical memory
+#define MEMORY_PRESSURE_NONE 0
+//free memory went below the low watermark, caches are being dropped
+#define MEMORY_PRESSURE_LOW 1
+//there was nothing left to drop, allocations are failing
+#define MEMORY_PRESSURE_CRITICAL 2
+
+typedef struct
+{
+	task_id pid;
+	//pages backed by memory, frames shared with other processes count in each of them
+	size_t resident_pages;
+	//pages of the address space that are allocated, touched or not
+	size_t virtual_pages;
+	//0 if there is no limit
+	size_t max_resident_pages;
+	size_t max_virtual_pages;
+} process_mem_info;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
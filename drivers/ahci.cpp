@@ -5,6 +5,7 @@
 #include <kernel/memorymanager.h>
 #include <kernel/physical_manager.h>
 #include <kernel/kassert.h>
+#include <kernel/dma.h>
 #include <kernel/filesystem/fs_driver.h>
 #include <drivers/ata_cmd.h>
 #include <drivers/pci.h>
@@ -232,6 +233,15 @@ struct __attribute__((packed)) hba_cmd_tbl
 	prdt_entry	prdt[1];	// Physical region descriptor table entries, 0 ~ 65535
 };
 
+// port_rebase leaves room for 8 PRDTs in each command table
+static constexpr dma_constraints ahci_constraints{
+	.limit			  = DMA_LIMIT_32BIT,
+	.boundary		  = 0,
+	.align			  = 2,			// Data base address must be word aligned
+	.max_segment_size = 4 << 20,	// 22 bit byte count
+	.max_segments	  = 8,
+};
+
 enum class ahci_drive_type 
 {
 	SATA,
@@ -494,11 +504,16 @@ bool ahci_access(bool write, const ahci_drive& drive, size_t lba, uint8_t num_se
 		return false;
 	}
 
-	uintptr_t phys_addr = memmanager_get_physical((uintptr_t)buffer);
+	dma_mapping mapping;
+	if(!dma_map(buffer, (size_t)num_sectors << 9, write ? DMA_TO_DEVICE : DMA_FROM_DEVICE,
+				&ahci_constraints, &mapping))
+	{
+		return false;
+	}
 
 	hba_cmd_hdr& header = drive.controller->get_addr((hba_cmd_hdr*)port->clb)[slot];
 
-	size_t num_prdts = ((num_sectors - 1) / 16) + 1;
+	size_t num_prdts = mapping.num_segments;
 
 	header.write_bit = write ? 1 : 0;
 	header.fis_len = sizeof(fis_h2d) / sizeof(uint32_t);	
@@ -507,19 +522,13 @@ bool ahci_access(bool write, const ahci_drive& drive, size_t lba, uint8_t num_se
 	hba_cmd_tbl* cmd_tbl = drive.controller->get_addr((hba_cmd_tbl*)header.cmd_tbl_addr);
 	memset(cmd_tbl, 0, sizeof(hba_cmd_tbl) + (num_prdts - 1) * sizeof(prdt_entry));
 
-	// 8K bytes (16 sectors) per PRDT
-	for(int i = 0; i < num_prdts - 1; i++)
+	// One PRDT per physically contiguous piece of the buffer
+	for(size_t i = 0; i < num_prdts; i++)
 	{
-		cmd_tbl->prdt[i].data_addr = (uint64_t)phys_addr;
-		cmd_tbl->prdt[i].data_size = 8 * 1024 - 1;	// 8K bytes (this value should always be set to 1 less than the actual value)
+		cmd_tbl->prdt[i].data_addr = (uint64_t)mapping.segments[i].address;
+		cmd_tbl->prdt[i].data_size = mapping.segments[i].size - 1;	// this value should always be set to 1 less than the actual value
 		cmd_tbl->prdt[i].int_bit = 1;
-		phys_addr += 4 * 1024;	// 4K words
-		num_sectors -= 16;	// 16 sectors
 	}
-	// Last entry
-	cmd_tbl->prdt[num_prdts - 1].data_addr = (uint64_t)phys_addr;
-	cmd_tbl->prdt[num_prdts - 1].data_size = (num_sectors << 9) - 1;	// 512 bytes per sector
-	cmd_tbl->prdt[num_prdts - 1].int_bit = 1;
 
 	// Setup command
 	fis_h2d* cmd = (fis_h2d*)(&cmd_tbl->cfis);
@@ -546,7 +555,10 @@ bool ahci_access(bool write, const ahci_drive& drive, size_t lba, uint8_t num_se
 
 	port->ci = 1 << slot;	// Issue command
 
-	if(!ahci_wait_complete(port, slot))
+	bool completed = ahci_wait_complete(port, slot);
+	dma_unmap(&mapping);
+
+	if(!completed)
 	{
 		printf("Disk error\n");
 		return false;
@@ -682,11 +694,11 @@ extern "C" int ahci_init(directory_stream * cwd)
 		auto abar = (hba_mem*)v_addr;
 		
 
-		auto mem_size = 296 * 1024;
-		auto phys_base = physical_memory_allocate(mem_size, PAGE_SIZE);
-		auto virt_base = memmanager_map_to_new_pages(phys_base, 
-													 memmanager_minimum_pages(mem_size),
-													 PAGE_PRESENT | PAGE_RW);
+		dma_region mem;
+		if(!dma_allocate(296 * 1024, &ahci_constraints, &mem))
+		{
+			return;
+		}
 
 		printf("%X\n", bar5);
 
@@ -694,8 +706,8 @@ extern "C" int ahci_init(directory_stream * cwd)
 		{
 			.abar = abar,
 			.num_cmd_slots = (abar->cap & 0x0f00) >> 8,
-			.phys_base = phys_base,
-			.virt_base = (uintptr_t)virt_base
+			.phys_base = (uintptr_t)mem.physical,
+			.virt_base = (uintptr_t)mem.address
 		};
 
 		probe_port(*c);
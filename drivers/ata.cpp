@@ -133,7 +133,7 @@ static void ata_wait_irq(size_t index)
 	irq_flags[index].clear();
 }
 
-static void ata_delay400(uint8_t channel)
+static INT_CALLABLE void ata_delay400(uint8_t channel)
 {
 	//Delay 400 nanoseconds by reading ALTSTATUS (100ns each)
 	for(size_t i = 0; i < 4; i++)
@@ -142,7 +142,7 @@ static void ata_delay400(uint8_t channel)
 	}
 }
 
-static ata_error ata_poll(uint8_t channel, bool check_status = false)
+static INT_CALLABLE ata_error ata_poll(uint8_t channel, bool check_status = false)
 {
 	//wait for BSY to be set:
 	ata_delay400(channel);
@@ -233,7 +233,7 @@ static ata_error ata_print_error(const ata_drive& drive, ata_error err)
 
 	return err;
 }
-static ata_addressing_mode ata_setup_transfer(ata_drive& drive, size_t lba, uint8_t numsects)
+static INT_CALLABLE ata_addressing_mode ata_setup_transfer(ata_drive& drive, size_t lba, uint8_t numsects)
 {
 	uint8_t		lba_io[6];
 
@@ -310,76 +310,243 @@ static ata_addressing_mode ata_setup_transfer(ata_drive& drive, size_t lba, uint
 	return adress_mode;
 }
 
-static ata_error ata_do_read(ata_drive& drive, size_t lba, uint8_t num_sectors,
-							 uint8_t* buffer)
+//a submitted transfer, carried on a sector at a time by the interrupt handler
+struct ata_transfer
 {
-	k_assert(buffer);
+	disk_request* request;
+	ata_drive* drive;
+	size_t lba;
+	size_t left;
+	size_t left_in_command;
+	uint8_t* buffer;
+	bool lba48;
+	bool flushing;
+};
 
-	auto adress_mode = ata_setup_transfer(drive, lba, num_sectors);
+static ata_transfer transfers[2];
+//submitted requests waiting for their channel, in order
+static disk_request* pending[2];
+//a synchronous ATAPI transfer has the channel
+static bool channel_claimed[2];
 
-	uint8_t read_cmd = (adress_mode == ata_addressing_mode::LBA48) ?
-		ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+//the rest of these run with interrupts off
 
-	auto channel = drive.channel;
+static INT_CALLABLE void ata_transfer_sector(uint8_t channel)
+{
+	auto& t			   = transfers[channel];
 	uint16_t base_port = channels[channel].base;
 
-	outb(base_port + ATA_REG_COMMAND, read_cmd);
-	ata_delay400(channel);
+	if(t.request->write)
+		outsw(base_port, (uint16_t*)t.buffer, WORDS_PER_SECTOR);
+	else
+		insw(base_port, (uint16_t*)t.buffer, WORDS_PER_SECTOR);
 
-	for(size_t i = 0; i < num_sectors; i++)
+	t.buffer += WORDS_PER_SECTOR * sizeof(uint16_t);
+	t.left--;
+	t.left_in_command--;
+}
+
+static INT_CALLABLE void ata_start_command(uint8_t channel)
+{
+	auto& t = transfers[channel];
+
+	const uint8_t num_sectors = (uint8_t)(t.left < 255 ? t.left : 255);
+
+	t.lba48 = ata_setup_transfer(*t.drive, t.lba, num_sectors) == ata_addressing_mode::LBA48;
+	t.lba += num_sectors;
+	t.left_in_command = num_sectors;
+
+	uint16_t base_port = channels[channel].base;
+
+	if(t.request->write)
 	{
-		ata_wait_irq(channel);
-		if(auto err = ata_poll(channel, true); err != ata_error::NONE)
-		{
-			return err;
-		}
-		insw(base_port, (uint16_t*)buffer, WORDS_PER_SECTOR);
-		buffer += (WORDS_PER_SECTOR * sizeof(uint16_t));
+		outb(base_port + ATA_REG_COMMAND, t.lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO);
+
+		//the first sector goes right away, there's an interrupt once each one is taken
+		ata_poll(channel);
+		ata_transfer_sector(channel);
+	}
+	else
+	{
+		//there's an interrupt once each sector is ready
+		outb(base_port + ATA_REG_COMMAND, t.lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO);
 	}
+}
 
-	return ata_error::NONE;
+static INT_CALLABLE void ata_start_next(uint8_t channel)
+{
+	auto& t = transfers[channel];
+
+	if(t.request || channel_claimed[channel] || !pending[channel])
+		return;
+
+	auto r			 = pending[channel];
+	pending[channel] = r->next;
+
+	t = ata_transfer{
+		.request		 = r,
+		.drive			 = (ata_drive*)r->driver_private,
+		.lba			 = r->block_number,
+		.left			 = r->num_blocks,
+		.left_in_command = 0,
+		.buffer			 = r->buf,
+		.lba48			 = false,
+		.flushing		 = false,
+	};
+
+	ata_start_command(channel);
 }
 
-static ata_error ata_do_write(ata_drive& drive, size_t lba, uint8_t num_sectors,
-							  const uint8_t* buffer)
+static INT_CALLABLE void ata_finish(uint8_t channel, int status)
 {
-	k_assert(buffer);
+	auto r = transfers[channel].request;
+	transfers[channel].request = nullptr;
 
-	auto adress_mode = ata_setup_transfer(drive, lba, num_sectors);
+	r->complete(r, status);
+	ata_start_next(channel);
+}
 
-	uint8_t write_cmd = (adress_mode == ata_addressing_mode::LBA48) ?
-		ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
+//called from the interrupt handlers, returns false if the channel has no transfer going
+static INT_CALLABLE bool ata_service_irq(uint8_t channel, uint8_t status)
+{
+	auto& t = transfers[channel];
 
-	auto channel = drive.channel;
-	uint16_t base_port = channels[channel].base;
+	if(!t.request)
+		return false;
 
-	outb(base_port + ATA_REG_COMMAND, write_cmd);
-	ata_delay400(channel);
+	if(status & (ATA_SR_ERR | ATA_SR_DF))
+	{
+		ata_finish(channel, -1);
+	}
+	else if(t.flushing)
+	{
+		ata_finish(channel, 0);
+	}
+	else if(!t.request->write)
+	{
+		ata_transfer_sector(channel);
 
-	for(size_t i = 0; i < num_sectors; i++)
+		if(!t.left)
+			ata_finish(channel, 0);
+		else if(!t.left_in_command)
+			ata_start_command(channel);
+	}
+	else if(t.left_in_command)
 	{
-		//ata_wait_irq(channel);
-		ata_poll(channel);
-		outsw(base_port, (uint16_t*)buffer, WORDS_PER_SECTOR);
-		buffer += (WORDS_PER_SECTOR * sizeof(uint16_t));
+		ata_transfer_sector(channel);
+	}
+	else if(t.left)
+	{
+		ata_start_command(channel);
+	}
+	else
+	{
+		outb(channels[channel].base + ATA_REG_COMMAND,
+			 t.lba48 ? ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+		t.flushing = true;
 	}
 
-	uint8_t flush_cmd = (adress_mode == ata_addressing_mode::LBA48) ?
-		ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH;
+	return true;
+}
 
-	outb(base_port + ATA_REG_COMMAND, flush_cmd);
-	ata_delay400(channel);
-	ata_poll(channel);
+static int ata_submit(void* drv_data, disk_request* r)
+{
+	ata_drive* drive = (ata_drive*)drv_data;
 
-	return ata_error::NONE;
+	//ATAPI drives are only read synchronously
+	if(!drive->exists || drive->type != ata_drive_type::ATA ||
+	   r->block_number + r->num_blocks > drive->size)
+	{
+		return -1;
+	}
+
+	if(r->num_blocks == 0)
+	{
+		r->complete(r, 0);
+		return 0;
+	}
+
+	r->driver_private = drive;
+	r->next			  = nullptr;
+
+	sync::interrupt_lock l{};
+
+	disk_request** it = &pending[drive->channel];
+	while(*it)
+	{
+		it = &(*it)->next;
+	}
+	*it = r;
+
+	ata_start_next(drive->channel);
+	return 0;
+}
+
+struct ata_waiter
+{
+	sync::atomic_flag done;
+	int status;
+};
+
+static INT_CALLABLE void ata_wake_waiter(disk_request* r, int status)
+{
+	auto w	  = (ata_waiter*)r->data;
+	w->status = status;
+	w->done.test_and_set();
+	w->done.notify_one();
+}
+
+//the synchronous calls submit a request and wait for it
+static ata_error ata_transfer_wait(ata_drive& drive, bool write, size_t lba, uint8_t* buffer,
+								   size_t num_sectors)
+{
+	ata_waiter w{};
+	disk_request r{write, lba, buffer, num_sectors, ata_wake_waiter, &w, nullptr, nullptr};
+
+	if(ata_submit(&drive, &r) != 0)
+		return ata_error::INVALID_SEEK_POS;
+
+	w.done.wait(false);
+	return w.status == 0 ? ata_error::NONE : ata_error::GENERAL_ERROR;
+}
+
+//keeps submitted transfers off the channel while a synchronous one uses it
+static void ata_claim_channel(uint8_t channel)
+{
+	while(true)
+	{
+		{
+			sync::interrupt_lock l{};
+
+			if(!transfers[channel].request && !channel_claimed[channel])
+			{
+				channel_claimed[channel] = true;
+				return;
+			}
+		}
+
+		run_background_tasks();
+	}
+}
+
+static void ata_release_channel(uint8_t channel)
+{
+	sync::interrupt_lock l{};
+
+	channel_claimed[channel] = false;
+	ata_start_next(channel);
 }
 
 static INTERRUPT_HANDLER void ata_irq_handler0(interrupt_frame* r)
 {
 	setup_segs();
 
-	inb(channels[0].base + ATA_REG_STATUS);
+	uint8_t status = inb(channels[0].base + ATA_REG_STATUS);
 	acknowledge_irq(14);
+
+	if(ata_service_irq(0, status))
+		return;
+
 	irq_flags[0].test_and_set();
 	irq_flags[0].notify_one();
 }
@@ -391,8 +558,12 @@ static INTERRUPT_HANDLER void ata_irq_handler1(interrupt_frame* r)
 	outb(0xA0, 0x0B);
 	if(inb(0xA0) & (1 << 7))
 	{
-		inb(channels[1].base + ATA_REG_STATUS);
+		uint8_t status = inb(channels[1].base + ATA_REG_STATUS);
 		acknowledge_irq(15);
+
+		if(ata_service_irq(1, status))
+			return;
+
 		irq_flags[1].test_and_set();
 		irq_flags[1].notify_one();
 	}
@@ -489,13 +660,14 @@ static ata_error ata_read_sectors(ata_drive& drive, size_t num_sectors,
 		auto err = ata_error::NONE;
 		if(drive.type == ata_drive_type::ATA)
 		{
-			foreach_n_sectors<255>(drive, lba, num_sectors, buffer,
-								   ATA_SECTOR_SIZE, ata_do_read);
+			err = ata_transfer_wait(drive, false, lba, buffer, num_sectors);
 		}
 		else if(drive.type == ata_drive_type::ATAPI)
 		{
+			ata_claim_channel(drive.channel);
 			foreach_n_sectors<255>(drive, lba, num_sectors, buffer,
 								   ATAPI_SECTOR_SIZE, ata_atapi_read);
+			ata_release_channel(drive.channel);
 		}
 
 		return ata_print_error(drive, err);
@@ -518,8 +690,7 @@ static ata_error ata_write_sectors(ata_drive& drive, size_t num_sectors,
 		auto err = ata_error::NONE;
 		if(drive.type == ata_drive_type::ATA)
 		{
-			err = foreach_n_sectors<255>(drive, lba, num_sectors, buffer,
-										 ATA_SECTOR_SIZE, ata_do_write);
+			err = ata_transfer_wait(drive, true, lba, const_cast<uint8_t*>(buffer), num_sectors);
 		}
 		else if(drive.type == ata_drive_type::ATAPI)
 		{
@@ -555,7 +726,10 @@ static disk_driver ata_driver = {
 	ata_read_blocks,
 	ata_write_blocks,
 	nullptr,
-	nullptr
+	nullptr,
+	ata_submit,
+	//the channel runs one command at a time, the rest wait in the driver's queue
+	4
 };
 
 static bool ata_check_status(uint8_t channel)
@@ -762,12 +936,17 @@ static INTERRUPT_HANDLER void ata_irq_handler(interrupt_frame* r)
 		outb(channels[0].bus_master + 0x2, 0x04);
 	}*/
 
-	inb(channels[0].base + ATA_REG_STATUS);
-	inb(channels[1].base + ATA_REG_STATUS);
-	irq_flags[0].test_and_set();
-	irq_flags[1].test_and_set();
-	irq_flags[0].notify_one();
-	irq_flags[1].notify_one();
+	for(uint8_t channel = 0; channel < 2; channel++)
+	{
+		uint8_t status = inb(channels[channel].base + ATA_REG_STATUS);
+
+		//both channels share the line, one that's still busy didn't raise it
+		if(!(status & ATA_SR_BSY) && ata_service_irq(channel, status))
+			continue;
+
+		irq_flags[channel].test_and_set();
+		irq_flags[channel].notify_one();
+	}
 
 	//outb(channels[0].bus_master + 0x2, inb(channels[0].bus_master + 0x2) | 4);
 
@@ -24,6 +24,24 @@ pmode:
 	mov ebp, stack.top
 	mov esp, ebp
 
+	; paging features the boot cpu uses, PAE has to be on before paging is
+	mov eax, dword [cr4_bits]
+	test eax, eax
+	jz .no_cr4
+	mov ecx, cr4
+	or ecx, eax
+	mov cr4, ecx
+.no_cr4:
+
+	mov ebx, dword [efer_bits]
+	test ebx, ebx
+	jz .no_efer
+	mov ecx, 0xC0000080
+	rdmsr
+	or eax, ebx
+	wrmsr
+.no_efer:
+
 	mov eax, dword [page_dir]
 	mov cr3, eax
 
@@ -57,4 +75,6 @@ flat_gdt_descriptor :
 ap_bootstrap_params:
 	page_dir: dd 0
 	entry_point: dd 0
-	processor_id: dd 0
\ No newline at end of file
+	processor_id: dd 0
+	cr4_bits: dd 0
+	efer_bits: dd 0
\ No newline at end of file
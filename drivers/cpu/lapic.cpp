@@ -67,6 +67,8 @@ struct __attribute__((packed)) ap_bootstrap_params
 	uint32_t page_dir;
 	uint32_t entry_point;
 	uint32_t processor_id;
+	uint32_t cr4_bits;
+	uint32_t efer_bits;
 };
 
 extern uint8_t _binary_ap_bootstrap_bin_start;
@@ -89,6 +91,11 @@ void init_smp(uintptr_t lapic_phys_addr, std::vector<cpu_core>& cores)
 	params->page_dir	= std::bit_cast<uint32_t>(get_page_directory());
 	params->entry_point = std::bit_cast<uint32_t>(&test_entry_point);
 
+	uint32_t cr4_bits, efer_bits;
+	memmanager_get_paging_bits(&cr4_bits, &efer_bits);
+	params->cr4_bits  = cr4_bits;
+	params->efer_bits = efer_bits;
+
 	printf("pdir: %X\n", params->page_dir);
 
 	auto lapic_addr =
@@ -336,6 +336,8 @@ static mount_status ext2_mount_disk(filesystem_virtual_drive* d)
 	};
 
 	d->fs_impl_data = fs;
+
+	filesystem_set_cache_line(d, fs->block_size);
 	return MOUNT_SUCCESS;
 }
 
@@ -378,6 +380,51 @@ static size_t ext2_read(uint8_t* buf, size_t start_cluster, file_size_t offset,
 	return block_num;
 }
 
+static size_t ext2_map_chunks(disk_extent* extents, size_t max_extents, fs_index start_cluster,
+							  file_size_t offset, size_t size, const file_data_block* file,
+							  const filesystem_virtual_drive* d)
+{
+	auto fs	   = (ext2fs*)d->fs_impl_data;
+	auto fdata = std::bit_cast<ext2_format_data>(file->format_data);
+
+	if(size == 0)
+		return 0;
+
+	const auto inod = fs->locate_inode(fdata.curr_inode);
+
+	const size_t first = start_cluster + (size_t)(offset >> fs->log2_block_size);
+	const size_t last  = start_cluster + (size_t)((offset + size - 1) >> fs->log2_block_size);
+
+	const size_t d_blocks = (size_t)1 << fs->d_blocks_per_block_log2;
+
+	size_t num_extents = 0;
+	for(size_t n = first; n <= last; n++)
+	{
+		const size_t blk = fs->get_block_n(inod, (uint32_t)n);
+
+		//a hole, there's nothing on the disk to read
+		if(blk == 0)
+			continue;
+
+		const size_t lba = blk << fs->d_blocks_per_block_log2;
+
+		auto prev = num_extents ? &extents[num_extents - 1] : nullptr;
+		if(prev && prev->block + prev->num_blocks == lba)
+		{
+			prev->num_blocks += d_blocks;
+		}
+		else
+		{
+			if(num_extents == max_extents)
+				break;
+
+			extents[num_extents++] = disk_extent{lba, d_blocks};
+		}
+	}
+
+	return num_extents;
+}
+
 static size_t ext2_write(const uint8_t* buf, size_t start_cluster,
 						 file_size_t offset, size_t size,
 						 const file_data_block* file,
@@ -678,6 +725,7 @@ static const filesystem_driver ext2_driver = {
 	ext2_update_file,
 	ext2_create_file,
 	nullptr,
+	ext2_map_chunks,
 };
 
 extern "C" void ext2_init()
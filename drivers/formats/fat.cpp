@@ -684,6 +684,8 @@ static mount_status fat_mount_disk(filesystem_virtual_drive* d)
 
 	f->cached_fat_sector = 0;
 
+	filesystem_set_cache_line(d, f->cluster_size);
+
 	auto loc = (f->type == FAT_12 || f->type == FAT_16) ? 0 : f->root_location;
 
 	d->root_dir = {
@@ -803,6 +805,52 @@ static size_t fat_read(uint8_t* buf, size_t start_cluster, file_size_t offset,
 	return cluster;
 }
 
+//follows the chain once for the whole range, not once per cluster like a read of it would
+static size_t fat_map_chunks(disk_extent* extents, size_t max_extents, fs_index start_cluster,
+							 file_size_t offset, size_t size, const file_data_block* file,
+							 const filesystem_virtual_drive* d)
+{
+	fat_drive* f = (fat_drive*)d->fs_impl_data;
+
+	//the fixed root directory isn't made of clusters
+	if((f->type == FAT_12 || f->type == FAT_16) && (file->flags & FAT_ROOT_DIR_FLAG))
+		return 0;
+
+	if(size == 0 || start_cluster < 2 || start_cluster >= f->eof_value)
+		return 0;
+
+	const size_t first = (size_t)(offset >> f->cluster_size_log2);
+	const size_t last  = (size_t)((offset + size - 1) >> f->cluster_size_log2);
+
+	const size_t blocks_per_cluster = f->cluster_size / d->block_size;
+
+	auto cluster = fat_get_relative_cluster(start_cluster, first, d);
+
+	size_t num_extents = 0;
+	for(size_t i = first; i <= last && cluster < f->eof_value; i++)
+	{
+		const size_t lba = fat_cluster_to_block(f, cluster);
+
+		auto prev = num_extents ? &extents[num_extents - 1] : nullptr;
+		if(prev && prev->block + prev->num_blocks == lba)
+		{
+			prev->num_blocks += blocks_per_cluster;
+		}
+		else
+		{
+			if(num_extents == max_extents)
+				break;
+
+			extents[num_extents++] = disk_extent{lba, blocks_per_cluster};
+		}
+
+		if(i != last)
+			cluster = fat_get_next_cluster(cluster, d);
+	}
+
+	return num_extents;
+}
+
 template<fat_type T> static size_t do_write_to_fat(size_t previous, size_t first_cluster, size_t num_clusters, const filesystem_virtual_drive* fd)
 {
 	if(previous != 0)
@@ -1169,7 +1217,8 @@ static const filesystem_driver fat_driver = {
 	fat_read_dir,
 	fat_update_file,
 	fat_create_file,
-	fat_delete_file
+	fat_delete_file,
+	fat_map_chunks
 };
 
 extern "C" void fat_init()
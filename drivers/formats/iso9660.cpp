@@ -249,6 +249,25 @@ static fs_index iso9660_read_chunks(uint8_t* dest, fs_index location,
 	return location + ((f_offset + num_bytes) >> f->sector_size_log2);
 }
 
+//files are in one piece on the disk
+static size_t iso9660_map_chunks(disk_extent* extents, size_t max_extents, fs_index location,
+								 file_size_t offset, size_t num_bytes,
+								 const file_data_block* file,
+								 const filesystem_virtual_drive* fd)
+{
+	iso9660_drive* f = (iso9660_drive*)fd->fs_impl_data;
+
+	if(num_bytes == 0 || max_extents == 0)
+		return 0;
+
+	const size_t start = location << f->blocks_per_sector_log2;
+	const size_t first = (size_t)(offset / fd->block_size);
+	const size_t last  = (size_t)((offset + num_bytes - 1) / fd->block_size);
+
+	extents[0] = disk_extent{start + first, last - first + 1};
+	return 1;
+}
+
 static void iso9660_read_dir(directory_stream* dest, const file_data_block* file, const filesystem_virtual_drive* fd)
 {
 	const iso9660_drive* f = (iso9660_drive*)fd->fs_impl_data;
@@ -332,7 +351,9 @@ static filesystem_driver iso9660_driver = {
 	nullptr,
 	iso9660_read_dir,
 	nullptr,
-	nullptr
+	nullptr,
+	nullptr,
+	iso9660_map_chunks
 };
 
 extern "C" void iso9660_init(void)
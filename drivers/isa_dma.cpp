@@ -7,6 +7,7 @@
 #include <kernel/memorymanager.h>
 #include <kernel/physical_manager.h>
 #include <kernel/kassert.h>
+#include <kernel/dma.h>
 
 #include "isa_dma.h" 
 
@@ -20,6 +21,15 @@ static constexpr uint8_t page_port[8] = {0x87, 0x83, 0x81, 0x82, 0x8F, 0x8B, 0x8
 static constexpr uint8_t adress_port[8] = {0x00, 0x02, 0x04, 0x06, 0xC0, 0xC4, 0xC8, 0xCC};
 static constexpr uint8_t count_port[8] = {0x01, 0x03, 0x05, 0x07, 0xC2, 0xC6, 0xCA, 0xCE};
 
+//transfers can't cross a 64k boundary, and the page register only holds 8 bits
+static constexpr dma_constraints isa_constraints{
+	.limit			  = DMA_LIMIT_ISA,
+	.boundary		  = 0x10000,
+	.align			  = 0,
+	.max_segment_size = 0x10000,
+	.max_segments	  = 1,
+};
+
 static bool check_continuity(uintptr_t v, size_t size)
 {
 	uintptr_t start = (uint32_t)v & ~(PAGE_SIZE - 1);
@@ -148,25 +158,13 @@ uint8_t* isa_dma_allocate_buffer(size_t size)
 		}
 	}
 
-	size_t size_in_pages = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
-	size_t buffer_size = size_in_pages * PAGE_SIZE;
-
-	for(uintptr_t address = 0; address < 0xFFFFFF; address += 0x10000)
-	{
-		uintptr_t physical = physical_memory_allocate_in_range(address,
-															   address + 0x10000,
-															   buffer_size,
-															   PAGE_SIZE);
-		if(physical != (uintptr_t)NULL)
-		{
-			auto virt = (uint8_t*)memmanager_map_to_new_pages(physical, size_in_pages,
-															  PAGE_PRESENT | PAGE_RW);
-			buffers->push_back(dma_buffer{virt, buffer_size, size});
-			return virt;
-		}
-	}
+	dma_region region;
+	if(!dma_allocate(size, &isa_constraints, &region))
+		return nullptr;
 
-	return nullptr;
+	auto virt = (uint8_t*)region.address;
+	buffers->push_back(dma_buffer{virt, region.size, size});
+	return virt;
 }
 
 int isa_dma_free_buffer(uint8_t* buf, size_t size)
@@ -177,9 +175,10 @@ int isa_dma_free_buffer(uint8_t* buf, size_t size)
 		{
 			if(r == 0)
 			{
-				size_t num_pages = (size + (PAGE_SIZE - 1)) / PAGE_SIZE;
-	
-				return memmanager_free_pages(buffer.buffer, num_pages);
+				dma_region region{buffer.buffer, memmanager_get_physical((uintptr_t)buffer.buffer),
+								  memmanager_minimum_pages(size) * PAGE_SIZE};
+				dma_free(&region);
+				return 0;
 			}
 			return 0;
 		}
@@ -28,10 +28,22 @@ RECLAIMABLE void reserve_boot_mem()
 			(uintptr_t)addr < (memmap + boot_information.memmap_size);)
 		{
 			multiboot_mmap_entry* entry = (multiboot_mmap_entry*)addr;
-			if(entry->m_type == 1 && entry->m_length)
+
+			//clip the entry to what can be addressed, instead of letting it wrap around
+			uint64_t begin = entry->m_addr;
+			uint64_t end   = entry->m_addr + entry->m_length;
+			if(end > PHYSICAL_ADDRESS_LIMIT)
+				end = PHYSICAL_ADDRESS_LIMIT;
+
+			//freed in pieces since a size_t can't hold all of it
+			while(entry->m_type == 1 && begin < end)
 			{
-				physical_memory_free((uintptr_t)entry->m_addr,
-									 (size_t)entry->m_length);
+				uint64_t length = end - begin;
+				if(length > 0x40000000u)
+					length = 0x40000000u;
+
+				physical_memory_free((phys_addr_t)begin, (size_t)length);
+				begin += length;
 			}
 			addr += entry->m_size + sizeof(uint32_t);
 		}
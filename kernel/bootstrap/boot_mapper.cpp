@@ -2,16 +2,28 @@
 #include <stdint.h>
 #include <kernel/memorymanager.h>
 
-alignas(4096) RECLAIMABLE_BSS static constinit uintptr_t pd[PAGE_TABLE_SIZE];
-alignas(4096) RECLAIMABLE_BSS static constinit uintptr_t pt[PAGE_TABLE_SIZE];
+//the 4 MiB the kernel is linked into, everything mapped here goes in this window
+#define BOOT_WINDOW_SIZE 0x400000u
+#define BOOT_PT_ENTRIES (BOOT_WINDOW_SIZE / PAGE_SIZE)
+
+#ifdef __PAE
+typedef uint64_t boot_pte_t;
+alignas(32) RECLAIMABLE_BSS static constinit boot_pte_t pdpt[4];
+#else
+typedef uintptr_t boot_pte_t;
+#endif
+
+alignas(4096) RECLAIMABLE_BSS static constinit boot_pte_t pd[PAGE_TABLE_SIZE];
+//with PAE this is 2 page tables back to back
+alignas(4096) RECLAIMABLE_BSS static constinit boot_pte_t pt[BOOT_PT_ENTRIES];
 
 RECLAIMABLE_BSS static uintptr_t pt_base = 0;
 
 #define PAGE_MASK (PAGE_SIZE - 1)
 
-extern "C" RECLAIMABLE void boot_mapper_remap_mem(uintptr_t virt, uintptr_t phys)
+extern "C" RECLAIMABLE void boot_mapper_remap_mem(uintptr_t virt, phys_addr_t phys)
 {
-	pt[(virt >> 12) & (PAGE_TABLE_SIZE - 1)] = phys | PAGE_PRESENT | PAGE_RW;
+	pt[(virt >> 12) & (BOOT_PT_ENTRIES - 1)] = phys | PAGE_PRESENT | PAGE_RW;
 }
 
 extern "C" RECLAIMABLE uintptr_t boot_mapper_map_mem(uintptr_t addr,
@@ -23,7 +35,7 @@ extern "C" RECLAIMABLE uintptr_t boot_mapper_map_mem(uintptr_t addr,
 	size_t num_pages = memmanager_minimum_pages(offset + bytes);
 	size_t pages_found = 0;
 
-	for(size_t i = PAGE_TABLE_SIZE - 1; i > 0; --i)
+	for(size_t i = BOOT_PT_ENTRIES - 1; i > 0; --i)
 	{
 		if(pt[i] == 0)
 		{
@@ -58,14 +70,34 @@ extern "C" RECLAIMABLE uintptr_t boot_remap_addresses(uintptr_t kernel_VM,
 													  size_t kernel_size,
 													  uintptr_t kernel_offset)
 {
+	pt_base = kernel_VM & ~(BOOT_WINDOW_SIZE - 1);
+
+#ifdef __PAE
+	//only the page directory for the top 1 GiB is needed
+	pdpt[3] = (uintptr_t)pd | PAGE_PRESENT;
+
+	for(size_t i = 0; i < BOOT_PT_ENTRIES / PAGE_TABLE_SIZE; i++)
+	{
+		pd[((pt_base >> 21) & (PAGE_TABLE_SIZE - 1)) + i] =
+			(uintptr_t)&pt[i * PAGE_TABLE_SIZE] | PAGE_PRESENT | PAGE_RW;
+	}
+
+	//PAE has to be on before paging is
+	__asm__ volatile(
+		"mov %%cr4, %%eax\n"
+		"or $0x20, %%eax\n"
+		"mov %%eax, %%cr4"
+		:
+		:
+		: "%eax");
+#else
 	//the last entry in the page dir is mapped to the page dir
 	pd[PAGE_TABLE_SIZE - 1] = (uintptr_t)pd | PAGE_PRESENT | PAGE_RW;
 
-	pt_base = (kernel_VM >> 22) << 22;
-
 	pd[kernel_VM >> 22] = (uintptr_t)pt | PAGE_PRESENT | PAGE_RW;
+#endif
 
-	auto pg_start = (kernel_VM >> 12) & (PAGE_TABLE_SIZE - 1);
+	auto pg_start = (kernel_VM >> 12) & (BOOT_PT_ENTRIES - 1);
 
 	size_t num_k_pages = memmanager_minimum_pages(kernel_size);
 
@@ -81,5 +113,9 @@ extern "C" RECLAIMABLE uintptr_t boot_remap_addresses(uintptr_t kernel_VM,
 		pg_start++;
 	}
 
+#ifdef __PAE
+	return (uintptr_t)&pdpt[0];
+#else
 	return (uintptr_t)&pd[0];
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,263 @@
+#include <kernel/dma.h>
+#include <kernel/memorymanager.h>
+#include <kernel/page_reclaim.h>
+#include <kernel/locks.h>
+
+//bounce buffers that were used recently, low memory is scarce and fragments easily
+#define BOUNCE_POOL_SIZE 8
+
+static dma_region bounce_pool[BOUNCE_POOL_SIZE];
+static size_t bounce_pool_count = 0;
+static bool reclaimer_added		= false;
+static constinit sync::mutex bounce_mutex{};
+
+//one past the last byte physical_memory_allocate_in_range may hand out
+static uintptr_t dma_physical_end(const dma_constraints* constraints)
+{
+	if(!constraints->limit || constraints->limit >= DMA_LIMIT_32BIT)
+		return (uintptr_t)0 - PAGE_SIZE;
+
+	return (uintptr_t)constraints->limit;
+}
+
+bool dma_allocate(size_t size, const dma_constraints* constraints, dma_region* region)
+{
+	const size_t num_pages = memmanager_minimum_pages(size);
+	const size_t bytes	   = num_pages * PAGE_SIZE;
+
+	size_t align = constraints->align > PAGE_SIZE ? constraints->align : PAGE_SIZE;
+
+	if(constraints->boundary)
+	{
+		if(bytes > constraints->boundary)
+			return false;
+
+		//aligned to its own size rounded up, it can't straddle a boundary
+		while(align < bytes)
+		{
+			align <<= 1;
+		}
+	}
+
+	uintptr_t physical = physical_memory_allocate_in_range(0, dma_physical_end(constraints),
+														   bytes, align);
+	if(!physical)
+		return false;
+
+	void* address = memmanager_map_to_new_pages(physical, num_pages, PAGE_PRESENT | PAGE_RW);
+	if(!address)
+	{
+		physical_memory_free(physical, bytes);
+		return false;
+	}
+
+	*region = dma_region{address, physical, bytes};
+	return true;
+}
+
+void dma_free(dma_region* region)
+{
+	if(!region->address)
+		return;
+
+	memmanager_unmap_pages(region->address, region->size / PAGE_SIZE);
+	physical_memory_free(region->physical, region->size);
+
+	*region = dma_region{};
+}
+
+static bool dma_region_fits(const dma_region& region, size_t size, const dma_constraints* constraints)
+{
+	if(region.size < size)
+		return false;
+
+	if(constraints->limit && region.physical + size > constraints->limit)
+		return false;
+
+	if(constraints->align && (region.physical & (constraints->align - 1)))
+		return false;
+
+	if(constraints->boundary)
+	{
+		const phys_addr_t mask = ~(phys_addr_t)(constraints->boundary - 1);
+		if((region.physical & mask) != ((region.physical + size - 1) & mask))
+			return false;
+	}
+
+	return true;
+}
+
+//frees the pooled bounce buffers when memory runs low
+static size_t dma_reclaim_bounce(void*, size_t num_bytes)
+{
+	//someone is taking or returning a buffer, it can wait for the next round
+	if(!bounce_mutex.try_lock())
+		return 0;
+
+	size_t freed = 0;
+	while(bounce_pool_count && freed < num_bytes)
+	{
+		auto& region = bounce_pool[--bounce_pool_count];
+		freed += region.size;
+		dma_free(&region);
+	}
+
+	bounce_mutex.unlock();
+	return freed;
+}
+
+static bool dma_take_bounce(size_t size, const dma_constraints* constraints, dma_region* region)
+{
+	{
+		sync::lock_guard l{bounce_mutex};
+
+		for(size_t i = 0; i < bounce_pool_count; i++)
+		{
+			if(dma_region_fits(bounce_pool[i], size, constraints))
+			{
+				*region		   = bounce_pool[i];
+				bounce_pool[i] = bounce_pool[--bounce_pool_count];
+				return true;
+			}
+		}
+	}
+
+	return dma_allocate(size, constraints, region);
+}
+
+static void dma_return_bounce(dma_region* region)
+{
+	{
+		sync::lock_guard l{bounce_mutex};
+
+		if(!reclaimer_added)
+		{
+			page_reclaim_add(dma_reclaim_bounce, nullptr);
+			reclaimer_added = true;
+		}
+
+		if(bounce_pool_count < BOUNCE_POOL_SIZE)
+		{
+			bounce_pool[bounce_pool_count++] = *region;
+			*region							  = dma_region{};
+			return;
+		}
+	}
+
+	dma_free(region);
+}
+
+//adds physically contiguous bytes to the list, splitting them where the device needs it
+static bool dma_add_range(dma_mapping* mapping, phys_addr_t physical, size_t size,
+						  const dma_constraints* constraints)
+{
+	size_t max_segments = DMA_MAX_SEGMENTS;
+	if(constraints->max_segments && constraints->max_segments < max_segments)
+		max_segments = constraints->max_segments;
+
+	if(constraints->limit && physical + size > constraints->limit)
+		return false;
+
+	const size_t boundary = constraints->boundary;
+	const size_t max_size = constraints->max_segment_size;
+
+	while(size)
+	{
+		size_t piece = size;
+		if(boundary && piece > boundary - (size_t)(physical & (boundary - 1)))
+			piece = boundary - (size_t)(physical & (boundary - 1));
+
+		dma_segment* last = mapping->num_segments ? &mapping->segments[mapping->num_segments - 1]
+												  : nullptr;
+
+		//grow the last segment if it ends right here, and this doesn't start past a boundary
+		if(last && last->address + last->size == physical &&
+		   (!boundary || (physical & (boundary - 1))) && (!max_size || last->size < max_size))
+		{
+			if(max_size && last->size + piece > max_size)
+				piece = max_size - last->size;
+
+			last->size += piece;
+		}
+		else
+		{
+			if(mapping->num_segments == max_segments)
+				return false;
+
+			if(constraints->align && (physical & (constraints->align - 1)))
+				return false;
+
+			if(max_size && piece > max_size)
+				piece = max_size;
+
+			mapping->segments[mapping->num_segments++] = dma_segment{physical, piece};
+		}
+
+		physical += piece;
+		size -= piece;
+	}
+
+	return true;
+}
+
+static bool dma_build_segments(uintptr_t address, size_t size, const dma_constraints* constraints,
+							   dma_mapping* mapping)
+{
+	mapping->num_segments = 0;
+
+	while(size)
+	{
+		const size_t offset = address & (PAGE_SIZE - 1);
+		const size_t chunk	= size < PAGE_SIZE - offset ? size : PAGE_SIZE - offset;
+
+		phys_addr_t page = memmanager_get_physical(address & ~(uintptr_t)(PAGE_SIZE - 1));
+		if(!page)
+			return false;
+
+		if(!dma_add_range(mapping, page + offset, chunk, constraints))
+			return false;
+
+		address += chunk;
+		size -= chunk;
+	}
+
+	return true;
+}
+
+bool dma_map(void* buffer, size_t size, int direction, const dma_constraints* constraints,
+			 dma_mapping* mapping)
+{
+	mapping->bounce	   = dma_region{};
+	mapping->buffer	   = buffer;
+	mapping->size	   = size;
+	mapping->direction = direction;
+
+	if(dma_build_segments((uintptr_t)buffer, size, constraints, mapping))
+		return true;
+
+	if(!dma_take_bounce(size, constraints, &mapping->bounce))
+		return false;
+
+	if(direction & DMA_TO_DEVICE)
+		memcpy(mapping->bounce.address, buffer, size);
+
+	if(!dma_build_segments((uintptr_t)mapping->bounce.address, size, constraints, mapping))
+	{
+		//the device can't take this much at once
+		dma_return_bounce(&mapping->bounce);
+		return false;
+	}
+
+	return true;
+}
+
+void dma_unmap(dma_mapping* mapping)
+{
+	if(!mapping->bounce.address)
+		return;
+
+	if(mapping->direction & DMA_FROM_DEVICE)
+		memcpy(mapping->buffer, mapping->bounce.address, mapping->size);
+
+	dma_return_bounce(&mapping->bounce);
+}
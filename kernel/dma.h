@@ -0,0 +1,81 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <kernel/physical_manager.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//the first physical address a device can't reach
+#define DMA_LIMIT_ISA 0x1000000ull //16 MiB
+#define DMA_LIMIT_32BIT 0x100000000ull
+
+//what a device can do, zero means no restriction
+typedef struct
+{
+	uint64_t limit;
+	//segments can't cross a multiple of this, a power of 2
+	size_t boundary;
+	//each segment must start on a multiple of this, a power of 2
+	size_t align;
+	size_t max_segment_size;
+	size_t max_segments;
+} dma_constraints;
+
+//physically contiguous memory, mapped into the kernel
+typedef struct
+{
+	void* address;
+	phys_addr_t physical;
+	size_t size;
+} dma_region;
+
+//size is rounded up to whole pages, returns false if no memory in range is left
+bool dma_allocate(size_t size, const dma_constraints* constraints, dma_region* region);
+void dma_free(dma_region* region);
+
+typedef struct
+{
+	phys_addr_t address;
+	size_t size;
+} dma_segment;
+
+enum dma_direction
+{
+	DMA_TO_DEVICE = 1,
+	DMA_FROM_DEVICE = 2,
+	DMA_BIDIRECTIONAL = DMA_TO_DEVICE | DMA_FROM_DEVICE
+};
+
+#define DMA_MAX_SEGMENTS 16
+
+//a kernel buffer as the device sees it
+typedef struct
+{
+	dma_segment segments[DMA_MAX_SEGMENTS];
+	size_t num_segments;
+
+	//when the buffer couldn't be used directly the device works on this instead
+	dma_region bounce;
+	void* buffer;
+	size_t size;
+	int direction;
+} dma_mapping;
+
+//builds a scatter gather list for buffer, which must stay mapped until dma_unmap,
+//falls back to a bounce buffer for pages the device can't reach or too many segments
+bool dma_map(void* buffer, size_t size, int direction, const dma_constraints* constraints,
+			 dma_mapping* mapping);
+//copies bounced data back after a transfer from the device
+void dma_unmap(dma_mapping* mapping);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,6 +9,7 @@
 #include <kernel/interrupt.h>
 #include <kernel/memorymanager.h>
 #include <kernel/physical_manager.h>
+#include <kernel/dma.h>
 #include <kernel/task.h>
 #include <kernel/elf.h>
 #include <kernel/locks.h>
@@ -121,6 +122,7 @@ static constexpr std::array func_list
 	func_info{"filesystem_add_driver"sv,		(void*)&filesystem_add_driver},
 	func_info{"filesystem_read_from_disk"sv,	(void*)&filesystem_read_from_disk},
 	func_info{"filesystem_write_to_disk"sv,		(void*)&filesystem_write_to_disk},
+	func_info{"filesystem_set_cache_line"sv,	(void*)&filesystem_set_cache_line},
 	func_info{"filesystem_create_stream"sv,		(void*)&filesystem_create_stream},
 	func_info{"filesystem_open_file"sv,			(void*)&filesystem_open_file},
 	func_info{"filesystem_close_file"sv,		(void*)&filesystem_close_file},
@@ -138,6 +140,12 @@ static constexpr std::array func_list
 	func_info{"memmanager_get_physical"sv,		(void*)&memmanager_get_physical},
 	func_info{"memmanager_unmap_pages"sv,		(void*)&memmanager_unmap_pages},
 	func_info{"memmanager_free_pages"sv,		(void*)&memmanager_free_pages},
+	func_info{"memmanager_set_tlb_shootdown"sv,	(void*)&memmanager_set_tlb_shootdown},
+	func_info{"memmanager_get_paging_bits"sv,	(void*)&memmanager_get_paging_bits},
+	func_info{"dma_allocate"sv,					(void*)&dma_allocate},
+	func_info{"dma_free"sv,						(void*)&dma_free},
+	func_info{"dma_map"sv,						(void*)&dma_map},
+	func_info{"dma_unmap"sv,					(void*)&dma_unmap},
 	func_info{"kernel_lock_mutex"sv,			(void*)&kernel_lock_mutex},
 	func_info{"kernel_unlock_mutex"sv,			(void*)&kernel_unlock_mutex},
 	func_info{"kernel_signal_cv"sv,				(void*)&kernel_signal_cv},
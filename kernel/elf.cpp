@@ -4,12 +4,19 @@
 
 #include <kernel/filesystem.h>
 #include <kernel/memorymanager.h>
+#include <kernel/physical_manager.h>
+#include <kernel/locks.h>
 #include <kernel/elf.h>
+#include <kernel/page_reclaim.h>
 #include <kernel/util/hash.h>
+#include <kernel/util/lru_list.h>
 #include <kernel/dynamic_object.h>
 #include <kernel/kassert.h>
 
 #include <string_view>
+#include <vector>
+#include <algorithm>
+#include <common/util.h>
 
 struct ELF_linker_data
 {
@@ -128,6 +135,256 @@ struct seg_info
 	uint32_t flags;
 };
 
+struct shared_image;
+
+struct cached_frame : lru_node
+{
+	phys_addr_t frame	= 0; //0 if the page hasn't been read yet
+	shared_image* image = nullptr;
+};
+
+//read only pages of executables and libraries, shared by every process that maps them
+struct shared_image
+{
+	size_t disk_id;
+	fs_index location_on_disk;
+	time_t time_modified;
+
+	//indexed by page of the file, never resized since the lru points into it
+	std::vector<cached_frame> frames;
+	size_t num_cached;
+
+	//once no page source uses the image, its pages stay cached until they are reclaimed
+	size_t num_sources;
+};
+
+static std::vector<shared_image*> shared_images;
+//every frame in every image, these are dropped when memory runs low
+static constinit lru_list cached_frames{};
+static constinit sync::mutex shared_images_mutex{};
+static bool reclaimer_added = false;
+
+//text relocations write into read only segments, so those can't be shared
+static bool elf_has_text_relocations(ELF_header32* file_header, fs::stream_ref f)
+{
+	for(size_t i = 0; i < file_header->pgh_entries; i++)
+	{
+		const auto pos =
+			file_header->pgh_offset + i * sizeof(ELF_program_header32);
+		ELF_program_header32 pg_header;
+		f.read(pos, &pg_header, sizeof(ELF_program_header32));
+
+		if(pg_header.type != ELF_PTYPE_DYNAMIC)
+			continue;
+
+		for(size_t offset = 0; offset + sizeof(ELF_dyn32) <= pg_header.file_size;
+			offset += sizeof(ELF_dyn32))
+		{
+			ELF_dyn32 entry;
+			f.read(pg_header.offset + offset, &entry, sizeof(ELF_dyn32));
+
+			if(entry.d_tag == DT_NULL)
+				break;
+
+			if(entry.d_tag == DT_TEXTREL ||
+			   (entry.d_tag == DT_FLAGS && (entry.d_un.d_val & DF_TEXTREL)))
+				return true;
+		}
+	}
+	return false;
+}
+
+//shared_images_mutex must be held
+static void elf_destroy_shared_image(shared_image* image)
+{
+	for(auto& page : image->frames)
+	{
+		if(!page.frame)
+			continue;
+
+		cached_frames.remove(&page);
+		memmanager_release_frame(page.frame);
+	}
+
+	auto it = std::find(shared_images.begin(), shared_images.end(), image);
+	k_assert(it != shared_images.end());
+	shared_images.erase(it);
+
+	delete image;
+}
+
+//gives back the frames of the images that were used least recently and aren't mapped
+static size_t elf_reclaim_frames(void*, size_t num_bytes)
+{
+	if(!shared_images_mutex.try_lock())
+		return 0;
+
+	size_t freed = 0;
+
+	//look at each frame once at most
+	for(size_t n = cached_frames.size(); n != 0 && freed < num_bytes; n--)
+	{
+		auto page = static_cast<cached_frame*>(cached_frames.oldest());
+
+		if(!memmanager_release_unused_frame(page->frame))
+		{
+			//a process still has it mapped
+			cached_frames.touch(page);
+			continue;
+		}
+
+		cached_frames.remove(page);
+		page->frame = 0;
+		freed += PAGE_SIZE;
+
+		auto image = page->image;
+		if(--image->num_cached == 0 && image->num_sources == 0)
+			elf_destroy_shared_image(image);
+	}
+
+	shared_images_mutex.unlock();
+	return freed;
+}
+
+//shared_images_mutex must be held
+static shared_image* elf_get_shared_image(const file_handle* file)
+{
+	if(!reclaimer_added)
+	{
+		page_reclaim_add(elf_reclaim_frames, nullptr);
+		reclaimer_added = true;
+	}
+
+	//an older version of the file that nothing uses anymore won't be needed again
+	for(size_t i = 0; i < shared_images.size();)
+	{
+		auto img = shared_images[i];
+		if(img->disk_id == file->data.disk_id &&
+		   img->location_on_disk == file->data.location_on_disk &&
+		   img->time_modified != file->time_modified && img->num_sources == 0)
+		{
+			elf_destroy_shared_image(img);
+			continue;
+		}
+		i++;
+	}
+
+	auto it = std::find_if(shared_images.begin(), shared_images.end(),
+						   [file](const shared_image* img) {
+							   return img->disk_id == file->data.disk_id &&
+									  img->location_on_disk == file->data.location_on_disk &&
+									  img->time_modified == file->time_modified;
+						   });
+
+	if(it != shared_images.end())
+	{
+		(*it)->num_sources++;
+		return *it;
+	}
+
+	return shared_images.emplace_back(new shared_image{
+		.disk_id		  = file->data.disk_id,
+		.location_on_disk = file->data.location_on_disk,
+		.time_modified	  = file->time_modified,
+		.frames = std::vector<cached_frame>(
+			memmanager_minimum_pages((size_t)file->data.size)),
+		.num_cached	 = 0,
+		.num_sources = 1,
+	});
+}
+
+//shared_images_mutex must be held
+static void elf_put_shared_image(shared_image* image)
+{
+	if(--image->num_sources == 0 && image->num_cached == 0)
+		elf_destroy_shared_image(image);
+}
+
+//shared_images_mutex must be held
+static phys_addr_t elf_get_shared_frame(shared_image* image, file_stream* f, size_t file_page)
+{
+	if(file_page >= image->frames.size())
+		return 0;
+
+	auto& cached = image->frames[file_page];
+	if(cached.frame)
+	{
+		cached_frames.touch(&cached);
+		return cached.frame;
+	}
+
+	phys_addr_t frame = physical_memory_allocate_page();
+	if(!frame)
+		return 0;
+
+	auto page = memmanager_map_to_new_pages(frame, 1, PAGE_PRESENT | PAGE_RW);
+	filesystem_read_file(file_page * PAGE_SIZE, page, PAGE_SIZE, f);
+	memmanager_unmap_pages(page, 1);
+
+	cached.frame = frame;
+	cached.image = image;
+	image->num_cached++;
+	cached_frames.insert(&cached);
+
+	return frame;
+}
+
+//backs the segments of a user executable, pages are read when they are first touched
+struct elf_file_source
+{
+	file_stream* stream;
+	shared_image* image; //null if the pages can't be shared
+	size_t refs;
+};
+
+static phys_addr_t elf_source_get_frame(void* data, uint64_t offset)
+{
+	auto src = static_cast<elf_file_source*>(data);
+
+	if(!src->image || offset % PAGE_SIZE)
+		return 0;
+
+	sync::lock_guard l{shared_images_mutex};
+	return elf_get_shared_frame(src->image, src->stream, (size_t)(offset / PAGE_SIZE));
+}
+
+static size_t elf_source_read(void* data, uint64_t offset, void* dst, size_t len)
+{
+	auto src = static_cast<elf_file_source*>(data);
+	return filesystem_read_file(offset, dst, len, src->stream);
+}
+
+static void elf_source_retain(void* data)
+{
+	auto src = static_cast<elf_file_source*>(data);
+	sync::atomic_add(&src->refs, (size_t)1);
+}
+
+static void elf_source_release(void* data)
+{
+	auto src = static_cast<elf_file_source*>(data);
+	{
+		sync::lock_guard l{shared_images_mutex};
+
+		sync::atomic_add(&src->refs, ~(size_t)0);
+		if(src->refs != 0)
+			return;
+
+		if(src->image)
+			elf_put_shared_image(src->image);
+	}
+
+	filesystem_close_file(src->stream);
+	delete src;
+}
+
+static constexpr page_source elf_page_source = {
+	.get_frame = elf_source_get_frame,
+	.read	   = elf_source_read,
+	.retain	   = elf_source_retain,
+	.release   = elf_source_release,
+};
+
 static seg_info calculate_segment_info(const ELF_program_header32& pg_header,
 									   uintptr_t base_adress, bool user)
 {
@@ -199,6 +456,25 @@ int load_elf(const file_handle* file, dynamic_object* object, bool user, directo
 				base_adress = 0;
 			}
 
+			//pages stay writable until relocation is done
+			std::vector<seg_info> loaded_segments;
+
+			//user segments are read on demand, the loader holds one reference until it's done
+			elf_file_source* source = nullptr;
+			if(user)
+			{
+				if(file_stream* stream = filesystem_open_file_handle(file, 0))
+				{
+					source = new elf_file_source{stream, nullptr, 1};
+
+					if(!elf_has_text_relocations(&file_header, f))
+					{
+						sync::lock_guard l{shared_images_mutex};
+						source->image = elf_get_shared_image(file);
+					}
+				}
+			}
+
 			for(size_t i = 0; i < file_header.pgh_entries; i++)
 			{
 				//seek ahead to the program header table
@@ -230,12 +506,51 @@ int load_elf(const file_handle* file, dynamic_object* object, bool user, directo
 					auto seg =
 						calculate_segment_info(pg_header, base_adress, user);
 
-					memmanager_set_page_flags((void*)seg.aligned_addr,
-											  num_pages, seg.flags);
+					//whole pages inside the segment are left to the page fault handler
+					const uintptr_t lazy_begin = align_addr(seg.virtual_addr, PAGE_SIZE);
+					const uintptr_t lazy_end =
+						(seg.virtual_addr + pg_header.mem_size) & ~(PAGE_SIZE - 1);
+
+					bool lazy = false;
+					if(source && lazy_end > lazy_begin)
+					{
+						const size_t skipped = lazy_begin - seg.virtual_addr;
+						const size_t file_bytes =
+							(pg_header.file_size > skipped) ? pg_header.file_size - skipped : 0;
+
+						elf_source_retain(source);
+						lazy = memmanager_map_file((void*)lazy_begin,
+												   (lazy_end - lazy_begin) / PAGE_SIZE,
+												   &elf_page_source, source,
+												   pg_header.offset + skipped, file_bytes);
+						if(!lazy)
+							elf_source_release(source);
+					}
+
+					if(!lazy)
+					{
+						//copy file_size bytes from offset to virtual_address
+						f.read(pg_header.offset, (void*) seg.virtual_addr,
+							   pg_header.file_size);
+					}
+					else
+					{
+						//only the partial pages at either end are read now
+						const uintptr_t seg_end = seg.virtual_addr + pg_header.file_size;
+
+						if(lazy_begin > seg.virtual_addr)
+						{
+							f.read(pg_header.offset, (void*)seg.virtual_addr,
+								   std::min(lazy_begin, seg_end) - seg.virtual_addr);
+						}
+						if(seg_end > lazy_end)
+						{
+							f.read(pg_header.offset + (lazy_end - seg.virtual_addr),
+								   (void*)lazy_end, seg_end - lazy_end);
+						}
+					}
 
-					//copy file_size bytes from offset to virtual_address
-					f.read(pg_header.offset, (void*) seg.virtual_addr,
-						   pg_header.file_size);		
+					loaded_segments.push_back(seg);
 				}
 				break;
 				case ELF_PTYPE_TLS:
@@ -254,9 +569,19 @@ int load_elf(const file_handle* file, dynamic_object* object, bool user, directo
 				}
 			}
 
+			if(source)
+				elf_source_release(source);
+
 			object->entry_point = (void*)(base_adress + file_header.entry_point);
 
 			elf_process_dynamic_section(object, lib_dir);
+
+			//the kernel can't write to read only pages either, so apply these last
+			for(auto&& seg : loaded_segments)
+			{
+				memmanager_set_page_flags((void*)seg.aligned_addr,
+										  seg.num_pages, seg.flags);
+			}
 		}
 	}
 	else
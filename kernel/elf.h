@@ -200,9 +200,16 @@ enum ELF_dyn_section_tags
 	DT_REL			= 17,
 	DT_RELSZ		= 18,
 	DT_RELENT		= 19,
+	DT_TEXTREL		= 22, // relocations may modify read only segments
 	DT_JMPREL		= 23,
 	DT_INIT_ARRAY	= 25, // array of constructors
-	DT_INIT_ARRAYSZ = 26  // size of the table of constructors
+	DT_INIT_ARRAYSZ = 26, // size of the table of constructors
+	DT_FLAGS		= 30
+};
+
+enum ELF_dyn_flags
+{
+	DF_TEXTREL = 0x04
 };
 
 enum ELF_reloc_types
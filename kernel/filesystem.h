@@ -10,6 +10,7 @@ struct directory_stream;
 
 #include <kernel/syscall.h>
 #include <api/files.h>
+#include <common/disk_stats.h>
 
 #ifdef __cplusplus
 
@@ -44,6 +45,11 @@ size_t filesystem_read_file(file_size_t offset, void* buf, size_t len,
 							file_stream* f);
 size_t filesystem_write_file(file_size_t offset, const void* buf, size_t len,
 							 file_stream* f);
+size_t filesystem_read_file_vec(file_size_t offset, const file_iovec* iov, size_t count,
+								file_stream* f);
+size_t filesystem_write_file_vec(file_size_t offset, const file_iovec* iov, size_t count,
+								 file_stream* f);
+size_t filesystem_read_file_multi(file_segment* segments, size_t count, file_stream* f);
 int filesystem_close_file(file_stream* f);
 
 directory_stream* filesystem_open_directory_handle(const file_handle* f, int flags);
@@ -68,7 +74,19 @@ SYSCALL_HANDLER size_t syscall_read_file(file_size_t offset, void* dst,
 										 size_t len, file_stream* f);
 SYSCALL_HANDLER size_t syscall_write_file(file_size_t offset, const void* dst,
 										  size_t len, file_stream* f);
+SYSCALL_HANDLER size_t syscall_read_file_vec(file_size_t offset, const file_iovec* iov,
+											 size_t count, file_stream* f);
+SYSCALL_HANDLER size_t syscall_write_file_vec(file_size_t offset, const file_iovec* iov,
+											  size_t count, file_stream* f);
+SYSCALL_HANDLER size_t syscall_read_file_multi(file_segment* segments, size_t count,
+											   file_stream* f);
 SYSCALL_HANDLER int syscall_close_file(file_stream* f);
+SYSCALL_HANDLER int syscall_sync_file(file_stream* f);
+SYSCALL_HANDLER int syscall_sync(void);
+//the counters of the index'th disk, returns -1 if there isn't one
+SYSCALL_HANDLER int syscall_get_disk_stats(size_t index, disk_stats* stats);
+SYSCALL_HANDLER void* syscall_map_file(file_size_t offset, size_t length, int flags,
+									   file_stream* f);
 SYSCALL_HANDLER int syscall_delete_file(const file_handle* f);
 SYSCALL_HANDLER int syscall_dispose_file_handle(const file_handle* f);
 
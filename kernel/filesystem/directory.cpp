@@ -8,6 +8,7 @@
 #include <kernel/filesystem.h>
 #include <kernel/filesystem/fs_driver.h>
 #include <kernel/filesystem/drives.h>
+#include <kernel/filesystem/page_cache.h>
 #include <kernel/kassert.h>
 
 #include <vector>
@@ -74,6 +75,8 @@ int filesystem_delete_file(const file_handle* f)
 	}
 
 	k_assert(drive->fs_driver->delete_file);
+
+	page_cache_drop_file(&f->data);
 	return drive->fs_driver->delete_file(&f->data, drive);
 }
 
@@ -1,13 +1,21 @@
 #include <kernel/filesystem.h>
 #include <kernel/filesystem/fs_driver.h>
 #include <kernel/filesystem/util.h>
+#include <kernel/filesystem/io_queue.h>
 #include <kernel/kassert.h>
 #include <kernel/locks.h>
+#include <kernel/memorymanager.h>
+#include <kernel/page_reclaim.h>
+#include <kernel/physical_manager.h>
+#include <kernel/sysclock.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <bit>
 #include "drives.h"
 
 constexpr size_t default_cache_size = 1024;
+//filesystems can ask for entries as big as their clusters, up to this
+constexpr size_t max_cache_size = PAGE_SIZE;
 
 size_t calc_block_ratio(size_t block_size, size_t cache_size)
 {
@@ -17,25 +25,132 @@ size_t calc_block_ratio(size_t block_size, size_t cache_size)
 		1 : (cache_size / block_size);
 }
 
+//a share of the memory that's free when a drive is added, buffers are only allocated once used
+#define BLOCK_CACHE_MEMORY_SHARE 32
+#define BLOCK_CACHE_MIN_ENTRIES 8
+#define BLOCK_CACHE_MAX_ENTRIES 4096
+
+//the flusher looks at the cache this often, and writes back what's been dirty for long enough,
+//or everything once more than 1 / DIRTY_THRESHOLD_FRACTION of the cache is dirty
+#define FLUSH_CHECKS_PER_SECOND 4
+#define DIRTY_EXPIRE_SECONDS 2
+#define DIRTY_THRESHOLD_FRACTION 4
+
+static size_t block_cache_entries(size_t buffer_size)
+{
+	size_t entries = physical_num_bytes_free() / BLOCK_CACHE_MEMORY_SHARE / buffer_size;
+
+	if(entries < BLOCK_CACHE_MIN_ENTRIES)
+		return BLOCK_CACHE_MIN_ENTRIES;
+	if(entries > BLOCK_CACHE_MAX_ENTRIES)
+		return BLOCK_CACHE_MAX_ENTRIES;
+
+	return entries;
+}
+
+//Entries are found by index through a hash table and evicted with a generalized clock:
+//a hit bumps a small use count, the hand takes one off every entry it passes and
+//evicts the first one it finds unused. Blocks that keep getting used, like a FAT
+//or an indirect block, outlive the ones a long sequential read goes through once.
+//The caller locks, hits only write the use count so they can share the lock.
 template <typename T>
-class fifo_cache
+class clock_cache
 {
 public:
 	using iterator = T*;
 	using const_iterator = const T*;
 
-	fifo_cache(size_t size)
-		: m_last_index(0)
-		, m_size(size)
-		, m_data(new T[size])
-	{}
+	static constexpr uint8_t max_uses = 3;
+
+	clock_cache(size_t size)
+	{
+		reset(size);
+	}
+
+	//replaces every entry with a new empty one, the caller frees what they held
+	void reset(size_t size)
+	{
+		m_hand		 = 0;
+		m_size		 = size;
+		m_data		 = std::unique_ptr<T[]>(new T[size]);
+		m_hash_shift = 32;
+
+		size_t num_buckets = 1;
+		while(num_buckets < size)
+		{
+			num_buckets <<= 1;
+			m_hash_shift--;
+		}
+
+		m_buckets = std::unique_ptr<T*[]>(new T*[num_buckets]);
+		for(size_t i = 0; i < num_buckets; i++)
+		{
+			m_buckets[i] = nullptr;
+		}
+	}
 
-	T& refresh_oldest_item()
+	//the entry holding index, whether it's still valid or not
+	T* lookup(size_t index) const
 	{
-		size_t next = (m_last_index + 1) % m_size;
+		T* item = m_buckets[bucket(index)];
+		while(item && item->index != index)
+		{
+			item = item->hash_next;
+		}
+		return item;
+	}
 
-		sync::atomic_store(&m_last_index, next);
-		return m_data[m_last_index];
+	void touch(T& item)
+	{
+		const uint8_t uses = __atomic_load_n(&item.uses, __ATOMIC_RELAXED);
+		if(uses < max_uses)
+			__atomic_store_n(&item.uses, (uint8_t)(uses + 1), __ATOMIC_RELAXED);
+	}
+
+	//takes an entry out of the cache to be reused, invalid ones go first,
+	//dirty ones are passed over until the hand has worn every use count down
+	T& evict()
+	{
+		const size_t dirty_after = (size_t)(max_uses + 1) * m_size;
+
+		for(size_t passed = 0;; passed++)
+		{
+			T& item = m_data[m_hand];
+			m_hand	= (m_hand + 1) % m_size;
+
+			if(!item.valid || (item.uses == 0 && (!item.dirty || passed >= dirty_after)))
+			{
+				unhash(item);
+				return item;
+			}
+
+			if(item.uses)
+				item.uses--;
+		}
+	}
+
+	//files item under a new index
+	void rehash(T& item, size_t index)
+	{
+		unhash(item);
+
+		item.index	   = index;
+		item.uses	   = 0;
+		item.hashed	   = true;
+		item.hash_next = m_buckets[bucket(index)];
+
+		m_buckets[bucket(index)] = &item;
+	}
+
+	//0 is the item the hand reaches next
+	T& item_by_age(size_t age)
+	{
+		return m_data[(m_hand + age) % m_size];
+	}
+
+	size_t size() const
+	{
+		return m_size;
 	}
 
 	iterator buf_begin()
@@ -48,9 +163,33 @@ public:
 		return &m_data[0] + m_size;
 	}
 private:
-	size_t m_last_index;
-	const size_t m_size;
+	size_t bucket(size_t index) const
+	{
+		//indexes are aligned to the buffer size, so the low bits alone are a poor hash
+		return m_hash_shift == 32 ? 0 : ((uint32_t)index * 0x9E3779B1u) >> m_hash_shift;
+	}
+
+	void unhash(T& item)
+	{
+		if(!item.hashed)
+			return;
+
+		T** it = &m_buckets[bucket(item.index)];
+		while(*it != &item)
+		{
+			it = &(*it)->hash_next;
+		}
+
+		*it			   = item.hash_next;
+		item.hash_next = nullptr;
+		item.hashed	   = false;
+	}
+
+	size_t m_hand;
+	size_t m_size;
 	std::unique_ptr<T[]> m_data;
+	unsigned m_hash_shift;
+	std::unique_ptr<T*[]> m_buckets;
 };
 
 struct filesystem_drive
@@ -60,38 +199,48 @@ struct filesystem_drive
 					 size_t block_size,
 					 size_t num_blocks,
 					 size_t index)
-		: m_drv_impl_data(driver_data)
-		, m_driver(disk_drv)
+		: m_driver(disk_drv)
 		, m_index(index)
 		, m_minimum_block_size(block_size)
 		, m_blocksz_log2((size_t)std::countr_zero(block_size))
 		, m_num_blocks(num_blocks)
 		, m_num_blocks_per_cache(calc_block_ratio(block_size, default_cache_size))
-		, block_cache{8}
+		, m_queue(disk_drv, driver_data, block_size)
+		, block_cache{block_cache_entries(blocks_to_bytes(m_num_blocks_per_cache))}
 	{
 		//must have allocate & free or neither
 		k_assert(!!disk_drv.allocate_buffer == !!disk_drv.free_buffer);
+
+		page_reclaim_add(reclaim_buffers, this);
+
+		if(!read_only())
+			background_work_add(flush_dirty, this);
 	};
 
 	~filesystem_drive()
 	{
+		page_reclaim_remove(reclaim_buffers, this);
+
+		if(!read_only())
+			background_work_remove(flush_dirty, this);
+
 		for(auto it = block_cache.buf_begin(); it != block_cache.buf_end(); ++it)
 		{
 			if(it->data)
-				free_buffer(it->data, block_size());
+				free_buffer(it->data, blocks_to_bytes(m_num_blocks_per_cache));
 		}
 	}
 
 	void write_blocks(size_t lba, const uint8_t* buf, size_t num_sectors) const
 	{
 		k_assert(m_driver.write_blocks);
-		m_driver.write_blocks(m_drv_impl_data, lba, buf, num_sectors);
+		m_queue.write(lba, buf, num_sectors);
 	}
 
 	void read_blocks(size_t lba, uint8_t* buf, size_t num_sectors) const
 	{
 		k_assert(m_driver.read_blocks);
-		m_driver.read_blocks(m_drv_impl_data, lba, buf, num_sectors);
+		m_queue.read(lba, buf, num_sectors);
 	}
 
 	uint8_t* allocate_buffer(size_t size) const
@@ -165,24 +314,63 @@ struct filesystem_drive
 						 uint8_t* buf,
 						 size_t num_bytes) const;
 
-	void block_flush(size_t block, size_t num_blocks) const;
+	//false if a dirty entry couldn't be written, it stays dirty
+	bool block_flush(size_t block, size_t num_blocks) const;
 	void block_invalidate(size_t block, size_t num_blocks) const;
+	bool block_cached(size_t block) const;
+
+	//reads the blocks of the extents that aren't cached yet into the cache, all as one
+	//plugged batch so the queue merges them, extents start from base
+	void prefetch(const disk_extent* extents, size_t num_extents, size_t base) const;
+
+	//writes dirty entries back through the queue, which merges neighbouring ones,
+	//unless all is set locked entries and ones dirtied recently are left for later,
+	//returns how many entries were written, ones that failed stay dirty and set failed
+	size_t write_back(bool all, bool* failed = nullptr) const;
+
+	void get_stats(disk_stats* stats) const;
+
+	//sizes cache entries to num_bytes for a filesystem starting at first_block, once another
+	//filesystem on the disk has asked they can only get smaller so both still fit
+	void set_cache_line(size_t num_bytes, size_t first_block);
 
 private:
+	//writes back and drops everything cached, then makes entries blocks_per_cache blocks,
+	//nothing changes if a dirty entry can't be written
+	void resize_cache(size_t blocks_per_cache);
+
+	//frees clean cache buffers, oldest first, when memory runs low
+	static size_t reclaim_buffers(void* data, size_t num_bytes);
+	//background work, writes back dirty entries every so often
+	static bool flush_dirty(void* data);
 
-	void* m_drv_impl_data;
 	const disk_driver& m_driver;
 	size_t m_index;
 	size_t m_minimum_block_size;
 	size_t m_blocksz_log2;
 	size_t m_num_blocks;
 	size_t m_num_blocks_per_cache;
+	bool m_line_requested = false;
+	clock_t m_last_flush = 0;
+
+	mutable io_queue m_queue;
+
+	//counted for disk_stats
+	mutable size_t m_cache_hits = 0;
+	mutable size_t m_cache_misses = 0;
+	mutable size_t m_evictions = 0;
+	mutable size_t m_dirty_evictions = 0;
+	mutable size_t m_written_back = 0;
 
 	struct cached_block {
-		size_t index;
+		size_t index = 0;
 		uint8_t* data = nullptr;
+		clock_t dirtied_at = 0;
 		bool dirty = false;
 		bool valid = false;
+		bool hashed = false;
+		uint8_t uses = 0;
+		cached_block* hash_next = nullptr;
 		sync::upgradable_shared_mutex mtx{};
 	};
 
@@ -196,7 +384,11 @@ private:
 		{}
 		~writable_block()
 		{
-			block.dirty = true;
+			if(!block.dirty)
+			{
+				block.dirty		 = true;
+				block.dirtied_at = sysclock_get_ticks();
+			}
 		}
 		uint8_t* get() const
 		{
@@ -232,11 +424,27 @@ private:
 		lock_t lock;
 	};
 
+	//write_bytes is how much the caller is about to write, if it's the whole entry
+	//there's no need to read it in first
 	template<typename T>
-	T block_rw(size_t block, bool write_all = false) const;
+	T block_rw(size_t block, size_t write_bytes = 0) const;
+
+	//calls f on every cached entry that overlaps [index, index + num_blocks)
+	template<typename F>
+	void for_each_cached(size_t index, size_t num_blocks, F&& f) const;
+
+	//writes a locked entry to the disk, it stays dirty if that fails
+	bool write_entry(cached_block& item) const;
+
+	//takes an entry out of the cache with nothing left to write back,
+	//the caller holds the cache exclusively
+	cached_block& evict_clean() const;
 
 	mutable sync::upgradable_shared_mutex cache_write_mutex;
-	mutable fifo_cache<cached_block> block_cache;
+	mutable clock_cache<cached_block> block_cache;
+
+	//held shared by write_back, which keeps pointers to entries while it waits for the disk
+	mutable sync::shared_mutex m_resize_mutex;
 };
 
 using fs_drive_list = std::vector<filesystem_virtual_drive*>;
@@ -380,103 +588,554 @@ filesystem_drive* filesystem_add_drive(const disk_driver* disk_drv, void* driver
 	return drives.back();
 }
 
-void filesystem_drive::block_flush(size_t index, size_t num_blocks) const
+template<typename F>
+void filesystem_drive::for_each_cached(size_t index, size_t num_blocks, F&& f) const
+{
+	const size_t first		 = fs::align_power_2(index, m_num_blocks_per_cache);
+	const size_t num_entries = (index + num_blocks - first + m_num_blocks_per_cache - 1) /
+							   m_num_blocks_per_cache;
+
+	//a long range is quicker to check against every entry than to look up piece by piece
+	if(num_entries > block_cache.size())
+	{
+		for(auto it = block_cache.buf_begin(); it != block_cache.buf_end(); ++it)
+		{
+			if(!it->hashed) continue;
+			if(index + num_blocks <= it->index) continue;
+			if(index >= it->index + m_num_blocks_per_cache) continue;
+
+			f(*it);
+		}
+		return;
+	}
+
+	for(size_t i = 0; i < num_entries; i++)
+	{
+		if(auto item = block_cache.lookup(first + i * m_num_blocks_per_cache))
+			f(*item);
+	}
+}
+
+bool filesystem_drive::write_entry(cached_block& item) const
+{
+	io_request r{IO_WRITE, item.index, m_num_blocks_per_cache, item.data};
+	m_queue.submit_and_wait(&r);
+
+	if(r.status != 0)
+		return false;
+
+	item.dirty = false;
+	return true;
+}
+
+filesystem_drive::cached_block& filesystem_drive::evict_clean() const
 {
+	for(size_t tries = 0;; tries++)
+	{
+		auto& item = block_cache.evict();
+
+		//once every entry has had a turn whatever's left is taken anyway
+		const bool last_try = tries >= block_cache.size();
+
+		//entries in use are always hashed, so one that's held goes back under its index,
+		//that way neither a writer nor one our own prefetch claimed is waited on
+		if(!item.mtx.try_lock())
+		{
+			if(!last_try)
+			{
+				block_cache.rehash(item, item.index);
+				continue;
+			}
+
+			item.mtx.lock();
+		}
+
+		//anything an invalid entry held was dropped along with it
+		if(item.valid && item.dirty)
+		{
+			if(write_entry(item))
+			{
+				sync::atomic_add(&m_dirty_evictions, (size_t)1);
+			}
+			else if(!last_try)
+			{
+				//the cache has the only copy, it goes back in for another try
+				block_cache.rehash(item, item.index);
+				item.mtx.unlock();
+				continue;
+			}
+			else
+			{
+				printf("couldn't write back block %d, dropping it\n", item.index);
+			}
+		}
+
+		if(item.valid)
+			sync::atomic_add(&m_evictions, (size_t)1);
+
+		item.dirty = false;
+		item.mtx.unlock();
+
+		return item;
+	}
+}
+
+bool filesystem_drive::block_flush(size_t index, size_t num_blocks) const
+{
+	bool flushed = true;
+
 	cache_write_mutex.lock_shared();
 
+	for_each_cached(index, num_blocks, [this, &flushed](cached_block& item) {
+		sync::unique_lock lock{item.mtx};
+		if(item.valid && item.dirty && !write_entry(item))
+			flushed = false;
+	});
+
+	cache_write_mutex.unlock_shared();
+
+	return flushed;
+}
+
+bool filesystem_drive::block_cached(size_t index) const
+{
+	sync::shared_lock lock{cache_write_mutex};
+
+	auto item = block_cache.lookup(fs::align_power_2(index, m_num_blocks_per_cache));
+	return item && item->valid;
+}
+
+size_t filesystem_drive::write_back(bool all, bool* failed) const
+{
+	struct dirty_entry
+	{
+		cached_block* item;
+		size_t index;
+	};
+
+	std::vector<dirty_entry> dirty;
+
+	sync::shared_lock resize_lock{m_resize_mutex};
+
+	//only a snapshot, each entry is checked again once it's locked
+	cache_write_mutex.lock_shared();
 	for(auto it = block_cache.buf_begin(); it != block_cache.buf_end(); ++it)
 	{
-		if(index + num_blocks < it->index) continue;
-		if(index > it->index + m_num_blocks_per_cache) continue;
+		if(it->valid && it->dirty)
+			dirty.push_back(dirty_entry{it, it->index});
+	}
+	cache_write_mutex.unlock_shared();
 
-		sync::unique_lock lock{it->mtx};
-		if(it->dirty)
+	if(!all && dirty.size() < block_cache.size() / DIRTY_THRESHOLD_FRACTION)
+	{
+		const clock_t now	 = sysclock_get_ticks();
+		const clock_t expire = sysclock_get_rate() * DIRTY_EXPIRE_SECONDS;
+
+		size_t kept = 0;
+		for(auto& d : dirty)
+		{
+			if(now - d.item->dirtied_at >= expire)
+				dirty[kept++] = d;
+		}
+
+		while(dirty.size() > kept)
 		{
-			write_blocks(it->index, it->data, m_num_blocks_per_cache);
-			it->dirty = false;
+			dirty.pop_back();
 		}
 	}
 
-	cache_write_mutex.unlock_shared();
+	if(dirty.empty())
+		return 0;
+
+	auto requests = std::make_unique<io_request[]>(dirty.size());
+	std::unique_ptr<cached_block*[]> items(new cached_block*[dirty.size()]);
+	size_t num_requests = 0;
+
+	m_queue.plug();
+
+	for(auto& d : dirty)
+	{
+		auto item = d.item;
+
+		if(all)
+			item->mtx.lock();
+		else if(!item->mtx.try_lock())
+			continue;
+
+		//it may have been written, evicted or invalidated since
+		if(!item->valid || !item->dirty || item->index != d.index)
+		{
+			item->mtx.unlock();
+			continue;
+		}
+
+		requests[num_requests] = io_request{IO_WRITE, item->index, m_num_blocks_per_cache, item->data};
+		items[num_requests]	   = item;
+
+		m_queue.submit(&requests[num_requests++]);
+	}
+
+	m_queue.unplug();
+
+	size_t num_written = 0;
+	for(size_t i = 0; i < num_requests; i++)
+	{
+		m_queue.wait(&requests[i]);
+
+		//the cache has the only copy, it's kept for another try
+		if(requests[i].status != 0)
+		{
+			if(failed)
+				*failed = true;
+		}
+		else
+		{
+			items[i]->dirty = false;
+			num_written++;
+		}
+
+		items[i]->mtx.unlock();
+	}
+
+	sync::atomic_add(&m_written_back, num_written);
+	return num_written;
 }
 
-void filesystem_drive::block_invalidate(size_t index, size_t num_blocks) const
+void filesystem_drive::get_stats(disk_stats* stats) const
 {
+	*stats = disk_stats{
+		.block_size		  = m_minimum_block_size,
+		.num_blocks		  = m_num_blocks,
+		.cache_hits		  = m_cache_hits,
+		.cache_misses	  = m_cache_misses,
+		.evictions		  = m_evictions,
+		.dirty_evictions  = m_dirty_evictions,
+		.written_back	  = m_written_back,
+	};
+
 	cache_write_mutex.lock_shared();
+	stats->cache_entries	= block_cache.size();
+	stats->cache_entry_size = blocks_to_bytes(m_num_blocks_per_cache);
+
+	for(auto it = block_cache.buf_begin(); it != block_cache.buf_end(); ++it)
+	{
+		if(it->valid)
+			stats->cached_entries++;
+		if(it->dirty)
+			stats->dirty_entries++;
+	}
+	cache_write_mutex.unlock_shared();
+
+	m_queue.get_stats(stats);
+}
+
+bool filesystem_drive::flush_dirty(void* data)
+{
+	auto drive = static_cast<filesystem_drive*>(data);
+
+	const clock_t now = sysclock_get_ticks();
+	if(now - drive->m_last_flush < sysclock_get_rate() / FLUSH_CHECKS_PER_SECOND)
+		return false;
 
+	drive->m_last_flush = now;
+	return drive->write_back(false) != 0;
+}
+
+size_t filesystem_drive::reclaim_buffers(void* data, size_t num_bytes)
+{
+	auto drive = static_cast<filesystem_drive*>(data);
+
+	if(!drive->cache_write_mutex.try_lock())
+		return 0;
+
+	const size_t buffer_size = drive->blocks_to_bytes(drive->m_num_blocks_per_cache);
+	size_t freed = 0;
+
+	//starting where the clock hand is, those are the next to be evicted anyway
+	for(size_t i = 0; i < drive->block_cache.size() && freed < num_bytes; i++)
+	{
+		auto& item = drive->block_cache.item_by_age(i);
+
+		//dirty buffers have to be written back before they can go
+		if(!item.data || item.dirty || !item.mtx.try_lock())
+			continue;
+
+		drive->free_buffer(item.data, buffer_size);
+		item.data  = nullptr;
+		item.valid = false;
+		item.mtx.unlock();
+
+		freed += buffer_size;
+	}
+
+	drive->cache_write_mutex.unlock();
+	return freed;
+}
+
+void filesystem_drive::prefetch(const disk_extent* extents, size_t num_extents,
+								size_t base) const
+{
+	//keeps the entries around while their reads are waited on
+	sync::shared_lock resize_lock{m_resize_mutex};
+
+	cache_write_mutex.lock();
+
+	const size_t blocks_per_cache = m_num_blocks_per_cache;
+
+	//the entries the extents cover, each only once, since two extents can share one
+	std::vector<size_t> blocks;
+	for(size_t i = 0; i < num_extents; i++)
+	{
+		const size_t index = base + extents[i].block;
+		for(size_t block = fs::align_power_2(index, blocks_per_cache);
+			block < index + extents[i].num_blocks; block += blocks_per_cache)
+		{
+			blocks.push_back(block);
+		}
+	}
+
+	std::sort(blocks.begin(), blocks.end(), [](size_t a, size_t b) { return a < b; });
+
+	//readahead shouldn't push out more than a share of what's cached
+	const size_t max_entries = block_cache.size() / 4;
+
+	std::vector<cached_block*> entries;
+	for(size_t i = 0; i < blocks.size() && entries.size() < max_entries; i++)
+	{
+		const size_t block = blocks[i];
+		if(i && blocks[i - 1] == block)
+			continue;
+
+		auto it = block_cache.lookup(block);
+		if(it && it->valid)
+			continue;
+
+		auto& item = it ? *it : evict_clean();
+
+		//held until the read is done, anyone after the block waits on it
+		item.mtx.lock();
+
+		//a miss was reading it in while we waited
+		if(&item == it && item.valid)
+		{
+			item.mtx.unlock();
+			continue;
+		}
+
+		item.dirty = false;
+		block_cache.rehash(item, block);
+
+		if(!item.data)
+			item.data = allocate_buffer(blocks_to_bytes(blocks_per_cache));
+
+		if(!item.data)
+		{
+			item.valid = false;
+			item.mtx.unlock();
+			continue;
+		}
+
+		//until the loop is done it looks used, so evict doesn't hand it back to us
+		item.valid = true;
+		item.uses  = clock_cache<cached_block>::max_uses;
+
+		entries.push_back(&item);
+	}
+
+	for(auto e : entries)
+	{
+		e->valid = false;
+		e->uses	 = 0;
+	}
+
+	cache_write_mutex.unlock();
+
+	if(entries.empty())
+		return;
+
+	auto requests = std::make_unique<io_request[]>(entries.size());
+
+	m_queue.plug();
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		requests[i] = io_request{IO_READ, entries[i]->index, blocks_per_cache, entries[i]->data};
+		m_queue.submit(&requests[i]);
+	}
+	m_queue.unplug();
+
+	for(size_t i = 0; i < entries.size(); i++)
+	{
+		m_queue.wait(&requests[i]);
+
+		//one that failed is read again by whoever wants it
+		entries[i]->valid = requests[i].status == 0;
+		entries[i]->mtx.unlock();
+	}
+}
+
+void filesystem_drive::set_cache_line(size_t num_bytes, size_t first_block)
+{
+	//nothing's cached for these
+	if(supports_byte_access())
+		return;
+
+	num_bytes = std::min(num_bytes, max_cache_size);
+
+	size_t blocks = num_bytes >> m_blocksz_log2;
+	if(blocks == 0)
+		blocks = 1;
+
+	//rounded down to a power of 2
+	while(!std::has_single_bit(blocks))
+	{
+		blocks &= blocks - 1;
+	}
+
+	//entries are aligned to their size on the disk, so they have to line up with the filesystem's
+	while(first_block % blocks != 0)
+	{
+		blocks >>= 1;
+	}
+
+	if(m_line_requested && blocks > m_num_blocks_per_cache)
+		blocks = m_num_blocks_per_cache;
+
+	m_line_requested = true;
+
+	if(blocks != m_num_blocks_per_cache)
+		resize_cache(blocks);
+}
+
+void filesystem_drive::resize_cache(size_t blocks_per_cache)
+{
+	if(!read_only())
+		write_back(true);
+
+	sync::lock_guard resize_lock{m_resize_mutex};
+	cache_write_mutex.lock();
+
+	const size_t old_size = m_num_blocks_per_cache;
+
+	//dirtied since the write back, if any can't be written the cache keeps its size
+	//rather than lose them
 	for(auto it = block_cache.buf_begin(); it != block_cache.buf_end(); ++it)
 	{
-		if(index + num_blocks < it->index) continue;
-		if(index > it->index + m_num_blocks_per_cache) continue;
+		sync::unique_lock lock{it->mtx};
 
+		if(it->valid && it->dirty && !write_entry(*it))
+		{
+			printf("couldn't write back block %d, the cache line stays %d blocks\n",
+				   it->index, old_size);
+
+			cache_write_mutex.unlock();
+			return;
+		}
+	}
+
+	//buffers are a different size now, they're allocated again as entries get used
+	for(auto it = block_cache.buf_begin(); it != block_cache.buf_end(); ++it)
+	{
 		sync::unique_lock lock{it->mtx};
-		it->valid = false;
+
+		if(it->data)
+			free_buffer(it->data, blocks_to_bytes(old_size));
 	}
 
+	m_num_blocks_per_cache = blocks_per_cache;
+	block_cache.reset(block_cache_entries(blocks_to_bytes(blocks_per_cache)));
+
+	cache_write_mutex.unlock();
+}
+
+void filesystem_drive::block_invalidate(size_t index, size_t num_blocks) const
+{
+	cache_write_mutex.lock_shared();
+
+	//the rest of a bigger entry isn't being overwritten, so it's written back first,
+	//after that nothing left in it may be written over the caller's blocks
+	for_each_cached(index, num_blocks, [this](cached_block& item) {
+		sync::unique_lock lock{item.mtx};
+		if(item.valid && item.dirty && !write_entry(item))
+			printf("couldn't write back block %d before overwriting it\n", item.index);
+
+		item.valid = false;
+		item.dirty = false;
+	});
+
 	cache_write_mutex.unlock_shared();
 }
 
 
 template<typename T>
-T filesystem_drive::block_rw(size_t index, bool write_all) const
+T filesystem_drive::block_rw(size_t index, size_t write_bytes) const
 {
-	auto block = fs::align_power_2(index, m_num_blocks_per_cache);
-
 	cache_write_mutex.lock_shared();
 
-	auto it = std::find_if(block_cache.buf_begin(),
-						   block_cache.buf_end(), [block](auto&& c) {
-							   return block == c.index && (!!c.valid);
-						   });
+	//the entry size only changes while the cache is locked
+	const size_t blocks_per_cache = m_num_blocks_per_cache;
+	const auto block			  = fs::align_power_2(index, blocks_per_cache);
 
-	if(it == block_cache.buf_end())
+	auto it = block_cache.lookup(block);
+	if(it && it->valid)
 	{
-		cache_write_mutex.upgrade();
+		block_cache.touch(*it);
+		sync::atomic_add(&m_cache_hits, (size_t)1);
 
-		auto& item = block_cache.refresh_oldest_item();
+		typename T::lock_t lock{it->mtx};
+		cache_write_mutex.unlock_shared();
 
-		{
-			sync::unique_lock lock{item.mtx};
+		return {*it, std::move(lock)};
+	}
 
-			auto old_index = item.index;
-			item.index = block;
+	cache_write_mutex.upgrade();
 
-			if(!item.data)
-			{
-				cache_write_mutex.unlock();
+	//someone else may have read it in while we waited
+	it = block_cache.lookup(block);
+	if(it && it->valid)
+	{
+		block_cache.touch(*it);
+		sync::atomic_add(&m_cache_hits, (size_t)1);
 
-				item.data = allocate_buffer(blocks_to_bytes(m_num_blocks_per_cache));
-			}
-			else
-			{
-				cache_write_mutex.unlock();
+		typename T::lock_t lock{it->mtx};
+		cache_write_mutex.unlock();
 
-				if(item.dirty)
-				{
-					write_blocks(old_index, item.data, m_num_blocks_per_cache);
-					item.dirty = false;
-				}
-			}
+		return {*it, std::move(lock)};
+	}
 
-			k_assert(item.data);
-			if(!write_all)
-			{
-				read_blocks(item.index, item.data, m_num_blocks_per_cache);
-			}
+	//an invalidated entry for the same block is reused, so there's never two of them,
+	//anything else is written back here so a failed write can leave it in the cache
+	auto& item = it ? *it : evict_clean();
 
-			item.valid = true;
+	sync::atomic_add(&m_cache_misses, (size_t)1);
 
+	{
+		sync::unique_lock lock{item.mtx};
+
+		//a prefetch had it locked and read it in
+		if(&item == it && item.valid)
+		{
+			cache_write_mutex.unlock();
 			return {item, std::move(lock)};
 		}
-	}
 
-	//printf("a");
-	typename T::lock_t lock{it->mtx};
-	//printf("g");
+		item.dirty = false;
+		block_cache.rehash(item, block);
 
-	cache_write_mutex.unlock_shared();
+		cache_write_mutex.unlock();
+
+		if(!item.data)
+			item.data = allocate_buffer(blocks_to_bytes(blocks_per_cache));
+
+		k_assert(item.data);
+		if(write_bytes != blocks_to_bytes(blocks_per_cache))
+		{
+			read_blocks(item.index, item.data, blocks_per_cache);
+		}
 
-	return {*it, std::move(lock)};
+		item.valid = true;
+
+		return {item, std::move(lock)};
+	}
 }
 
 filesystem_virtual_drive::filesystem_virtual_drive(filesystem_drive* disk_,
@@ -500,7 +1159,7 @@ void filesystem_drive::write_to_block(size_t block,
 									  const uint8_t* buf,
 									  size_t num_bytes) const
 {
-	auto blk = block_rw<writable_block>(block, num_bytes == blocks_to_bytes(m_num_blocks_per_cache));
+	auto blk = block_rw<writable_block>(block, num_bytes);
 	auto block_offset = blocks_to_bytes(block - blk.index());
 	memcpy(blk.get() + block_offset + offset, buf, num_bytes);
 }
@@ -589,10 +1248,18 @@ void filesystem_read_from_disk(const filesystem_drive* disk,
 
 	if(blocks.num_full_chunks)
 	{
-		if(!disk->needs_buffer() && blocks.num_full_chunks > 1)
+		//blocks readahead already brought in don't have to come from the device again
+		while(!disk->needs_buffer() && blocks.num_full_chunks > 1 && disk->block_cached(block))
 		{
-			disk->block_flush(block, blocks.num_full_chunks);
+			disk->read_from_block(block++, 0, buf, disk->block_size());
+			buf += disk->block_size();
+			blocks.num_full_chunks--;
+		}
 
+		//if the cache couldn't be written back it has the only copy, so it's read from there
+		if(!disk->needs_buffer() && blocks.num_full_chunks > 1 &&
+		   disk->block_flush(block, blocks.num_full_chunks))
+		{
 			disk->read_blocks(block, buf, blocks.num_full_chunks);
 			buf += disk->blocks_to_bytes(blocks.num_full_chunks);
 			block += blocks.num_full_chunks;
@@ -614,6 +1281,138 @@ void filesystem_read_from_disk(const filesystem_drive* disk,
 	}
 }
 
+//file data to be read into the block cache before anyone asks for it
+struct readahead_request
+{
+	const filesystem_virtual_drive* drive;
+	file_data_block file;
+	file_size_t offset;
+	file_size_t end;
+};
+
+#define READAHEAD_QUEUE_SIZE 8
+
+static readahead_request readahead_queue[READAHEAD_QUEUE_SIZE];
+static size_t readahead_count	  = 0;
+static bool readahead_work_added = false;
+static constinit sync::mutex readahead_mutex{};
+
+//a window is looked up as at most this many runs of blocks, what's past them isn't read ahead
+#define READAHEAD_MAX_EXTENTS 32
+
+//only the background thread reads into this
+static std::unique_ptr<uint8_t[]> readahead_buffer;
+static size_t readahead_buffer_size = 0;
+
+//reads the window of the oldest request, the driver finds all of its blocks at once
+//and they go to the queue together, so the device reads ahead while the caller works
+static bool filesystem_readahead_work(void*)
+{
+	readahead_request r;
+
+	{
+		sync::lock_guard l{readahead_mutex};
+
+		if(!readahead_count)
+			return false;
+
+		r = readahead_queue[0];
+		for(size_t i = 1; i < readahead_count; i++)
+		{
+			readahead_queue[i - 1] = readahead_queue[i];
+		}
+		readahead_count--;
+	}
+
+	const auto drive = r.drive;
+	const size_t len = (size_t)(r.end - r.offset);
+
+	if(drive->fs_driver->map_chunks)
+	{
+		disk_extent extents[READAHEAD_MAX_EXTENTS];
+		const size_t num_extents =
+			drive->fs_driver->map_chunks(extents, READAHEAD_MAX_EXTENTS, r.file.location_on_disk,
+										 r.offset, len, &r.file, drive);
+
+		drive->disk->prefetch(extents, num_extents, drive->first_block);
+		return true;
+	}
+
+	//the driver can't say where the file is, it's read through it instead
+	if(readahead_buffer_size < len)
+	{
+		readahead_buffer	  = std::make_unique<uint8_t[]>(len);
+		readahead_buffer_size = len;
+	}
+
+	drive->fs_driver->read_chunks(readahead_buffer.get(), r.file.location_on_disk, r.offset, len,
+								  &r.file, drive);
+	return true;
+}
+
+void filesystem_readahead(const filesystem_virtual_drive* d, const file_data_block* file,
+						  file_size_t offset, size_t num_bytes)
+{
+	//these are read straight from the device, there's no cache to fill
+	if(d->disk->supports_byte_access() || num_bytes == 0)
+		return;
+
+	sync::lock_guard l{readahead_mutex};
+
+	if(!readahead_work_added)
+	{
+		background_work_add(filesystem_readahead_work, nullptr);
+		readahead_work_added = true;
+	}
+
+	//it's only a hint, the reads will still work without it
+	if(readahead_count == READAHEAD_QUEUE_SIZE)
+		return;
+
+	readahead_queue[readahead_count++] = readahead_request{d, *file, offset, offset + num_bytes};
+}
+
+void filesystem_set_cache_line(filesystem_virtual_drive* d, size_t num_bytes)
+{
+	k_assert(d);
+	k_assert(d->disk);
+
+	d->disk->set_cache_line(num_bytes, d->first_block);
+}
+
+int filesystem_sync_disk(const filesystem_drive* disk)
+{
+	k_assert(disk);
+
+	bool failed = false;
+	if(!disk->read_only())
+		disk->write_back(true, &failed);
+
+	return failed ? -1 : 0;
+}
+
+SYSCALL_HANDLER int syscall_sync(void)
+{
+	int result = 0;
+	for(auto drive : drives)
+	{
+		if(filesystem_sync_disk(drive) != 0)
+			result = -1;
+	}
+
+	return result;
+}
+
+SYSCALL_HANDLER int syscall_get_disk_stats(size_t index, disk_stats* stats)
+{
+	if(stats == nullptr || index >= drives.size() ||
+	   !memmanager_prefault_user(stats, sizeof(disk_stats), true))
+		return -1;
+
+	drives[index]->get_stats(stats);
+	return 0;
+}
+
 std::optional<file_handle> filesystem_get_root_directory(size_t drive_number)
 {
 	k_assert(drive_number < virtual_drives.size());
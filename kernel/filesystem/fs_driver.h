@@ -2,6 +2,7 @@
 #define FS_DRIVER_H
 
 #include <kernel/filesystem.h>
+#include <kernel/interrupt.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,6 +26,21 @@ typedef int (*partition_func)(filesystem_drive*, filesystem_virtual_drive*, size
 
 void filesystem_write_to_disk(const filesystem_drive* d, size_t block, size_t offset, const uint8_t* buf, size_t num_bytes);
 void filesystem_read_from_disk(const filesystem_drive* d, size_t block, size_t offset, uint8_t* buf, size_t num_bytes);
+//writes everything dirty in the block cache back to the disk, returns -1 if some of it failed
+int filesystem_sync_disk(const filesystem_drive* d);
+//called on mount with the filesystem's cluster or block size, the block cache
+//keeps entries that size so a cluster is one entry instead of several
+void filesystem_set_cache_line(filesystem_virtual_drive* d, size_t num_bytes);
+//has the background thread read part of a file into the block cache
+void filesystem_readahead(const filesystem_virtual_drive* d, const file_data_block* file, file_size_t offset, size_t num_bytes);
+
+//a run of blocks on the disk, in the drive's blocks from the start of the partition
+struct disk_extent
+{
+	size_t block;
+	size_t num_blocks;
+};
+typedef struct disk_extent disk_extent;
 
 struct filesystem_driver
 {
@@ -42,6 +58,34 @@ struct filesystem_driver
 	void (*flush_file)(const file_data_block* file, const filesystem_virtual_drive* fd);
 	void (*create_file)(const char* name, size_t name_len, uint32_t flags, directory_stream* dir, const filesystem_virtual_drive* fd);
 	int (*delete_file)(const file_data_block* file, const filesystem_virtual_drive* fd);
+	//optional, fills extents with where [offset, offset + num_bytes) of the file is on the
+	//disk, neighbouring runs merged, returns how many of max_extents it used, readahead
+	//uses it to find a whole window at once and read it straight into the block cache
+	size_t (*map_chunks)(disk_extent* extents, size_t max_extents, fs_index location,
+						 file_size_t offset, size_t num_bytes, const file_data_block* file,
+						 const filesystem_virtual_drive* fd);
+};
+
+struct disk_request;
+typedef struct disk_request disk_request;
+
+//a transfer handed to a driver, it calls complete once it's done, status is 0 if it worked,
+//this may be from an interrupt handler so complete mustn't block
+typedef INT_CALLABLE void (*disk_complete_func)(disk_request* r, int status);
+
+struct disk_request
+{
+	int write;
+	size_t block_number;
+	uint8_t* buf;
+	size_t num_blocks;
+
+	disk_complete_func complete;
+	void* data;
+
+	//the driver's to use while it has the request
+	void* driver_private;
+	disk_request* next;
 };
 
 struct disk_driver
@@ -50,6 +94,12 @@ struct disk_driver
 	void (*write_blocks)(void* driver_data, size_t block_number, const uint8_t* buf, size_t num_blocks);
 	uint8_t* (*allocate_buffer)(size_t size);
 	int (*free_buffer)(uint8_t* buffer, size_t size);
+
+	//optional, starts r and returns without waiting for it, returns nonzero if it can't
+	//take r and the synchronous calls above should be used for it instead
+	int (*submit)(void* driver_data, disk_request* r);
+	//how many submitted requests the driver takes at once, 0 is the same as 1
+	size_t queue_depth;
 };
 
 void filesystem_add_driver(const filesystem_driver* fs_drv);
@@ -0,0 +1,477 @@
+#include <kernel/filesystem/io_queue.h>
+#include <kernel/sysclock.h>
+#include <kernel/kassert.h>
+#include <stdlib.h>
+#include <string.h>
+
+//how long a batch can be passed over by the elevator before it goes next
+#define IO_READ_DEADLINE_MS 500
+#define IO_WRITE_DEADLINE_MS 5000
+
+//the most merged requests transfer at once
+#define IO_MAX_BATCH_BYTES 0x10000
+
+//requests for consecutive blocks, in order
+struct io_batch
+{
+	int op;
+	size_t lba;
+	size_t num_blocks;
+	clock_t deadline;
+
+	io_request* first;
+	io_request* last;
+
+	io_batch* next;
+	io_batch* fifo_next;
+
+	//what the driver is given, buffer is the first request's own if contiguous
+	disk_request request;
+	uint8_t* buffer;
+	bool contiguous;
+	int status;
+	sync::atomic_flag finished;
+	io_batch* in_flight_next;
+
+	clock_t started;
+};
+
+//can be called from the driver's interrupt handler, the rest is left to reap
+static INT_CALLABLE void io_batch_complete(disk_request* r, int status)
+{
+	auto b	  = static_cast<io_batch*>(r->data);
+	b->status = status;
+	b->finished.test_and_set();
+}
+
+static clock_t io_deadline(int op)
+{
+	const clock_t ms = op == IO_READ ? IO_READ_DEADLINE_MS : IO_WRITE_DEADLINE_MS;
+	return sysclock_get_ticks() + sysclock_get_rate() * ms / 1000;
+}
+
+io_queue::io_queue(const disk_driver& driver, void* driver_data, size_t block_size)
+	: m_driver(driver)
+	, m_driver_data(driver_data)
+	, m_block_size(block_size)
+	, m_max_batch_blocks(block_size < IO_MAX_BATCH_BYTES ? IO_MAX_BATCH_BYTES / block_size : 1)
+	, m_depth(driver.submit && driver.queue_depth ? driver.queue_depth : 1)
+{}
+
+io_queue::~io_queue()
+{
+	k_assert(!m_sorted && !m_in_flight);
+}
+
+uint8_t* io_queue::allocate_buffer(size_t size) const
+{
+	if(m_driver.allocate_buffer)
+		return m_driver.allocate_buffer(size);
+
+	return (uint8_t*)malloc(size);
+}
+
+void io_queue::free_buffer(uint8_t* buf, size_t size) const
+{
+	if(m_driver.free_buffer)
+		m_driver.free_buffer(buf, size);
+	else
+		free(buf);
+}
+
+bool io_queue::try_merge(io_request* r)
+{
+	for(auto b = m_sorted; b; b = b->next)
+	{
+		if(b->op != r->op || b->num_blocks + r->num_blocks > m_max_batch_blocks)
+			continue;
+
+		if(b->lba + b->num_blocks == r->lba)
+		{
+			b->last->next = r;
+			b->last		  = r;
+		}
+		else if(r->lba + r->num_blocks == b->lba)
+		{
+			//nothing else covers the blocks in between, so it stays sorted
+			r->next	 = b->first;
+			b->first = r;
+			b->lba	 = r->lba;
+		}
+		else
+		{
+			continue;
+		}
+
+		b->num_blocks += r->num_blocks;
+		return true;
+	}
+
+	return false;
+}
+
+bool io_queue::enqueue(io_request* r)
+{
+	r->next = nullptr;
+	r->done = false;
+
+	sync::lock_guard l{m_mtx};
+
+	m_requests[r->op]++;
+
+	if(!try_merge(r))
+	{
+		auto b = new io_batch{};
+
+		b->op		  = r->op;
+		b->lba		  = r->lba;
+		b->num_blocks = r->num_blocks;
+		b->deadline	  = io_deadline(r->op);
+		b->first	  = r;
+		b->last		  = r;
+
+		io_batch** it = &m_sorted;
+		while(*it && (*it)->lba < b->lba)
+		{
+			it = &(*it)->next;
+		}
+		b->next = *it;
+		*it		= b;
+
+		it = &m_fifo;
+		while(*it)
+		{
+			it = &(*it)->fifo_next;
+		}
+		*it = b;
+	}
+
+	return m_plugged != 0;
+}
+
+void io_queue::submit(io_request* r)
+{
+	if(!enqueue(r))
+		run();
+}
+
+void io_queue::submit_and_wait(io_request* r)
+{
+	enqueue(r);
+	wait(r);
+}
+
+void io_queue::wait(const io_request* r)
+{
+	while(true)
+	{
+		//whatever the driver completed gets finished here, a plug is only
+		//overridden to get r itself to the driver
+		run(queued(r));
+
+		if(__atomic_load_n(&r->done, __ATOMIC_ACQUIRE))
+			return;
+
+		switch_to_active_task();
+		run_background_tasks();
+	}
+}
+
+void io_queue::plug()
+{
+	sync::lock_guard l{m_mtx};
+	m_plugged++;
+}
+
+void io_queue::unplug()
+{
+	{
+		sync::lock_guard l{m_mtx};
+
+		k_assert(m_plugged);
+		if(--m_plugged)
+			return;
+	}
+
+	run();
+}
+
+void io_queue::read(size_t lba, uint8_t* buf, size_t num_blocks)
+{
+	io_request r{IO_READ, lba, num_blocks, buf};
+	submit_and_wait(&r);
+}
+
+void io_queue::write(size_t lba, const uint8_t* buf, size_t num_blocks)
+{
+	io_request r{IO_WRITE, lba, num_blocks, const_cast<uint8_t*>(buf)};
+	submit_and_wait(&r);
+}
+
+void io_queue::get_stats(disk_stats* stats)
+{
+	sync::lock_guard l{m_mtx};
+
+	stats->read_requests   = m_requests[IO_READ];
+	stats->write_requests  = m_requests[IO_WRITE];
+	stats->read_transfers  = m_transfers[IO_READ];
+	stats->write_transfers = m_transfers[IO_WRITE];
+	stats->blocks_read	   = m_blocks[IO_READ];
+	stats->blocks_written  = m_blocks[IO_WRITE];
+
+	for(size_t i = 0; i < DISK_LATENCY_BUCKETS; i++)
+	{
+		stats->latency[i] = m_latency[i];
+	}
+}
+
+//the oldest batch if it's past its deadline, otherwise the next one up from the last
+io_batch* io_queue::next_batch()
+{
+	if(!m_sorted)
+		return nullptr;
+
+	io_batch* b = m_fifo;
+	if(sysclock_get_ticks() < b->deadline)
+	{
+		b = m_sorted;
+		for(auto it = m_sorted; it; it = it->next)
+		{
+			if(it->lba >= m_head_lba)
+			{
+				b = it;
+				break;
+			}
+		}
+	}
+
+	io_batch** it = &m_sorted;
+	while(*it != b)
+	{
+		it = &(*it)->next;
+	}
+	*it = b->next;
+
+	it = &m_fifo;
+	while(*it != b)
+	{
+		it = &(*it)->fifo_next;
+	}
+	*it = b->fifo_next;
+
+	m_head_lba = b->lba + b->num_blocks;
+	return b;
+}
+
+bool io_queue::queued(const io_request* r)
+{
+	sync::lock_guard l{m_mtx};
+
+	for(auto b = m_sorted; b; b = b->next)
+	{
+		for(auto it = b->first; it; it = it->next)
+		{
+			if(it == r)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+void io_queue::run(bool force)
+{
+	{
+		sync::lock_guard l{m_mtx};
+
+		//whoever is dispatching already gets to them
+		if(m_dispatching)
+			return;
+
+		m_dispatching = true;
+	}
+
+	while(true)
+	{
+		reap();
+
+		io_batch* b;
+
+		{
+			sync::lock_guard l{m_mtx};
+
+			const bool may_dispatch = force || !m_plugged;
+
+			b = may_dispatch && m_num_in_flight < m_depth ? next_batch() : nullptr;
+			if(!b)
+			{
+				m_dispatching = false;
+				return;
+			}
+		}
+
+		start(b);
+	}
+}
+
+void io_queue::reap()
+{
+	while(true)
+	{
+		io_batch* b = nullptr;
+
+		{
+			sync::lock_guard l{m_mtx};
+
+			for(io_batch** it = &m_in_flight; *it; it = &(*it)->in_flight_next)
+			{
+				if((*it)->finished.test())
+				{
+					b	= *it;
+					*it = b->in_flight_next;
+					m_num_in_flight--;
+					break;
+				}
+			}
+		}
+
+		if(!b)
+			return;
+
+		finish(b);
+	}
+}
+
+void io_queue::transfer(int op, size_t lba, uint8_t* buf, size_t num_blocks)
+{
+	if(op == IO_READ)
+	{
+		k_assert(m_driver.read_blocks);
+		m_driver.read_blocks(m_driver_data, lba, buf, num_blocks);
+	}
+	else
+	{
+		k_assert(m_driver.write_blocks);
+		m_driver.write_blocks(m_driver_data, lba, buf, num_blocks);
+	}
+}
+
+void io_queue::start(io_batch* b)
+{
+	b->started = sysclock_get_ticks();
+
+	//buffers that follow each other can be used as they are, unless the driver
+	//needs its own, those are only contiguous one at a time
+	b->contiguous = true;
+	for(auto r = b->first; r != b->last; r = r->next)
+	{
+		if(m_driver.allocate_buffer || r->buf + r->num_blocks * m_block_size != r->next->buf)
+		{
+			b->contiguous = false;
+			break;
+		}
+	}
+
+	b->buffer = b->contiguous ? b->first->buf : allocate_buffer(b->num_blocks * m_block_size);
+
+	if(!b->buffer)
+	{
+		//no memory to gather them in, they go one at a time
+		for(auto r = b->first; r; r = r->next)
+		{
+			transfer(r->op, r->lba, r->buf, r->num_blocks);
+		}
+
+		b->contiguous = true;
+		finish(b);
+		return;
+	}
+
+	if(!b->contiguous && b->op == IO_WRITE)
+	{
+		uint8_t* dst = b->buffer;
+		for(auto r = b->first; r; r = r->next)
+		{
+			memcpy(dst, r->buf, r->num_blocks * m_block_size);
+			dst += r->num_blocks * m_block_size;
+		}
+	}
+
+	if(m_driver.submit)
+	{
+		b->request = disk_request{b->op == IO_WRITE, b->lba, b->buffer, b->num_blocks,
+								  io_batch_complete, b, nullptr, nullptr};
+
+		{
+			sync::lock_guard l{m_mtx};
+
+			b->in_flight_next = m_in_flight;
+			m_in_flight		  = b;
+			m_num_in_flight++;
+		}
+
+		if(m_driver.submit(m_driver_data, &b->request) == 0)
+			return;
+
+		sync::lock_guard l{m_mtx};
+
+		io_batch** it = &m_in_flight;
+		while(*it != b)
+		{
+			it = &(*it)->in_flight_next;
+		}
+		*it = b->in_flight_next;
+		m_num_in_flight--;
+	}
+
+	transfer(b->op, b->lba, b->buffer, b->num_blocks);
+	finish(b);
+}
+
+void io_queue::finish(io_batch* b)
+{
+	const clock_t ms = (sysclock_get_ticks() - b->started) * 1000 / sysclock_get_rate();
+
+	size_t bucket = 0;
+	while(bucket < DISK_LATENCY_BUCKETS - 1 && ms >= ((clock_t)1 << bucket))
+	{
+		bucket++;
+	}
+
+	{
+		sync::lock_guard l{m_mtx};
+
+		m_transfers[b->op]++;
+		m_blocks[b->op] += b->num_blocks;
+		m_latency[bucket]++;
+	}
+
+	if(!b->contiguous)
+	{
+		if(b->op == IO_READ && b->status == 0)
+		{
+			const uint8_t* src = b->buffer;
+			for(auto r = b->first; r; r = r->next)
+			{
+				memcpy(r->buf, src, r->num_blocks * m_block_size);
+				src += r->num_blocks * m_block_size;
+			}
+		}
+
+		free_buffer(b->buffer, b->num_blocks * m_block_size);
+	}
+
+	for(auto r = b->first; r;)
+	{
+		auto next = r->next;
+
+		r->status = b->status;
+		if(r->complete)
+			r->complete(r, r->data);
+
+		__atomic_store_n(&r->done, true, __ATOMIC_RELEASE);
+		r = next;
+	}
+
+	delete b;
+}
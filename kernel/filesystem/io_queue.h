@@ -0,0 +1,117 @@
+#ifndef FS_IO_QUEUE_H
+#define FS_IO_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <kernel/filesystem/fs_driver.h>
+#include <kernel/locks.h>
+#include <common/disk_stats.h>
+
+enum io_op
+{
+	IO_READ,
+	IO_WRITE
+};
+
+//a transfer of whole blocks to or from one buffer, the queue may merge it with others
+struct io_request
+{
+	int op;
+	size_t lba;
+	size_t num_blocks;
+	uint8_t* buf;
+
+	//optional, called once the transfer is done by whoever dispatched it
+	void (*complete)(io_request* r, void* data) = nullptr;
+	void* data = nullptr;
+
+	//set by the queue, status is 0 if the transfer worked
+	io_request* next = nullptr;
+	int status = 0;
+	bool done = false;
+};
+
+struct io_batch;
+
+//Sits between the block cache and a disk driver. Requests for neighbouring blocks are
+//merged into batches, and batches go to the driver in order of their blocks, sweeping up
+//the disk and starting over at the lowest one, unless one has waited past its deadline.
+//While the queue is plugged requests only collect, so a burst of them can be merged.
+//Drivers that can take requests asynchronously get up to their queue depth of batches,
+//and what they complete is finished by whoever next submits or waits on the queue.
+//Nothing orders requests for the same blocks, callers never have those in flight twice.
+class io_queue
+{
+public:
+	io_queue(const disk_driver& driver, void* driver_data, size_t block_size);
+	~io_queue();
+
+	io_queue(const io_queue&) = delete;
+
+	//r must stay alive until it's done
+	void submit(io_request* r);
+	//submits r even if the queue is plugged and waits for it
+	void submit_and_wait(io_request* r);
+	//if r is still queued the queue is dispatched even when plugged, or it would never finish
+	void wait(const io_request* r);
+
+	//plugs nest, the queue starts dispatching when the last one is taken out
+	void plug();
+	void unplug();
+
+	//synchronous transfers through the queue
+	void read(size_t lba, uint8_t* buf, size_t num_blocks);
+	void write(size_t lba, const uint8_t* buf, size_t num_blocks);
+
+	//fills in the request, transfer and latency counts
+	void get_stats(disk_stats* stats);
+
+private:
+	//returns whether the queue is plugged
+	bool enqueue(io_request* r);
+	bool try_merge(io_request* r);
+	io_batch* next_batch();
+	bool queued(const io_request* r);
+	//finishes what the driver completed and dispatches more, unless the queue is
+	//plugged and it isn't forced
+	void run(bool force = false);
+	void reap();
+	void start(io_batch* b);
+	void finish(io_batch* b);
+	void transfer(int op, size_t lba, uint8_t* buf, size_t num_blocks);
+
+	uint8_t* allocate_buffer(size_t size) const;
+	void free_buffer(uint8_t* buf, size_t size) const;
+
+	const disk_driver& m_driver;
+	void* m_driver_data;
+	size_t m_block_size;
+	size_t m_max_batch_blocks;
+	size_t m_depth;
+
+	sync::mutex m_mtx{};
+
+	//sorted by lba, and in the order they came in
+	io_batch* m_sorted = nullptr;
+	io_batch* m_fifo = nullptr;
+
+	//batches the driver has, and how many
+	io_batch* m_in_flight = nullptr;
+	size_t m_num_in_flight = 0;
+
+	//the elevator's position
+	size_t m_head_lba = 0;
+
+	size_t m_plugged = 0;
+	bool m_dispatching = false;
+
+	//indexed by io_op
+	size_t m_requests[2] = {};
+	size_t m_transfers[2] = {};
+	size_t m_blocks[2] = {};
+	size_t m_latency[DISK_LATENCY_BUCKETS] = {};
+};
+
+#endif
@@ -0,0 +1,298 @@
+#include <kernel/filesystem/page_cache.h>
+#include <kernel/physical_manager.h>
+#include <kernel/memorymanager.h>
+#include <kernel/page_reclaim.h>
+#include <kernel/locks.h>
+#include <kernel/kassert.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+//the cache can grow to 1 / PAGE_CACHE_MEMORY_SHARE of the memory free when it's first used
+#define PAGE_CACHE_MEMORY_SHARE 16
+#define PAGE_CACHE_MIN_PAGES 16
+#define PAGE_CACHE_MAX_PAGES 4096
+
+#define PAGE_CACHE_BUCKETS 1024
+
+//a miss reads up to this many missing pages from the driver at once
+#define PAGE_CACHE_MAX_FILL 16
+
+struct cached_page
+{
+	size_t disk_id;
+	fs_index location;
+	size_t index;
+
+	//how much of the page is in the file, only the last one is short
+	size_t size;
+	uint8_t* data;
+
+	cached_page* hash_next;
+	cached_page* lru_prev;
+	cached_page* lru_next;
+};
+
+static cached_page* buckets[PAGE_CACHE_BUCKETS];
+
+//most recently used first, evicted from the back
+static cached_page* lru_head = nullptr;
+static cached_page* lru_tail = nullptr;
+
+static size_t num_pages = 0;
+static size_t max_pages = 0;
+
+//bumped by every invalidation, a fill that raced one doesn't go in
+static size_t generation = 0;
+
+static constinit sync::mutex page_cache_mutex{};
+
+static cached_page** page_bucket(size_t disk_id, fs_index location, size_t index)
+{
+	const uint32_t h = ((uint32_t)location * 0x9E3779B1u) ^ ((uint32_t)index * 0x85EBCA6Bu) ^
+					   (uint32_t)disk_id;
+
+	return &buckets[(h ^ (h >> 16)) & (PAGE_CACHE_BUCKETS - 1)];
+}
+
+static cached_page* page_find(const file_data_block* file, size_t index)
+{
+	auto p = *page_bucket(file->disk_id, file->location_on_disk, index);
+	while(p && !(p->index == index && p->location == file->location_on_disk &&
+				 p->disk_id == file->disk_id))
+	{
+		p = p->hash_next;
+	}
+
+	return p;
+}
+
+static void lru_unlink(cached_page* p)
+{
+	(p->lru_prev ? p->lru_prev->lru_next : lru_head) = p->lru_next;
+	(p->lru_next ? p->lru_next->lru_prev : lru_tail) = p->lru_prev;
+}
+
+static void lru_push_front(cached_page* p)
+{
+	p->lru_prev = nullptr;
+	p->lru_next = lru_head;
+	(lru_head ? lru_head->lru_prev : lru_tail) = p;
+	lru_head = p;
+}
+
+static void page_remove(cached_page* p)
+{
+	auto it = page_bucket(p->disk_id, p->location, p->index);
+	while(*it != p)
+	{
+		it = &(*it)->hash_next;
+	}
+	*it = p->hash_next;
+
+	lru_unlink(p);
+	num_pages--;
+
+	free(p->data);
+	delete p;
+}
+
+static size_t page_cache_reclaim(void*, size_t num_bytes)
+{
+	if(!page_cache_mutex.try_lock())
+		return 0;
+
+	size_t freed = 0;
+	while(lru_tail && freed < num_bytes)
+	{
+		page_remove(lru_tail);
+		freed += PAGE_SIZE;
+	}
+
+	page_cache_mutex.unlock();
+	return freed;
+}
+
+//copies what's cached of one page, returns false if the part that's wanted isn't
+static bool page_copy(const file_data_block* file, size_t index, size_t in_page, uint8_t* dst,
+					  size_t len)
+{
+	//dst can be a mapped file too, it's faulted in first so that doesn't happen under the lock,
+	//for writing, a read would only map the zero page or leave a shared frame to copy later
+	(void)__atomic_fetch_add(dst, 0, __ATOMIC_RELAXED);
+	(void)__atomic_fetch_add(dst + len - 1, 0, __ATOMIC_RELAXED);
+
+	sync::lock_guard l{page_cache_mutex};
+
+	auto p = page_find(file, index);
+	if(!p || in_page + len > p->size)
+		return false;
+
+	memcpy(dst, p->data + in_page, len);
+
+	lru_unlink(p);
+	lru_push_front(p);
+	return true;
+}
+
+static bool page_cached(const file_data_block* file, size_t index)
+{
+	sync::lock_guard l{page_cache_mutex};
+	return page_find(file, index) != nullptr;
+}
+
+static void page_insert(const file_data_block* file, size_t index, const uint8_t* src,
+						size_t size, size_t fill_generation)
+{
+	sync::lock_guard l{page_cache_mutex};
+
+	if(fill_generation != generation)
+		return;
+
+	if(!max_pages)
+	{
+		max_pages = physical_num_bytes_free() / PAGE_CACHE_MEMORY_SHARE / PAGE_SIZE;
+		max_pages = std::clamp<size_t>(max_pages, PAGE_CACHE_MIN_PAGES, PAGE_CACHE_MAX_PAGES);
+
+		page_reclaim_add(page_cache_reclaim, nullptr);
+	}
+
+	//a shorter copy of the last page, from before the file grew
+	if(auto p = page_find(file, index))
+	{
+		if(p->size >= size)
+			return;
+
+		page_remove(p);
+	}
+
+	if(num_pages == max_pages)
+		page_remove(lru_tail);
+
+	auto data = (uint8_t*)malloc(PAGE_SIZE);
+	if(!data)
+		return;
+
+	memcpy(data, src, size);
+
+	auto bucket = page_bucket(file->disk_id, file->location_on_disk, index);
+	auto p		= new cached_page{file->disk_id, file->location_on_disk, index, size, data,
+								  *bucket, nullptr, nullptr};
+	*bucket		= p;
+
+	lru_push_front(p);
+	num_pages++;
+}
+
+void page_cache_read(const file_data_block* file, const filesystem_virtual_drive* drive,
+					 file_size_t offset, uint8_t* dst, size_t len)
+{
+	k_assert(!(file->flags & IS_DIR));
+	k_assert(offset + len <= file->size);
+
+	const size_t last_index = len ? (size_t)((offset + len - 1) / PAGE_SIZE) : 0;
+
+	size_t done = 0;
+	while(done < len)
+	{
+		const file_size_t pos = offset + done;
+		const size_t index	  = (size_t)(pos / PAGE_SIZE);
+		const size_t in_page  = (size_t)(pos % PAGE_SIZE);
+		const size_t wanted	  = std::min(PAGE_SIZE - in_page, len - done);
+
+		if(page_copy(file, index, in_page, dst + done, wanted))
+		{
+			done += wanted;
+			continue;
+		}
+
+		//the driver reads the missing pages up to the next cached one in one go
+		size_t num_fill = 1;
+		while(num_fill < PAGE_CACHE_MAX_FILL && index + num_fill <= last_index &&
+			  !page_cached(file, index + num_fill))
+		{
+			num_fill++;
+		}
+
+		const file_size_t start = (file_size_t)index * PAGE_SIZE;
+		size_t fill_size		= (size_t)std::min<file_size_t>(num_fill * PAGE_SIZE,
+																file->size - start);
+
+		//when memory is low a single page is tried, and if even that fails
+		//the rest is read straight into dst without being cached
+		auto buffer = (uint8_t*)malloc(fill_size);
+		if(!buffer && fill_size > PAGE_SIZE)
+		{
+			fill_size = PAGE_SIZE;
+			buffer	  = (uint8_t*)malloc(fill_size);
+		}
+
+		if(!buffer)
+		{
+			drive->fs_driver->read_chunks(dst + done, file->location_on_disk, pos, len - done,
+										  file, drive);
+			return;
+		}
+
+		size_t fill_generation;
+		{
+			sync::lock_guard l{page_cache_mutex};
+			fill_generation = generation;
+		}
+
+		drive->fs_driver->read_chunks(buffer, file->location_on_disk, start, fill_size,
+									  file, drive);
+
+		for(size_t i = 0; i * PAGE_SIZE < fill_size; i++)
+		{
+			page_insert(file, index + i, &buffer[i * PAGE_SIZE],
+						std::min<size_t>(PAGE_SIZE, fill_size - i * PAGE_SIZE), fill_generation);
+		}
+
+		const size_t copied = std::min(fill_size - in_page, len - done);
+		memcpy(dst + done, &buffer[in_page], copied);
+		done += copied;
+
+		free(buffer);
+	}
+}
+
+void page_cache_invalidate(const file_data_block* file, file_size_t offset, size_t len)
+{
+	if(len == 0)
+		return;
+
+	const size_t first = (size_t)(offset / PAGE_SIZE);
+	const size_t last  = (size_t)((offset + len - 1) / PAGE_SIZE);
+
+	sync::lock_guard l{page_cache_mutex};
+	generation++;
+
+	//more pages than are cached, it's quicker to look at each cached one
+	if(last - first >= num_pages)
+	{
+		for(auto p = lru_head; p;)
+		{
+			auto next = p->lru_next;
+			if(p->disk_id == file->disk_id && p->location == file->location_on_disk &&
+			   p->index >= first && p->index <= last)
+				page_remove(p);
+
+			p = next;
+		}
+
+		return;
+	}
+
+	for(size_t i = first; i <= last; i++)
+	{
+		if(auto p = page_find(file, i))
+			page_remove(p);
+	}
+}
+
+void page_cache_drop_file(const file_data_block* file)
+{
+	page_cache_invalidate(file, 0, (size_t)-1);
+}
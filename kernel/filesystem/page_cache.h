@@ -0,0 +1,18 @@
+#ifndef FS_PAGE_CACHE_H
+#define FS_PAGE_CACHE_H
+
+#include <kernel/filesystem/fs_driver.h>
+
+//Pages of file data kept above the filesystem drivers, found by the file's drive and location
+//on disk and the offset in the file. Reads of cached pages don't go to the driver at all.
+//Anything that changes a file's data on disk has to invalidate what it changed.
+
+//reads through the cache, the range must be inside the file
+void page_cache_read(const file_data_block* file, const filesystem_virtual_drive* drive,
+					 file_size_t offset, uint8_t* dst, size_t len);
+
+void page_cache_invalidate(const file_data_block* file, file_size_t offset, size_t len);
+//drops all of a file's pages, once it's deleted something else can get its location
+void page_cache_drop_file(const file_data_block* file);
+
+#endif
@@ -1,13 +1,27 @@
 #include <kernel/filesystem.h>
 #include <kernel/filesystem/fs_driver.h>
 #include <kernel/filesystem/drives.h>
+#include <kernel/filesystem/page_cache.h>
+#include <kernel/memorymanager.h>
+#include <kernel/locks.h>
 #include <kernel/kassert.h>
 
+#include <algorithm>
+
+//sequential reads start with this much readahead, and double it each time up to the max
+#define READAHEAD_MIN_WINDOW 0x4000
+#define READAHEAD_MAX_WINDOW 0x20000
+
 //an instance of an open file
 struct file_stream
 {
 	file_data_block file;
 	bool modified;
+
+	//where the last read ended, and how far past it has been queued for readahead
+	file_size_t next_offset = 0;
+	file_size_t readahead_end = 0;
+	size_t readahead_window = 0;
 };
 
 file_stream* filesystem_create_stream(const file_data_block* f)
@@ -75,12 +89,44 @@ int filesystem_close_file(file_stream* s)
 	return 0;
 }
 
-size_t filesystem_read_file(file_size_t offset, void* dst_buf, size_t len,
-							file_stream* s)
+//reads that carry on where the last one ended keep the next window queued,
+//any other read stops readahead until reads are sequential again
+static void filesystem_stream_readahead(file_stream* s, const filesystem_virtual_drive* drive,
+										file_size_t offset, size_t len)
 {
-	k_assert(dst_buf);
-	k_assert(s);
+	const file_size_t end = offset + len;
+
+	if(offset != s->next_offset || (s->file.flags & IS_DIR))
+	{
+		s->next_offset		= end;
+		s->readahead_end	= end;
+		s->readahead_window = 0;
+		return;
+	}
+
+	s->next_offset		= end;
+	s->readahead_window = s->readahead_window ? std::min<size_t>(s->readahead_window * 2, READAHEAD_MAX_WINDOW)
+											  : READAHEAD_MIN_WINDOW;
+
+	if(s->readahead_end < end)
+		s->readahead_end = end;
 
+	//the next window is queued once half of the last one has been read
+	if(s->readahead_end - end > s->readahead_window / 2)
+		return;
+
+	const file_size_t stop = std::min<file_size_t>(end + s->readahead_window, s->file.size);
+	if(stop <= s->readahead_end)
+		return;
+
+	filesystem_readahead(drive, &s->file, s->readahead_end, (size_t)(stop - s->readahead_end));
+	s->readahead_end = stop;
+}
+
+//reads what there is of [offset, offset + len) in the file, returns how much that was
+static size_t filesystem_stream_read(file_stream* s, const filesystem_virtual_drive* drive,
+									 file_size_t offset, uint8_t* dst, size_t len)
+{
 	if(!(s->file.flags & IS_DIR))
 	{
 		if(offset >= s->file.size)
@@ -95,15 +141,113 @@ size_t filesystem_read_file(file_size_t offset, void* dst_buf, size_t len,
 		}
 	}
 
+	//files that don't have anything on disk yet have no location to cache them by
+	if(!(s->file.flags & IS_DIR) && s->file.location_on_disk)
+	{
+		page_cache_read(&s->file, drive, offset, dst, len);
+		return len;
+	}
+
+	drive->fs_driver->read_chunks(dst, s->file.location_on_disk, offset,
+								  len, &s->file, drive);
+	return len;
+}
+
+size_t filesystem_read_file(file_size_t offset, void* dst_buf, size_t len,
+							file_stream* s)
+{
+	k_assert(dst_buf);
+	k_assert(s);
+
 	auto drive = filesystem_get_drive(s->file.disk_id);
 
-	uint8_t* dst_ptr = (uint8_t*)dst_buf;
+	len = filesystem_stream_read(s, drive, offset, (uint8_t*)dst_buf, len);
+	if(len == 0)
+		return 0;
 
-	drive->fs_driver->read_chunks(dst_ptr, s->file.location_on_disk, offset,
-								  len, &s->file, drive);
+	filesystem_stream_readahead(s, drive, offset, len);
 	return len;
 }
 
+//buffers that follow each other in memory go to the driver as one read
+size_t filesystem_read_file_vec(file_size_t offset, const file_iovec* iov, size_t count,
+								file_stream* s)
+{
+	k_assert(iov);
+	k_assert(s);
+
+	auto drive = filesystem_get_drive(s->file.disk_id);
+
+	size_t total = 0;
+	for(size_t i = 0; i < count;)
+	{
+		uint8_t* buf = (uint8_t*)iov[i].buf;
+		size_t len	 = iov[i].len;
+
+		for(i++; i < count && buf + len == iov[i].buf; i++)
+		{
+			len += iov[i].len;
+		}
+
+		const size_t read = filesystem_stream_read(s, drive, offset + total, buf, len);
+		total += read;
+
+		if(read < len)
+			break;
+	}
+
+	if(total)
+		filesystem_stream_readahead(s, drive, offset, total);
+
+	return total;
+}
+
+//Segments are read in file order, and ones that follow each other in the file and in
+//memory go to the driver as one read. They don't move the readahead window.
+size_t filesystem_read_file_multi(file_segment* segments, size_t count, file_stream* s)
+{
+	k_assert(segments);
+	k_assert(s);
+
+	auto drive = filesystem_get_drive(s->file.disk_id);
+
+	std::vector<file_segment*> order;
+	order.reserve(count);
+	for(size_t i = 0; i < count; i++)
+	{
+		order.push_back(&segments[i]);
+	}
+
+	std::sort(order.begin(), order.end(), [](const file_segment* a, const file_segment* b) {
+		return a->offset < b->offset;
+	});
+
+	size_t total = 0;
+	for(size_t i = 0; i < count;)
+	{
+		const file_size_t offset = order[i]->offset;
+		uint8_t* buf			 = (uint8_t*)order[i]->buf;
+		size_t len				 = order[i]->len;
+
+		size_t end = i + 1;
+		while(end < count && order[end]->offset == offset + len && order[end]->buf == buf + len)
+		{
+			len += order[end++]->len;
+		}
+
+		size_t read = filesystem_stream_read(s, drive, offset, buf, len);
+
+		for(; i < end; i++)
+		{
+			order[i]->done = std::min(read, order[i]->len);
+			read -= order[i]->done;
+			total += order[i]->done;
+		}
+	}
+
+	return total;
+}
+
 void filesystem_allocate_space(file_stream* s, fs_index location,
 							   file_size_t requested_size)
 {
@@ -136,14 +280,63 @@ size_t filesystem_write_file(file_size_t offset, const void* dst_buf,
 
 	drive->fs_driver->write_chunks(dst_ptr, s->file.location_on_disk, offset,
 								   len, &s->file, drive);
+	page_cache_invalidate(&s->file, offset, len);
 	s->modified = true;
 	return len;
 }
 
+//space for all the buffers is allocated at once, and ones that follow each other
+//in memory go to the driver as one write
+size_t filesystem_write_file_vec(file_size_t offset, const file_iovec* iov, size_t count,
+								 file_stream* s)
+{
+	k_assert(iov);
+	k_assert(s);
+	k_assert(!(s->file.flags & IS_READONLY));
+
+	auto drive = filesystem_get_drive(s->file.disk_id);
+
+	k_assert(drive->fs_driver->write_chunks);
+
+	size_t len = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		len += iov[i].len;
+	}
+
+	if(!(s->file.flags & IS_DIR) && offset + len >= s->file.size)
+	{
+		filesystem_allocate_space(s, s->file.location_on_disk, offset + len);
+		len = s->file.size > offset ? (size_t)(s->file.size - offset) : 0;
+	}
+
+	size_t total = 0;
+	for(size_t i = 0; i < count && total < len;)
+	{
+		const uint8_t* buf = (const uint8_t*)iov[i].buf;
+		size_t run		   = iov[i].len;
+
+		for(i++; i < count && buf + run == iov[i].buf; i++)
+		{
+			run += iov[i].len;
+		}
+
+		run = std::min(run, len - total);
+
+		drive->fs_driver->write_chunks(buf, s->file.location_on_disk, offset + total,
+									   run, &s->file, drive);
+		total += run;
+	}
+
+	page_cache_invalidate(&s->file, offset, total);
+	s->modified = true;
+	return total;
+}
+
 SYSCALL_HANDLER size_t syscall_read_file(file_size_t offset, void* dst,
 										 size_t len, file_stream* f)
 {
-	if(f == nullptr || dst == nullptr)
+	if(f == nullptr || dst == nullptr || !memmanager_prefault_user(dst, len, true))
 	{
 		return 0;
 	}
@@ -153,13 +346,82 @@ SYSCALL_HANDLER size_t syscall_read_file(file_size_t offset, void* dst,
 SYSCALL_HANDLER size_t syscall_write_file(file_size_t offset, const void* dst,
 										  size_t len, file_stream* f)
 {
-	if(f == nullptr || dst == nullptr || (f->file.flags & IS_READONLY))
+	if(f == nullptr || dst == nullptr || (f->file.flags & IS_READONLY) ||
+	   !memmanager_prefault_user(dst, len, false))
 	{
 		return 0;
 	}
 	return filesystem_write_file(offset, dst, len, f);
 }
 
+//write is whether the buffers are written to, they're faulted in before any locks are taken
+static bool iovecs_valid(const file_iovec* iov, size_t count, bool write)
+{
+	if(iov == nullptr || count > FILE_MAX_IOVECS ||
+	   !memmanager_prefault_user(iov, count * sizeof(file_iovec), false))
+		return false;
+
+	//the lengths are added up into a size_t, so they can't be allowed to wrap
+	size_t total = 0;
+	for(size_t i = 0; i < count; i++)
+	{
+		if(iov[i].buf == nullptr && iov[i].len)
+			return false;
+
+		if(iov[i].len > (size_t)-1 - total)
+			return false;
+
+		total += iov[i].len;
+
+		if(!memmanager_prefault_user(iov[i].buf, iov[i].len, write))
+			return false;
+	}
+
+	return true;
+}
+
+SYSCALL_HANDLER size_t syscall_read_file_vec(file_size_t offset, const file_iovec* iov,
+											 size_t count, file_stream* f)
+{
+	if(f == nullptr || !iovecs_valid(iov, count, true))
+	{
+		return 0;
+	}
+	return filesystem_read_file_vec(offset, iov, count, f);
+}
+
+SYSCALL_HANDLER size_t syscall_write_file_vec(file_size_t offset, const file_iovec* iov,
+											  size_t count, file_stream* f)
+{
+	if(f == nullptr || !iovecs_valid(iov, count, false) || (f->file.flags & IS_READONLY))
+	{
+		return 0;
+	}
+	return filesystem_write_file_vec(offset, iov, count, f);
+}
+
+SYSCALL_HANDLER size_t syscall_read_file_multi(file_segment* segments, size_t count,
+											   file_stream* f)
+{
+	if(f == nullptr || segments == nullptr || count > FILE_MAX_IOVECS ||
+	   !memmanager_prefault_user(segments, count * sizeof(file_segment), true))
+	{
+		return 0;
+	}
+
+	for(size_t i = 0; i < count; i++)
+	{
+		segments[i].done = 0;
+		if(segments[i].buf == nullptr && segments[i].len)
+			return 0;
+
+		if(!memmanager_prefault_user(segments[i].buf, segments[i].len, true))
+			return 0;
+	}
+
+	return filesystem_read_file_multi(segments, count, f);
+}
+
 SYSCALL_HANDLER
 file_stream* syscall_open_file(directory_stream* rel,
 							   const char* path,
@@ -189,4 +451,118 @@ SYSCALL_HANDLER int syscall_close_file(file_stream* stream)
 
 	filesystem_close_file(stream);
 	return 0;
-}
\ No newline at end of file
+}
+
+SYSCALL_HANDLER int syscall_sync_file(file_stream* f)
+{
+	if(f == nullptr)
+	{
+		return -1;
+	}
+
+	if(f->file.flags & IS_READONLY)
+	{
+		return 0;
+	}
+
+	auto drive = filesystem_get_drive(f->file.disk_id);
+
+	if(f->modified)
+	{
+		k_assert(drive->fs_driver->flush_file);
+		drive->fs_driver->flush_file(&f->file, drive);
+	}
+
+	//the cache doesn't know which blocks belong to the file
+	return filesystem_sync_disk(drive->disk);
+}
+
+//a file mapped into an address space, the mapping keeps its own stream open
+struct mapped_file
+{
+	file_stream* stream;
+	size_t refs;
+};
+
+static size_t mapped_file_read(void* data, uint64_t offset, void* dst, size_t len)
+{
+	return filesystem_read_file(offset, dst, len, static_cast<mapped_file*>(data)->stream);
+}
+
+static size_t mapped_file_write(void* data, uint64_t offset, const void* src, size_t len)
+{
+	return filesystem_write_file(offset, src, len, static_cast<mapped_file*>(data)->stream);
+}
+
+static void mapped_file_retain(void* data)
+{
+	sync::atomic_add(&static_cast<mapped_file*>(data)->refs, (size_t)1);
+}
+
+static void mapped_file_release(void* data)
+{
+	auto m = static_cast<mapped_file*>(data);
+
+	if(sync::atomic_sub(&m->refs, (size_t)1) == 0)
+	{
+		filesystem_close_file(m->stream);
+		delete m;
+	}
+}
+
+static constexpr page_source mapped_file_source = {
+	.read	 = mapped_file_read,
+	.retain	 = mapped_file_retain,
+	.release = mapped_file_release,
+};
+
+static constexpr page_source mapped_file_source_rw = {
+	.read	 = mapped_file_read,
+	.write	 = mapped_file_write,
+	.retain	 = mapped_file_retain,
+	.release = mapped_file_release,
+};
+
+SYSCALL_HANDLER void* syscall_map_file(file_size_t offset, size_t length, int flags,
+									   file_stream* f)
+{
+	if(f == nullptr || length == 0 || (offset & (PAGE_SIZE - 1)) || (f->file.flags & IS_DIR))
+	{
+		return nullptr;
+	}
+
+	const bool writable = flags & FILE_WRITE;
+	if(writable && (f->file.flags & IS_READONLY))
+	{
+		return nullptr;
+	}
+
+	const size_t num_pages = memmanager_minimum_pages(length);
+
+	//pages past the end of the file read as zero and aren't written back
+	size_t file_bytes = 0;
+	if(offset < f->file.size)
+	{
+		file_bytes = (f->file.size - offset < length) ? (size_t)(f->file.size - offset) : length;
+	}
+
+	void* address = memmanager_virtual_alloc(nullptr, num_pages,
+											 PAGE_USER | (writable ? PAGE_RW : 0));
+	if(address == nullptr)
+	{
+		return nullptr;
+	}
+
+	auto m = new mapped_file{filesystem_create_stream(&f->file), 1};
+
+	if(!memmanager_map_file(address, num_pages,
+							writable ? &mapped_file_source_rw : &mapped_file_source,
+							m, offset, file_bytes))
+	{
+		mapped_file_release(m);
+		memmanager_free_pages(address, num_pages);
+		return nullptr;
+	}
+
+	return address;
+}
@@ -1,11 +1,13 @@
 #include <stdint.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <bit>
 #include <array>
 
 #include <kernel/memorymanager.h>
 #include <kernel/task.h>
+#include <kernel/locks.h>
 #include <kernel/interrupt.h>
 #include <kernel/display.h>
 #include <kernel/tss.h>
@@ -275,11 +277,21 @@ extern "C" void fault_handler(interrupt_info * r)
 	if(r->int_no < 32)
 	{
 		if(r->int_no == 14 &&
-		   memmanager_handle_page_fault(r->err_code, getcr2reg())) //page fault
+		   memmanager_handle_page_fault(r->err_code, getcr2reg(), r->eflags)) //page fault
 		{
 			return; //page fault handled, we can resume execution
 		}
 
+		//a user program that faults, or goes over its memory limit, only takes itself down
+		if((r->cs & 3) == 3)
+		{
+			print_string(exception_messages[r->int_no]);
+			printf(" exception in user code at %X, ending the process\n", r->eip);
+
+			unlock_interrupts(lock_interrupts() | (r->eflags & 0x200));
+			exit_process(-1);
+		}
+
 		display_mode requested = {
 			80, 25,
 			0,0,0,
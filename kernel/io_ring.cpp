@@ -0,0 +1,202 @@
+#include <kernel/io_ring.h>
+#include <kernel/filesystem.h>
+#include <kernel/physical_manager.h>
+#include <kernel/memorymanager.h>
+#include <kernel/task.h>
+#include <kernel/locks.h>
+
+#include <string.h>
+
+struct io_ring
+{
+	//the kernel's own mapping, it's there whichever address space is loaded
+	io_ring_header* header;
+	void* user_address;
+
+	//userspace can write the header, only the heads and tails in it are read after setup
+	io_ring_sqe* sq;
+	io_ring_cqe* cq;
+	uint32_t sq_entries;
+	uint32_t cq_entries;
+
+	uintptr_t physical;
+	size_t num_pages;
+	int flags;
+
+	//held while submissions are taken, threads of the process can enter at the same time
+	sync::mutex mtx;
+};
+
+static size_t round_up_entries(size_t entries)
+{
+	size_t n = 1;
+	while(n < entries)
+	{
+		n <<= 1;
+	}
+
+	return n;
+}
+
+static uintptr_t io_ring_do(const io_ring_sqe& sqe)
+{
+	switch(sqe.op)
+	{
+	case IO_RING_NOP:
+		return 0;
+	case IO_RING_READ:
+		return syscall_read_file(sqe.offset, sqe.buf, sqe.len, sqe.file);
+	case IO_RING_WRITE:
+		return syscall_write_file(sqe.offset, sqe.buf, sqe.len, sqe.file);
+	case IO_RING_OPEN:
+		return (uintptr_t)syscall_open_file(sqe.dir, (const char*)sqe.buf, sqe.len, sqe.mode);
+	case IO_RING_CLOSE:
+		return (uintptr_t)syscall_close_file(sqe.file);
+	case IO_RING_SYNC:
+		return (uintptr_t)syscall_sync_file(sqe.file);
+	default:
+		return (uintptr_t)-1;
+	}
+}
+
+//does up to max submissions while there's room for their completions, the caller holds mtx
+static size_t io_ring_drain(io_ring* r, size_t max)
+{
+	io_ring_header* h = r->header;
+
+	size_t count = 0;
+	while(count < max)
+	{
+		const uint32_t head = h->sq_head;
+		if(head == __atomic_load_n(&h->sq_tail, __ATOMIC_ACQUIRE))
+			break;
+
+		const uint32_t cq_tail = h->cq_tail;
+		if(cq_tail - __atomic_load_n(&h->cq_head, __ATOMIC_ACQUIRE) >= r->cq_entries)
+			break;
+
+		//copied, userspace can change the entry while it's being worked on
+		const io_ring_sqe sqe = r->sq[head & (r->sq_entries - 1)];
+		__atomic_store_n(&h->sq_head, head + 1, __ATOMIC_RELEASE);
+
+		const uintptr_t result = io_ring_do(sqe);
+
+		r->cq[cq_tail & (r->cq_entries - 1)] = io_ring_cqe{sqe.user_data, result};
+		__atomic_store_n(&h->cq_tail, cq_tail + 1, __ATOMIC_RELEASE);
+
+		count++;
+	}
+
+	return count;
+}
+
+SYSCALL_HANDLER void* io_ring_setup(size_t entries, int flags)
+{
+	if(entries == 0 || entries > IO_RING_MAX_ENTRIES || (flags & ~IO_RING_POLL))
+		return nullptr;
+
+	if(process_get_io_ring())
+		return nullptr;
+
+	const size_t sq_entries = round_up_entries(entries);
+	const size_t cq_entries = sq_entries * 2;
+
+	const size_t sq_offset = (sizeof(io_ring_header) + alignof(io_ring_sqe) - 1) &
+							 ~(alignof(io_ring_sqe) - 1);
+	const size_t cq_offset = sq_offset + sq_entries * sizeof(io_ring_sqe);
+	const size_t size	   = cq_offset + cq_entries * sizeof(io_ring_cqe);
+
+	auto r		 = new io_ring{};
+	r->num_pages = memmanager_minimum_pages(size);
+	r->flags	 = flags;
+	r->physical	 = physical_memory_allocate(r->num_pages * PAGE_SIZE, PAGE_SIZE);
+
+	if(!r->physical)
+	{
+		delete r;
+		return nullptr;
+	}
+
+	r->header = (io_ring_header*)memmanager_map_to_new_pages(r->physical, r->num_pages,
+															 PAGE_PRESENT | PAGE_RW);
+	r->user_address = memmanager_map_to_new_pages(r->physical, r->num_pages,
+												  PAGE_USER | PAGE_PRESENT | PAGE_RW);
+
+	if(!r->header || !r->user_address)
+	{
+		io_ring_destroy(r);
+		return nullptr;
+	}
+
+	memset(r->header, 0, r->num_pages * PAGE_SIZE);
+	r->header->sq_entries = (uint32_t)sq_entries;
+	r->header->cq_entries = (uint32_t)cq_entries;
+	r->header->flags	  = (uint32_t)flags;
+	r->header->sq_offset  = (uint32_t)sq_offset;
+	r->header->cq_offset  = (uint32_t)cq_offset;
+
+	r->sq		  = (io_ring_sqe*)((uint8_t*)r->header + sq_offset);
+	r->cq		  = (io_ring_cqe*)((uint8_t*)r->header + cq_offset);
+	r->sq_entries = (uint32_t)sq_entries;
+	r->cq_entries = (uint32_t)cq_entries;
+
+	//another thread of the process set one up first
+	if(!process_set_io_ring(r))
+	{
+		io_ring_destroy(r);
+		return nullptr;
+	}
+
+	return r->user_address;
+}
+
+SYSCALL_HANDLER int io_ring_enter(size_t to_submit, size_t min_complete)
+{
+	auto r = process_get_io_ring();
+	if(!r)
+		return -1;
+
+	size_t submitted;
+	{
+		sync::lock_guard l{r->mtx};
+		submitted = io_ring_drain(r, to_submit);
+	}
+
+	//submissions are only ever done here, by a thread of the process that owns the ring,
+	//so the buffers, handles and memory limits they use are that process's
+	const io_ring_header* h = r->header;
+	if(min_complete > r->cq_entries)
+		min_complete = r->cq_entries;
+
+	//a polled ring also takes what's been queued past to_submit, until min_complete are done
+	while((r->flags & IO_RING_POLL) &&
+		  __atomic_load_n(&h->cq_tail, __ATOMIC_ACQUIRE) - h->cq_head < min_complete)
+	{
+		sync::lock_guard l{r->mtx};
+
+		const size_t taken = io_ring_drain(r, min_complete);
+		if(taken == 0)
+			break;
+
+		submitted += taken;
+	}
+
+	return (int)submitted;
+}
+
+void io_ring_unmap_user(io_ring* r)
+{
+	memmanager_unmap_pages(r->user_address, r->num_pages);
+}
+
+void io_ring_destroy(io_ring* r)
+{
+	if(r->user_address)
+		memmanager_unmap_pages(r->user_address, r->num_pages);
+
+	if(r->header)
+		memmanager_unmap_pages(r->header, r->num_pages);
+
+	physical_memory_free(r->physical, r->num_pages * PAGE_SIZE);
+	delete r;
+}
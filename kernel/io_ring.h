@@ -0,0 +1,31 @@
+#ifndef KERNEL_IO_RING_H
+#define KERNEL_IO_RING_H
+
+#include <kernel/syscall.h>
+#include <common/io_ring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+	struct io_ring;
+	typedef struct io_ring io_ring;
+
+	//gives the process a submission and completion ring, entries are rounded up to a
+	//power of 2, returns where the ring's io_ring_header is mapped or null
+	SYSCALL_HANDLER void* io_ring_setup(size_t entries, int flags);
+	//does up to to_submit of the submissions, a polled ring also does the ones after them
+	//until there are min_complete completions, returns how many it took or -1
+	SYSCALL_HANDLER int io_ring_enter(size_t to_submit, size_t min_complete);
+
+	//called when the process exits, while its address space is still around
+	void io_ring_destroy(io_ring* ring);
+	//takes the ring out of the loaded address space, a forked child gets a copy of the
+	//mapping but the frames go with the parent's ring
+	void io_ring_unmap_user(io_ring* ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -82,6 +82,8 @@ void kernel_main()
 
 	setup_syscalls();
 
+	memmanager_start_background_thread();
+
 	ramdisk_init();
 
 	rdfs_init();
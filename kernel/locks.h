@@ -161,6 +161,18 @@ T atomic_add(T* ptr, T amount)
 #endif
 }
 
+//returns the new value
+template<typename T>
+T atomic_sub(T* ptr, T amount)
+{
+#ifdef SINGLE_CPU_ONLY
+	interrupt_lock l{};
+	return *ptr -= amount;
+#else
+	return __atomic_sub_fetch(ptr, amount, __ATOMIC_SEQ_CST);
+#endif
+}
+
 template<typename Mutex> class shared_lock;
 
 template<typename Mutex>
@@ -268,6 +280,11 @@ public:
 		exclusive_mtx.lock();
 	}
 
+	bool try_lock()
+	{
+		return exclusive_mtx.try_lock();
+	}
+
 	void unlock()
 	{
 		exclusive_mtx.unlock();
@@ -304,6 +321,16 @@ public:
 		mtx.lock();
 	}
 
+	bool try_lock()
+	{
+		if(!meta_mutex.try_lock())
+			return false;
+
+		bool locked = mtx.try_lock();
+		meta_mutex.unlock();
+		return locked;
+	}
+
 	void unlock()
 	{
 		mtx.unlock();
@@ -6,6 +6,8 @@
 #include <kernel/physical_manager.h>
 #include <kernel/locks.h>
 #include <kernel/kassert.h>
+#include <kernel/page_reclaim.h>
+#include <kernel/util/range_tree.h>
 
 static inline void __flush_tlb()
 {
@@ -25,31 +27,117 @@ static inline void __flush_tlb_page(uintptr_t addr)
 #endif
 }
 
+//reloading cr3 leaves global pages alone, toggling PGE drops those too
+static inline void __flush_tlb_global()
+{
+	__asm__ volatile("mov %%cr4, %%eax\n"
+					 "xor $0x80, %%eax\n"
+					 "mov %%eax, %%cr4\n"
+					 "xor $0x80, %%eax\n"
+					 "mov %%eax, %%cr4"
+					 :
+					 :
+					 : "%eax", "memory");
+}
+
 //this mutex must be locked when accessing/modfying kernel address space mappings
 static constinit sync::mutex kernel_addr_mutex{};
 static uintptr_t kernel_page_directory;
 
+#ifdef __PAE
+//cr3 points at a table of 4 page directories, each one covering 1 GiB
+typedef uint64_t pte_t;
+#define NUM_PAGE_DIRS 4
+#define PAGE_DIR_SHIFT 21
+#define PAGE_NO_EXECUTE (1ull << 63)
+#define PTE_ADDRESS_MASK 0x000FFFFFFFFFF000ull
+#else
+typedef uintptr_t pte_t;
+#define NUM_PAGE_DIRS 1
+#define PAGE_DIR_SHIFT 22
+#define PTE_ADDRESS_MASK PAGE_ADDRESS_MASK
+#endif
+
+//page tables it takes to cover the address space, their entries are in one array
+#define NUM_PAGE_TABLES ((size_t)1 << (32 - PAGE_DIR_SHIFT))
+
+//the pages an address space is made of, the pdpt comes first with PAE
+#ifdef __PAE
+#define SPACE_PAGES (1 + NUM_PAGE_DIRS)
+#else
+#define SPACE_PAGES NUM_PAGE_DIRS
+#endif
+
 #define PT_INDEX_MASK (PAGE_TABLE_SIZE - 1)
 #define PAGE_FLAGS_MASK (PAGE_SIZE - 1)
 #define PAGE_ADDRESS_MASK (~PAGE_FLAGS_MASK)
 
+//a page directory entry with PAGE_LARGE set maps 4 MiB directly instead of a page table
+#define LARGE_PAGE_SIZE ((uintptr_t)PAGE_SIZE * PAGE_TABLE_SIZE)
+#define LARGE_PAGE_ADDRESS_MASK (~(LARGE_PAGE_SIZE - 1))
+
+static bool large_pages_enabled = false;
+
+#ifdef __PAE
+//set if writable pages can be made not executable
+static bool no_execute_enabled = false;
+#endif
+
+//what other cpus have to enable before using these page tables
+static uint32_t cr4_bits  = 0;
+static uint32_t efer_bits = 0;
+
+//PAGE_GLOBAL if the cpu has global pages, added to everything mapped in the kernel half
+static page_flags_t kernel_page_flags = 0;
+
+//past this many pages flushing the whole tlb is cheaper than invlpg on each
+#define TLB_FLUSH_ALL_THRESHOLD 32
+
+static void (*tlb_shootdown)(uintptr_t address, size_t num_pages) = nullptr;
+
 #define MAXIMUM_ADDRESS (~(uintptr_t)0)
 
 #define KERNEL_SPLIT (MAXIMUM_ADDRESS - MAXIMUM_ADDRESS/8)
 
-uintptr_t* const last_pde_address = (uintptr_t*)((uintptr_t)(PAGE_TABLE_SIZE - 1) * (uintptr_t)PAGE_TABLE_SIZE * (uintptr_t)PAGE_SIZE);
-uintptr_t* const current_page_directory = (uintptr_t*)((uintptr_t)MAXIMUM_ADDRESS - (uintptr_t)~PAGE_ADDRESS_MASK);
+//the first page table is shared with the kernel (low memory identity mappings)
+#define USER_SPACE_BEGIN ((uintptr_t)PAGE_TABLE_SIZE * PAGE_SIZE)
+
+//the last entries of the page directories map the page directories themselves,
+//so all page tables show up here and the page directories at the very end
+pte_t* const last_pde_address = (pte_t*)((uintptr_t)(NUM_PAGE_TABLES - NUM_PAGE_DIRS) * LARGE_PAGE_SIZE);
+pte_t* const current_page_directory = (pte_t*)((uintptr_t)MAXIMUM_ADDRESS - (NUM_PAGE_DIRS * PAGE_SIZE - 1));
+
+#define GET_PAGE_TABLE_ADDRESS(pd_index) ((pte_t*)(last_pde_address + (PAGE_TABLE_SIZE * pd_index)))
+
+//frames zeroed ahead of time by a background thread, so first touch faults can skip it
+#define ZERO_POOL_SIZE 64
+//don't zero ahead once memory gets this low, leave it to real allocations
+#define ZERO_POOL_MIN_FREE RECLAIM_HIGH_WATERMARK
+
+//this is also taken from inside page faults, so it's guarded by turning interrupts off
+//rather than by the address space mutex
+static phys_addr_t zero_pool[ZERO_POOL_SIZE];
+static size_t zero_pool_count = 0;
 
-#define GET_PAGE_TABLE_ADDRESS(pd_index) ((uintptr_t*)(last_pde_address + (PAGE_TABLE_SIZE * pd_index)))
+//returns 0 if the pool is empty
+static phys_addr_t memmanager_take_zeroed_page()
+{
+	sync::interrupt_lock l{};
+	return zero_pool_count ? zero_pool[--zero_pool_count] : 0;
+}
 
-inline uintptr_t memmanager_allocate_physical_page()
+inline phys_addr_t memmanager_allocate_physical_page()
 {
-	return physical_memory_allocate(PAGE_SIZE, PAGE_SIZE);
+	if(phys_addr_t physical = physical_memory_allocate_page())
+		return physical;
+
+	//pooled frames are still free memory
+	return memmanager_take_zeroed_page();
 }
 
 inline constexpr size_t get_page_dir_index(uintptr_t virtual_address)
 {
-	return virtual_address >> 22;
+	return virtual_address >> PAGE_DIR_SHIFT;
 }
 
 inline constexpr size_t get_page_tbl_index(uintptr_t virtual_address)
@@ -57,432 +145,1897 @@ inline constexpr size_t get_page_tbl_index(uintptr_t virtual_address)
 	return (virtual_address >> 12) & PT_INDEX_MASK;
 }
 
-static uintptr_t& memmanager_get_pt_entry(uintptr_t virtual_address, size_t pd_index)
+static bool memmanager_has_page_table(size_t pd_index)
+{
+	return (current_page_directory[pd_index] & (PAGE_PRESENT | PAGE_LARGE)) == PAGE_PRESENT;
+}
+
+static pte_t& memmanager_get_pt_entry(uintptr_t virtual_address, size_t pd_index)
+{
+	pte_t* page_table = GET_PAGE_TABLE_ADDRESS(pd_index);
+
+	return page_table[get_page_tbl_index(virtual_address)];
+}
+
+static pte_t memmanager_get_pt_entry(uintptr_t virtual_address)
+{
+	size_t pd_index = get_page_dir_index(virtual_address);
+	pte_t pd_entry = current_page_directory[pd_index];
+
+	if(!(pd_entry & PAGE_PRESENT)) //page table is not present
+	{
+		return pd_entry;
+	}
+
+	if(pd_entry & PAGE_LARGE)
+	{
+		//what the entry would look like if this was mapped with a page table
+		return (pd_entry & PTE_ADDRESS_MASK & ~(pte_t)(LARGE_PAGE_SIZE - 1)) +
+			   (virtual_address & ~LARGE_PAGE_ADDRESS_MASK & PAGE_ADDRESS_MASK) +
+			   (pd_entry & PAGE_FLAGS_MASK & ~PAGE_LARGE);
+	}
+
+	return memmanager_get_pt_entry(virtual_address, pd_index);
+}
+
+phys_addr_t memmanager_get_physical(uintptr_t virtual_address)
+{
+	return (memmanager_get_pt_entry(virtual_address) & PTE_ADDRESS_MASK) +
+		(virtual_address & ~PAGE_ADDRESS_MASK);
+}
+
+//writable memory is never code, except in the low identity mapped area and the
+//kernel image, which is mapped without this
+static pte_t memmanager_make_entry(uintptr_t virtual_address, phys_addr_t physical_address,
+								   page_flags_t flags)
+{
+	pte_t entry = (physical_address & PTE_ADDRESS_MASK) | flags;
+#ifdef __PAE
+	if(no_execute_enabled && (flags & PAGE_RW) && virtual_address >= USER_SPACE_BEGIN)
+	{
+		entry |= PAGE_NO_EXECUTE;
+	}
+#else
+	(void)virtual_address;
+#endif
+	return entry;
+}
+
+static void memmanager_account_entry(uintptr_t virtual_address, pte_t old_entry, pte_t new_entry);
+
+void memmanager_update_pt(pte_t* pt_ptr, pte_t new_value, uintptr_t v_address)
+{
+	memmanager_account_entry(v_address, *pt_ptr, new_value);
+
+	__atomic_store(pt_ptr, &new_value, __ATOMIC_RELAXED);
+	__flush_tlb_page(v_address);
+}
+
+void memmanager_set_tlb_shootdown(void (*shootdown)(uintptr_t address, size_t num_pages))
+{
+	tlb_shootdown = shootdown;
+}
+
+void memmanager_get_paging_bits(uint32_t* cr4, uint32_t* efer)
+{
+	*cr4  = cr4_bits;
+	*efer = efer_bits;
+}
+
+//invalidate a run of page table entries that were changed without flushing
+static void memmanager_flush_tlb_range(uintptr_t virtual_address, size_t num_pages)
+{
+	if(num_pages == 0)
+		return;
+
+#ifndef __I386_ONLY
+	if(num_pages > TLB_FLUSH_ALL_THRESHOLD)
+	{
+		if(virtual_address + (num_pages - 1) * PAGE_SIZE >= KERNEL_SPLIT && kernel_page_flags)
+			__flush_tlb_global();
+		else
+			__flush_tlb();
+	}
+	else
+	{
+		for(size_t i = 0; i < num_pages; i++)
+		{
+			__flush_tlb_page(virtual_address + i * PAGE_SIZE);
+		}
+	}
+#else
+	__flush_tlb();
+#endif
+
+	if(tlb_shootdown)
+		tlb_shootdown(virtual_address, num_pages);
+}
+
+static void memmanager_create_new_page_table(size_t pd_index, page_flags_t flags)
+{
+	flags &= ~(PAGE_RESERVED | PAGE_MAP_ON_ACCESS);
+
+	current_page_directory[pd_index] = memmanager_allocate_physical_page() | PAGE_PRESENT | PAGE_RW | flags;
+
+	__flush_tlb();
+
+	//printf("added new page table, %X\n", current_page_directory[pd_index]);
+
+	pte_t* page_table = GET_PAGE_TABLE_ADDRESS(pd_index);
+
+	memset(page_table, 0, PAGE_SIZE);
+}
+
+//bookkeeping nodes for the address spaces, these can't come from the heap
+//since the heap itself allocates through the free range trees
+template<class T>
+class node_pool
+{
+public:
+	constexpr node_pool() = default;
+
+	T* allocate()
+	{
+		k_assert(m_free_list);
+
+		free_node* n = m_free_list;
+		m_free_list	 = n->next;
+		m_num_free--;
+		return reinterpret_cast<T*>(n);
+	}
+
+	void deallocate(T* n)
+	{
+		auto f		= reinterpret_cast<free_node*>(n);
+		f->next		= m_free_list;
+		m_free_list = f;
+		m_num_free++;
+	}
+
+	void add_nodes(T* nodes, size_t count)
+	{
+		for(size_t i = 0; i < count; i++)
+		{
+			deallocate(&nodes[i]);
+		}
+	}
+
+	size_t num_free() const
+	{
+		return m_num_free;
+	}
+
+private:
+	struct free_node
+	{
+		free_node* next;
+	};
+	static_assert(sizeof(T) >= sizeof(free_node));
+
+	free_node* m_free_list = nullptr;
+	size_t m_num_free = 0;
+};
+
+using range_node_pool = node_pool<range_node>;
+using free_range_tree = range_tree<range_node_pool>;
+
+static constinit range_node_pool range_nodes{};
+static constinit range_node initial_range_nodes[32]{};
+
+//part of an address space whose pages are read from a file on first access
+struct file_mapping
+{
+	uintptr_t start;
+	size_t num_pages;
+	uint64_t offset;
+	size_t file_bytes;
+
+	const page_source* source;
+	void* data;
+
+	file_mapping* next;
+};
+
+static constinit node_pool<file_mapping> mapping_nodes{};
+
+//virtual address ranges in the kernel half, these are shared by every address space
+static constinit free_range_tree kernel_ranges{range_nodes};
+
+struct memory_space
+{
+	constexpr memory_space() : user_ranges{range_nodes} {}
+
+	uintptr_t page_dir_phys = 0; //always below 4 GiB, since it goes in cr3
+	free_range_tree user_ranges;
+	file_mapping* mappings = nullptr;
+
+	//user pages that own a frame, frames shared with other spaces count in each of them
+	size_t resident_pages = 0;
+	//0 means no limit
+	size_t max_resident_pages = 0;
+	size_t max_virtual_pages  = 0;
+
+	//set once the space is destroyed, its page tables are freed from reap_index on
+	uintptr_t dead_pages = 0;
+	size_t reap_index	 = 0;
+
+	memory_space* next = nullptr;
+};
+
+static constinit memory_space kernel_space{};
+
+//destroyed spaces whose page tables haven't all been freed yet, linked through next
+static constinit memory_space* dead_spaces = nullptr;
+
+#define NUM_SPACE_BUCKETS 64
+static constinit memory_space* memory_spaces[NUM_SPACE_BUCKETS]{};
+
+static size_t memmanager_space_bucket(uintptr_t page_dir_phys)
+{
+	return (page_dir_phys / PAGE_SIZE) % NUM_SPACE_BUCKETS;
+}
+
+static void memmanager_register_space(memory_space* space)
+{
+	auto& bucket = memory_spaces[memmanager_space_bucket(space->page_dir_phys)];
+	space->next	 = bucket;
+	bucket		 = space;
+}
+
+static memory_space* memmanager_unregister_space(uintptr_t page_dir_phys)
+{
+	auto* it = &memory_spaces[memmanager_space_bucket(page_dir_phys)];
+	for(; *it != nullptr; it = &(*it)->next)
+	{
+		if((*it)->page_dir_phys == page_dir_phys)
+		{
+			auto space = *it;
+			*it		   = space->next;
+			return space;
+		}
+	}
+	return nullptr;
+}
+
+//null if nothing is registered for page_dir_phys, for page directories that come from a syscall
+static memory_space* memmanager_lookup_space(uintptr_t page_dir_phys)
+{
+	auto space = memory_spaces[memmanager_space_bucket(page_dir_phys)];
+	while(space && space->page_dir_phys != page_dir_phys)
+	{
+		space = space->next;
+	}
+
+	return space;
+}
+
+static memory_space* memmanager_find_space(uintptr_t page_dir_phys)
+{
+	auto space = memmanager_lookup_space(page_dir_phys);
+
+	k_assert(space);
+	return space;
+}
+
+static memory_space* memmanager_current_space()
+{
+	return memmanager_find_space((uintptr_t)get_page_directory());
+}
+
+static bool memmanager_owns_frame(pte_t entry)
+{
+	return (entry & PAGE_ALLOCATED) == PAGE_ALLOCATED;
+}
+
+//every change to a user page table entry goes through here, so the counts stay exact
+static void memmanager_account_entry(uintptr_t virtual_address, pte_t old_entry, pte_t new_entry)
+{
+	if(virtual_address < USER_SPACE_BEGIN || virtual_address >= KERNEL_SPLIT)
+		return;
+
+	const bool owned = memmanager_owns_frame(new_entry);
+	if(owned == memmanager_owns_frame(old_entry))
+		return;
+
+	if(auto space = memmanager_current_space())
+		sync::atomic_add(&space->resident_pages, owned ? (size_t)1 : ~(size_t)0);
+}
+
+static size_t memmanager_virtual_pages(const memory_space* space)
+{
+	return (KERNEL_SPLIT - USER_SPACE_BEGIN - space->user_ranges.bytes_free()) / PAGE_SIZE;
+}
+
+//whether the current address space may get num_pages more frames
+static bool memmanager_can_add_resident(size_t num_pages)
+{
+	auto space = memmanager_current_space();
+	if(!space || !space->max_resident_pages ||
+	   space->resident_pages + num_pages <= space->max_resident_pages)
+		return true;
+
+	printf("process is over its limit of %d resident pages\n", space->max_resident_pages);
+	return false;
+}
+
+//extra references to each physical frame, 0 means the frame has a single owner
+//the table is mapped on access so only the parts covering real memory get backed
+static uint16_t* frame_refs = nullptr;
+
+static uint16_t& memmanager_frame_refs(phys_addr_t physical_address)
+{
+	return frame_refs[(size_t)(physical_address / PAGE_SIZE)];
+}
+
+static void memmanager_get_frame(phys_addr_t physical_address)
+{
+	auto& refs = memmanager_frame_refs(physical_address);
+	k_assert(refs != (uint16_t)~0u);
+	refs++;
+}
+
+//drop a reference to a frame and free it if that was the last one
+static void memmanager_put_frame(phys_addr_t physical_address)
+{
+	auto& refs = memmanager_frame_refs(physical_address);
+	if(refs == 0)
+	{
+		physical_memory_free(physical_address & PTE_ADDRESS_MASK, PAGE_SIZE);
+	}
+	else
+	{
+		refs--;
+	}
+}
+
+static bool memmanager_map_page(uintptr_t virtual_address, phys_addr_t physical_address, page_flags_t flags);
+
+#ifndef __I386_ONLY
+//mapped copy on write in place of user pages that have only been read so far
+//not used on the 386, its kernel would write straight through it
+static phys_addr_t zero_page = 0;
+#endif
+
+static void* memmanager_alloc_node_page()
+{
+	uintptr_t virtual_address = kernel_ranges.allocate(PAGE_SIZE);
+	phys_addr_t physical_address = memmanager_allocate_physical_page();
+
+	k_assert(virtual_address && physical_address);
+
+	memmanager_map_page(virtual_address, physical_address, PAGE_PRESENT | PAGE_RW);
+
+	return (void*)virtual_address;
+}
+
+//a tree operation can consume at most 2 nodes, and refilling consumes 1 itself
+static void memmanager_reserve_range_nodes()
+{
+	if(range_nodes.num_free() >= 4)
+		return;
+
+	range_nodes.add_nodes((range_node*)memmanager_alloc_node_page(),
+						  PAGE_SIZE / sizeof(range_node));
+}
+
+static file_mapping* memmanager_new_mapping_node()
+{
+	memmanager_reserve_range_nodes();
+
+	if(mapping_nodes.num_free() == 0)
+	{
+		mapping_nodes.add_nodes((file_mapping*)memmanager_alloc_node_page(),
+								PAGE_SIZE / sizeof(file_mapping));
+	}
+
+	return mapping_nodes.allocate();
+}
+
+static free_range_tree* memmanager_get_ranges(uintptr_t virtual_address)
+{
+	if(virtual_address >= KERNEL_SPLIT)
+	{
+		return (virtual_address < (uintptr_t)last_pde_address) ? &kernel_ranges : nullptr;
+	}
+	return (virtual_address >= USER_SPACE_BEGIN) ? &memmanager_current_space()->user_ranges : nullptr;
+}
+
+static void memmanager_release_range(uintptr_t virtual_address, size_t num_pages)
+{
+	if(auto ranges = memmanager_get_ranges(virtual_address))
+	{
+		memmanager_reserve_range_nodes();
+		ranges->release(virtual_address, num_pages * PAGE_SIZE);
+	}
+}
+
+static void memmanager_reserve_range(uintptr_t virtual_address, size_t num_pages)
+{
+	if(auto ranges = memmanager_get_ranges(virtual_address))
+	{
+		memmanager_reserve_range_nodes();
+		ranges->reserve(virtual_address, num_pages * PAGE_SIZE);
+	}
+}
+
+static uintptr_t memmanager_get_unmapped_pages(const size_t num_pages, page_flags_t flags)
+{
+	memmanager_reserve_range_nodes();
+
+	auto& ranges = (flags & PAGE_USER) ? memmanager_current_space()->user_ranges : kernel_ranges;
+
+	if(uintptr_t address = ranges.allocate(num_pages * PAGE_SIZE))
+	{
+		return address;
+	}
+
+	printf("couldn't find page, num_pages = %d, flags = %X\n", num_pages, flags);
+	k_assert(false);
+
+	return (uintptr_t)nullptr;
+}
+
+//the tlb entry is left for the caller to flush, returns whether anything was unmapped
+static bool memmanager_clear_page_locked(uintptr_t virtual_address, page_flags_t flags)
+{
+	size_t pd_index = get_page_dir_index(virtual_address);
+	pte_t pd_entry = current_page_directory[pd_index];
+
+	if(pd_entry & PAGE_LARGE)
+	{
+		printf("can't unmap %X, it's part of a large page\n", virtual_address);
+	}
+	else if(pd_entry & PAGE_PRESENT)
+	{
+		auto& pt_entry = memmanager_get_pt_entry(virtual_address, pd_index);
+		if(pt_entry & flags)
+		{
+			memmanager_account_entry(virtual_address, pt_entry, 0);
+
+			//unmap the page
+			__atomic_store_n(&pt_entry, 0, __ATOMIC_RELAXED);
+			memmanager_release_range(virtual_address, 1);
+			return true;
+		}
+	}
+	else
+	{
+		printf("warning pdir not exists for %X!\n", virtual_address);
+		k_assert(false);
+	}
+	return false;
+}
+
+static void memmanager_unmap_page_locked(uintptr_t virtual_address, page_flags_t flags)
+{
+	if(memmanager_clear_page_locked(virtual_address, flags))
+	{
+		__flush_tlb_page(virtual_address);
+	}
+}
+
+static bool memmanager_map_page(uintptr_t virtual_address, phys_addr_t physical_address, page_flags_t flags)
+{
+	size_t pd_index = get_page_dir_index(virtual_address);
+	pte_t pd_entry = current_page_directory[pd_index];
+
+	if(!(pd_entry & PAGE_PRESENT)) //page table is not present
+	{
+		memmanager_create_new_page_table(pd_index, flags);
+	}
+	else if((flags & PAGE_USER) && !(pd_entry & PAGE_USER))
+	{
+		printf("Page at %X does not match requested flags %X\n", virtual_address, (uintptr_t)(pd_entry & PAGE_FLAGS_MASK));
+		return false;
+	}
+	else if(pd_entry & PAGE_LARGE)
+	{
+		printf("warning large page already exists at %X!\n", virtual_address);
+		return false;
+	}
+
+	pte_t& pt_entry = memmanager_get_pt_entry(virtual_address, pd_index);
+
+	if(pt_entry & PAGE_ALLOCATED)
+	{
+		printf("warning page already exists at %X!\n", virtual_address);
+		return false;
+	}
+
+	if(virtual_address >= KERNEL_SPLIT)
+	{
+		flags |= kernel_page_flags;
+	}
+
+	memmanager_update_pt(&pt_entry,
+						 memmanager_make_entry(virtual_address, physical_address, flags),
+						 virtual_address);
+
+	return true;
+}
+
+//map a frame into the kernel half for a short while, kernel_addr_mutex must be held
+static pte_t* memmanager_map_temporary(phys_addr_t physical_address)
+{
+	uintptr_t virtual_address = memmanager_get_unmapped_pages(1, PAGE_RW);
+
+	auto r = memmanager_map_page(virtual_address, physical_address, PAGE_PRESENT | PAGE_RW);
+	k_assert(r);
+
+	return (pte_t*)virtual_address;
+}
+
+static void memmanager_copy_to_frame(phys_addr_t physical_address, const void* src)
+{
+	auto dst = memmanager_map_temporary(physical_address);
+	memcpy(dst, src, PAGE_SIZE);
+	memmanager_unmap_page_locked((uintptr_t)dst, PAGE_PRESENT);
+}
+
+bool memmanager_map_shared_frame(void* v_address, phys_addr_t physical_address, page_flags_t flags)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+
+	uintptr_t virtual_address = (uintptr_t)v_address;
+
+	size_t pd_index = get_page_dir_index(virtual_address);
+
+	if(!memmanager_has_page_table(pd_index))
+	{
+		printf("address %X was not allocated\n", virtual_address);
+		return false;
+	}
+
+	pte_t& pt_entry = memmanager_get_pt_entry(virtual_address, pd_index);
+
+	//only replace a page that is allocated but hasn't been touched yet
+	if((pt_entry & PAGE_ALLOCATED) != PAGE_RESERVED)
+	{
+		return false;
+	}
+
+	//it already has as many sharers as the count holds
+	if(memmanager_frame_refs(physical_address) == (uint16_t)~0u)
+	{
+		return false;
+	}
+
+	memmanager_get_frame(physical_address);
+
+	flags &= PAGE_FLAGS_MASK & ~(PAGE_MAP_ON_ACCESS | PAGE_COPY_ON_WRITE);
+
+	memmanager_update_pt(&pt_entry,
+						 memmanager_make_entry(virtual_address, physical_address, flags | PAGE_ALLOCATED),
+						 virtual_address);
+	return true;
+}
+
+void memmanager_release_frame(phys_addr_t physical_address)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+	memmanager_put_frame(physical_address);
+}
+
+bool memmanager_release_unused_frame(phys_addr_t physical_address)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+
+	if(memmanager_frame_refs(physical_address) != 0)
+		return false;
+
+	physical_memory_free(physical_address, PAGE_SIZE);
+	return true;
+}
+
+//drops cached data to make room if memory ran out, the caches give their frames back
+//through kernel_addr_mutex, so this can't be used while it's held
+static phys_addr_t memmanager_allocate_physical_page_reclaiming()
+{
+	if(phys_addr_t physical = memmanager_allocate_physical_page())
+		return physical;
+
+	//the fault may have come from code that holds it
+	if(!kernel_addr_mutex.try_lock())
+		return 0;
+	kernel_addr_mutex.unlock();
+
+	page_reclaim_run(RECLAIM_HIGH_WATERMARK);
+
+	phys_addr_t physical = memmanager_allocate_physical_page();
+	if(!physical)
+		page_reclaim_out_of_memory();
+
+	return physical;
+}
+
+bool memmanager_map_file(void* virtual_address, size_t num_pages, const page_source* source,
+						 void* data, uint64_t offset, size_t file_bytes)
+{
+	if((uintptr_t)virtual_address & PAGE_FLAGS_MASK ||
+	   (uintptr_t)virtual_address < USER_SPACE_BEGIN ||
+	   (uintptr_t)virtual_address >= KERNEL_SPLIT)
+	{
+		printf("can't map file at %X\n", (uintptr_t)virtual_address);
+		return false;
+	}
+
+	sync::lock_guard l{kernel_addr_mutex};
+
+	auto space = memmanager_current_space();
+
+	auto mapping = memmanager_new_mapping_node();
+	*mapping	 = file_mapping{
+		.start		= (uintptr_t)virtual_address,
+		.num_pages	= num_pages,
+		.offset		= offset,
+		.file_bytes = file_bytes,
+		.source		= source,
+		.data		= data,
+		.next		= space->mappings,
+	};
+	space->mappings = mapping;
+
+	return true;
+}
+
+//copies the mapping covering virtual_address and retains its data
+static bool memmanager_find_file_mapping(uintptr_t virtual_address, file_mapping* result)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+
+	for(auto m = memmanager_current_space()->mappings; m != nullptr; m = m->next)
+	{
+		if(virtual_address >= m->start &&
+		   virtual_address - m->start < m->num_pages * PAGE_SIZE)
+		{
+			*result = *m;
+			m->source->retain(m->data);
+			return true;
+		}
+	}
+	return false;
+}
+
+//worth it when the range covers at least one whole, aligned large page
+static bool memmanager_should_map_large(phys_addr_t physical_address, size_t n)
+{
+	if(!large_pages_enabled)
+		return false;
+
+	const uint64_t first_large = ((uint64_t)physical_address + (LARGE_PAGE_SIZE - 1)) &
+								 ~(uint64_t)(LARGE_PAGE_SIZE - 1);
+
+	return first_large + LARGE_PAGE_SIZE <= (uint64_t)physical_address + (uint64_t)n * PAGE_SIZE;
+}
+
+//maps a physically contiguous range using large pages wherever it's aligned
+static void* memmanager_map_large(phys_addr_t physical_address, size_t n, page_flags_t flags)
+{
+	auto& ranges = (flags & PAGE_USER) ? memmanager_current_space()->user_ranges : kernel_ranges;
+
+	//the virtual address has to be at the same offset into a large page as the physical one
+	const size_t head = (size_t)(physical_address & (LARGE_PAGE_SIZE - 1));
+
+	memmanager_reserve_range_nodes();
+	uintptr_t base = ranges.allocate(head + n * PAGE_SIZE, LARGE_PAGE_SIZE);
+	if(!base)
+		return nullptr;
+
+	if(head)
+	{
+		memmanager_reserve_range_nodes();
+		ranges.release(base, head);
+	}
+
+	const uintptr_t virtual_address = base + head;
+
+	for(size_t i = 0; i < n;)
+	{
+		const uintptr_t v_address	= virtual_address + i * PAGE_SIZE;
+		const phys_addr_t p_address = physical_address + i * PAGE_SIZE;
+		const size_t pd_index		= get_page_dir_index(v_address);
+
+		//a page table left behind by earlier mappings can't be replaced, other spaces may share it
+		if(!(v_address & ~LARGE_PAGE_ADDRESS_MASK) && n - i >= PAGE_TABLE_SIZE &&
+		   !(current_page_directory[pd_index] & PAGE_PRESENT))
+		{
+			current_page_directory[pd_index] = memmanager_make_entry(
+				v_address, p_address, (flags & ~(PAGE_RESERVED | PAGE_MAP_ON_ACCESS)) | PAGE_LARGE);
+			__flush_tlb_page(v_address);
+
+			i += PAGE_TABLE_SIZE;
+			continue;
+		}
+
+		if(!memmanager_map_page(v_address, p_address, flags))
+			return nullptr;
+		i++;
+	}
+
+	return (void*)virtual_address;
+}
+
+void* memmanager_map_to_new_pages(phys_addr_t physical_address, size_t n, page_flags_t flags)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+
+	if(memmanager_should_map_large(physical_address, n))
+	{
+		if(void* address = memmanager_map_large(physical_address, n, flags))
+			return address;
+	}
+
+	uintptr_t virtual_address = memmanager_get_unmapped_pages(n, flags);
+
+	for(size_t i = 0; i < n; i++)
+	{
+		if(!memmanager_map_page(virtual_address + i * PAGE_SIZE, physical_address + i * PAGE_SIZE, flags))
+			return NULL;
+	}
+
+	return (void*)virtual_address;
+}
+
+uintptr_t memmanager_get_page_flags(uintptr_t virtual_address)
+{
+	return (uintptr_t)(memmanager_get_pt_entry(virtual_address) & PAGE_FLAGS_MASK);
+}
+
+void memmanager_set_page_flags(void* virtual_address, size_t num_pages, page_flags_t flags)
+{
+	//copy on write stays through a change that takes write access away, or adding it back
+	//later would make a frame that's still shared writable
+	uintptr_t preserved = PAGE_PRESENT | PAGE_RESERVED | PAGE_MAP_ON_ACCESS | PAGE_DIRTY |
+						  PAGE_GLOBAL | PAGE_COPY_ON_WRITE;
+
+	for(size_t i = 0; i < num_pages; i++)
+	{
+		const uintptr_t v_address = (uintptr_t)virtual_address + i * PAGE_SIZE;
+
+		const size_t pd_index = get_page_dir_index(v_address);
+		const pte_t pd_entry  = current_page_directory[pd_index];
+
+		if(!(pd_entry & PAGE_PRESENT)) //page table is not present
+		{
+			puts("page table not present, while attempting to set flags");
+			memmanager_flush_tlb_range((uintptr_t)virtual_address, i);
+			return;
+		}
+
+		if(pd_entry & PAGE_LARGE)
+		{
+			puts("can't set flags on part of a large page");
+			memmanager_flush_tlb_range((uintptr_t)virtual_address, i);
+			return;
+		}
+
+		pte_t& page_entry = memmanager_get_pt_entry(v_address, pd_index);
+
+		page_flags_t new_flags = (page_flags_t)(page_entry & preserved) | flags;
+
+		//a shared frame, like the zero page, only becomes writable once it's copied
+		if((page_entry & PAGE_COPY_ON_WRITE) && (new_flags & PAGE_RW))
+			new_flags = (new_flags & ~PAGE_RW) | PAGE_COPY_ON_WRITE;
+
+		const pte_t new_entry =
+			memmanager_make_entry(v_address, page_entry & PTE_ADDRESS_MASK, new_flags);
+		memmanager_account_entry(v_address, page_entry, new_entry);
+
+		__atomic_store_n(&page_entry, new_entry, __ATOMIC_RELAXED);
+	}
+
+	memmanager_flush_tlb_range((uintptr_t)virtual_address, num_pages);
+}
+
+//whether n pages at virtual_address can be given out with flags, kernel_addr_mutex must be held
+static bool memmanager_range_free(uintptr_t virtual_address, size_t n, page_flags_t flags)
+{
+	const uintptr_t last = (flags & PAGE_USER) ? KERNEL_SPLIT - 1 : MAXIMUM_ADDRESS;
+	if((flags & PAGE_USER) && virtual_address < USER_SPACE_BEGIN)
+		return false;
+
+	if(virtual_address > last || (n && n - 1 > (last - virtual_address) / PAGE_SIZE))
+		return false;
+
+	for(size_t i = 0; i < n; i++)
+	{
+		const uintptr_t page = virtual_address + i * PAGE_SIZE;
+		const pte_t pd_entry = current_page_directory[get_page_dir_index(page)];
+
+		if(pd_entry & PAGE_LARGE)
+			return false;
+
+		if((pd_entry & PAGE_PRESENT) && (memmanager_get_pt_entry(page) & PAGE_ALLOCATED))
+			return false;
+	}
+
+	return true;
+}
+
+//takes back a virtual_alloc that failed after mapping the first num_mapped of its n pages
+static void memmanager_undo_alloc_locked(uintptr_t virtual_address, size_t num_mapped, size_t n)
+{
+	for(size_t i = 0; i < num_mapped; i++)
+	{
+		const uintptr_t page = virtual_address + i * PAGE_SIZE;
+		const pte_t entry	 = memmanager_get_pt_entry(page);
+
+		memmanager_unmap_page_locked(page, PAGE_ALLOCATED);
+
+		if(entry & PAGE_PRESENT)
+			memmanager_put_frame(entry & PTE_ADDRESS_MASK);
+	}
+
+	//the pages that were never mapped are still reserved
+	memmanager_release_range(virtual_address + num_mapped * PAGE_SIZE, n - num_mapped);
+}
+
+void* memmanager_virtual_alloc(void* v_address, size_t n, page_flags_t flags)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+
+	uintptr_t illegal = PAGE_RESERVED | PAGE_MAP_ON_ACCESS | PAGE_COPY_ON_WRITE;
+
+	flags &= (PAGE_FLAGS_MASK & ~illegal);
+
+	if(flags & PAGE_USER)
+	{
+		auto space = memmanager_current_space();
+		if(space->max_virtual_pages &&
+		   memmanager_virtual_pages(space) + n > space->max_virtual_pages)
+		{
+			printf("process is over its limit of %d virtual pages\n", space->max_virtual_pages);
+			return nullptr;
+		}
+
+		if((flags & PAGE_PRESENT) && !memmanager_can_add_resident(n))
+			return nullptr;
+	}
+
+	uintptr_t virtual_address = (uintptr_t)v_address;
+
+	if(virtual_address == (uintptr_t)nullptr)
+	{
+		virtual_address = memmanager_get_unmapped_pages(n, flags);
+
+		//if its still null then there were not enough contiguous unmapped pages
+		if(virtual_address == (uintptr_t)nullptr)
+		{
+			printf("failure to get %d unmapped pages\n", n);
+			return nullptr;
+		}
+	}
+	else if((uintptr_t)virtual_address & PAGE_FLAGS_MASK)
+	{
+		printf("unaligned address %X\n", virtual_address);
+		return nullptr;
+	}
+	else if(!memmanager_range_free(virtual_address, n, flags))
+	{
+		printf("can't allocate %d pages at %X\n", n, virtual_address);
+		return nullptr;
+	}
+	else
+	{
+		memmanager_reserve_range(virtual_address, n);
+	}
+
+	uintptr_t page_virtual_address = (uintptr_t)virtual_address;
+
+	for(size_t i = 0; i < n; i++)
+	{
+		bool mapped;
+		if(flags & PAGE_PRESENT)
+		{
+			//PAGE_RESERVED stays set on present pages that own their frame
+			phys_addr_t physical = memmanager_allocate_physical_page();
+			mapped = physical && memmanager_map_page(page_virtual_address, physical,
+													 flags | PAGE_PRESENT | PAGE_RESERVED);
+
+			if(physical && !mapped)
+				physical_memory_free(physical, PAGE_SIZE);
+		}
+		else
+		{
+			mapped = memmanager_map_page(page_virtual_address, 0,
+										 flags | PAGE_RESERVED | PAGE_MAP_ON_ACCESS);
+		}
+
+		if(!mapped)
+		{
+			printf("failure to map page %X\n", page_virtual_address);
+			memmanager_undo_alloc_locked(virtual_address, i, n);
+			return nullptr;
+		}
+
+		page_virtual_address += PAGE_SIZE;
+	}
+
+	return (void*)virtual_address;
+}
+
+SYSCALL_HANDLER void* syscall_virtual_alloc(void* v_address, size_t n, page_flags_t flags)
+{
+	return memmanager_virtual_alloc(v_address, n, flags);
+}
+
+static int memmanager_unmap_pages_with_flags(void* addr, size_t num_pages, page_flags_t flags)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+
+	uintptr_t v_addr = (uintptr_t)addr;
+
+	//pages are unmapped in runs that get flushed together
+	uintptr_t run_start = v_addr;
+	size_t run_pages	= 0;
+
+	while(num_pages)
+	{
+		const size_t pd_index = get_page_dir_index(v_addr);
+
+		if((current_page_directory[pd_index] & PAGE_LARGE) &&
+		   !(v_addr & ~LARGE_PAGE_ADDRESS_MASK) && num_pages >= PAGE_TABLE_SIZE)
+		{
+			memmanager_flush_tlb_range(run_start, run_pages);
+
+			if(current_page_directory[pd_index] & flags)
+			{
+				current_page_directory[pd_index] = 0;
+				memmanager_flush_tlb_range(v_addr, 1);
+				memmanager_release_range(v_addr, PAGE_TABLE_SIZE);
+			}
+
+			v_addr += LARGE_PAGE_SIZE;
+			num_pages -= PAGE_TABLE_SIZE;
+
+			run_start = v_addr;
+			run_pages = 0;
+			continue;
+		}
+
+		memmanager_clear_page_locked(v_addr, flags); //unmap the page
+		v_addr += PAGE_SIZE; //next page
+		num_pages--;
+		run_pages++;
+	}
+
+	memmanager_flush_tlb_range(run_start, run_pages);
+	return 0;
+}
+
+SYSCALL_HANDLER int syscall_unmap_user_pages(void* addr, size_t num_pages)
+{
+	return memmanager_unmap_pages_with_flags(addr, num_pages, PAGE_USER);
+}
+
+int memmanager_unmap_pages(void* addr, size_t num_pages)
+{
+	return memmanager_unmap_pages_with_flags(addr, num_pages, PAGE_ALLOCATED);
+}
+
+#define TLB_BATCH_PAGES 16
+
+int memmanager_free_pages_with_flags(void* page, size_t num_pages, page_flags_t flags)
+{
+	uintptr_t virtual_address = (uintptr_t)page;
+
+	sync::lock_guard l{kernel_addr_mutex};
+
+	//frames are only freed after the tlb can't reach them anymore
+	phys_addr_t frames[TLB_BATCH_PAGES];
+	int result = 0;
+
+	while(num_pages && result == 0)
+	{
+		const uintptr_t batch_start = virtual_address;
+		size_t batch_pages = 0;
+		size_t num_frames  = 0;
+
+		while(num_pages && batch_pages < TLB_BATCH_PAGES)
+		{
+			pte_t physical_address = memmanager_get_pt_entry(virtual_address);
+
+			memmanager_clear_page_locked(virtual_address, flags); //unmap the page
+
+			virtual_address += PAGE_SIZE; //next page
+			batch_pages++;
+			num_pages--;
+
+			if(!(physical_address & PAGE_ALLOCATED))
+			{
+				result = -1; //the page was not allocated
+				break;
+			}
+
+			if(physical_address & PAGE_PRESENT)
+			{
+				frames[num_frames++] = physical_address & PTE_ADDRESS_MASK;
+			}
+		}
+
+		memmanager_flush_tlb_range(batch_start, batch_pages);
+
+		for(size_t i = 0; i < num_frames; i++)
+		{
+			memmanager_put_frame(frames[i]);
+		}
+	}
+
+	return result;
+}
+
+int memmanager_free_pages(void* page, size_t num_pages)
+{
+	return memmanager_free_pages_with_flags(page, num_pages, PAGE_ALLOCATED);
+}
+
+//clears the dirty bit, returns whether it was set
+static bool memmanager_clean_page(uintptr_t virtual_address)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+
+	size_t pd_index = get_page_dir_index(virtual_address);
+
+	if(!memmanager_has_page_table(pd_index))
+		return false;
+
+	pte_t& pt_entry = memmanager_get_pt_entry(virtual_address, pd_index);
+
+	if((pt_entry & (PAGE_PRESENT | PAGE_DIRTY)) != (PAGE_PRESENT | PAGE_DIRTY))
+		return false;
+
+	memmanager_update_pt(&pt_entry, pt_entry & ~PAGE_DIRTY, virtual_address);
+	return true;
+}
+
+void memmanager_sync_file_pages(void* v_address, size_t num_pages)
+{
+	const uintptr_t start = (uintptr_t)v_address & PAGE_ADDRESS_MASK;
+
+	for(size_t i = 0; i < num_pages; i++)
+	{
+		const uintptr_t virtual_address = start + i * PAGE_SIZE;
+
+		file_mapping m;
+		if(!memmanager_find_file_mapping(virtual_address, &m))
+			continue;
+
+		//the page is cleaned first, so writes made while it's being written are kept
+		const size_t page_offset = virtual_address - m.start;
+		if(m.source->write && page_offset < m.file_bytes &&
+		   memmanager_clean_page(virtual_address))
+		{
+			size_t len = m.file_bytes - page_offset;
+			if(len > PAGE_SIZE) len = PAGE_SIZE;
+
+			m.source->write(m.data, m.offset + page_offset, (const void*)virtual_address, len);
+		}
+
+		m.source->release(m.data);
+	}
+}
+
+SYSCALL_HANDLER int syscall_sync_file_pages(void* virtual_address, size_t num_pages)
+{
+	if((uintptr_t)virtual_address < USER_SPACE_BEGIN ||
+	   (uintptr_t)virtual_address >= KERNEL_SPLIT ||
+	   num_pages > (KERNEL_SPLIT - (uintptr_t)virtual_address) / PAGE_SIZE)
+	{
+		return -1;
+	}
+
+	memmanager_sync_file_pages(virtual_address, num_pages);
+	return 0;
+}
+
+//releasing may close files, so the list has to be detached before calling this
+static void memmanager_free_mappings(file_mapping* list)
+{
+	for(auto m = list; m != nullptr; m = m->next)
+	{
+		m->source->release(m->data);
+	}
+
+	sync::lock_guard l{kernel_addr_mutex};
+
+	while(list)
+	{
+		auto next = list->next;
+		mapping_nodes.deallocate(list);
+		list = next;
+	}
+}
+
+//forget the file backing of [start, start + num_pages), so the range can be reused
+static void memmanager_drop_file_mappings(uintptr_t start, size_t num_pages)
+{
+	const uintptr_t end = start + num_pages * PAGE_SIZE;
+	file_mapping* dropped = nullptr;
+	{
+		sync::lock_guard l{kernel_addr_mutex};
+
+		file_mapping** link = &memmanager_current_space()->mappings;
+		while(file_mapping* m = *link)
+		{
+			const uintptr_t m_end = m->start + m->num_pages * PAGE_SIZE;
+
+			if(m_end <= start || m->start >= end)
+			{
+				link = &m->next;
+				continue;
+			}
+
+			if(m->start < start && m_end > end)
+			{
+				//split around the hole, both halves hold a reference
+				auto tail		 = memmanager_new_mapping_node();
+				*tail			 = *m;
+				size_t skipped	 = end - m->start;
+				tail->start		 = end;
+				tail->num_pages	 = (m_end - end) / PAGE_SIZE;
+				tail->offset	+= skipped;
+				tail->file_bytes = (m->file_bytes > skipped) ? m->file_bytes - skipped : 0;
+				m->source->retain(m->data);
+
+				m->num_pages = (start - m->start) / PAGE_SIZE;
+				m->next		 = tail;
+				link		 = &tail->next;
+			}
+			else if(m->start < start)
+			{
+				m->num_pages = (start - m->start) / PAGE_SIZE;
+				link		 = &m->next;
+			}
+			else if(m_end > end)
+			{
+				size_t skipped = end - m->start;
+				m->start	   = end;
+				m->num_pages   = (m_end - end) / PAGE_SIZE;
+				m->offset	  += skipped;
+				m->file_bytes  = (m->file_bytes > skipped) ? m->file_bytes - skipped : 0;
+				link		   = &m->next;
+			}
+			else
+			{
+				*link	= m->next;
+				m->next = dropped;
+				dropped = m;
+			}
+		}
+	}
+
+	memmanager_free_mappings(dropped);
+}
+
+SYSCALL_HANDLER int syscall_free_pages(void* page, size_t num_pages)
+{
+	if(!page) 
+		return -1;
+
+	const bool user_range = (uintptr_t)page >= USER_SPACE_BEGIN && (uintptr_t)page < KERNEL_SPLIT;
+
+	//mapped files get their changes before the pages go away
+	if(user_range)
+	{
+		memmanager_sync_file_pages(page, num_pages);
+	}
+
+	int ret = memmanager_free_pages_with_flags(page, num_pages, PAGE_USER);
+
+	if(user_range)
+	{
+		memmanager_drop_file_mappings((uintptr_t)page & PAGE_ADDRESS_MASK, num_pages);
+	}
+
+	return ret;
+}
+
+//the page directories of an address space, as one array of NUM_PAGE_TABLES entries
+static pte_t* memmanager_space_dirs(uintptr_t space_pages)
+{
+	return (pte_t*)(space_pages + (SPACE_PAGES - NUM_PAGE_DIRS) * PAGE_SIZE);
+}
+
+void memmanager_init_page_dir(uintptr_t space_pages, const phys_addr_t* dirs_phys)
+{
+	pte_t* page_dir = memmanager_space_dirs(space_pages);
+
+	//Mark pages not present
+	memset(page_dir, 0, NUM_PAGE_DIRS * PAGE_SIZE);
+
+#ifdef __PAE
+	//these entries can only have the present bit set
+	auto pdpt = (pte_t*)space_pages;
+	memset(pdpt, 0, PAGE_SIZE);
+
+	for(size_t i = 0; i < NUM_PAGE_DIRS; i++)
+	{
+		pdpt[i] = dirs_phys[i] | PAGE_PRESENT;
+	}
+#endif
+
+	//the last entries in the page dir are mapped to the page dirs
+	for(size_t i = 0; i < NUM_PAGE_DIRS; i++)
+	{
+		page_dir[NUM_PAGE_TABLES - NUM_PAGE_DIRS + i] = dirs_phys[i] | PAGE_PRESENT | PAGE_RW;
+	}
+}
+
+//maps the pages for a new address space, the first one is what goes in cr3
+static uintptr_t memmanager_alloc_space_pages()
+{
+	//cr3 only holds 32 bits
+	uintptr_t root = physical_memory_allocate(PAGE_SIZE, PAGE_SIZE);
+	if(!root)
+		return (uintptr_t)NULL;
+
+	sync::lock_guard l{kernel_addr_mutex};
+
+	uintptr_t virtual_address = memmanager_get_unmapped_pages(SPACE_PAGES, PAGE_RW);
+
+	auto r = memmanager_map_page(virtual_address, root, PAGE_PRESENT | PAGE_RW);
+	k_assert(r);
+
+	for(size_t i = 1; i < SPACE_PAGES; i++)
+	{
+		phys_addr_t physical_address = memmanager_allocate_physical_page();
+		k_assert(physical_address);
+
+		r = memmanager_map_page(virtual_address + i * PAGE_SIZE, physical_address,
+								PAGE_PRESENT | PAGE_RW);
+		k_assert(r);
+	}
+
+	return virtual_address;
+}
+
+uintptr_t memmanager_new_memory_space()
+{
+	//allocate this before taking the lock, the heap allocates pages too
+	auto space = new memory_space{};
+
+	uintptr_t space_pages = memmanager_alloc_space_pages();
+
+	if(space_pages == (uintptr_t)NULL)
+	{
+		delete space;
+		return (uintptr_t)NULL; //not enough free physical memory 
+	}
+
+	space->page_dir_phys = (uintptr_t)memmanager_get_physical(space_pages);
+
+	phys_addr_t dirs_phys[NUM_PAGE_DIRS];
+	for(size_t i = 0; i < NUM_PAGE_DIRS; i++)
+	{
+		dirs_phys[i] = memmanager_get_physical((uintptr_t)memmanager_space_dirs(space_pages) + i * PAGE_SIZE);
+	}
+
+	memmanager_init_page_dir(space_pages, dirs_phys);
+
+	pte_t* process_page_dir = memmanager_space_dirs(space_pages);
+
+	for(size_t i = 0; i < NUM_PAGE_TABLES - NUM_PAGE_DIRS; i++)
+	{
+		//copy only the kernel page directories
+		if(!(current_page_directory[i] & PAGE_USER))
+		{
+			process_page_dir[i] = current_page_directory[i];
+		}
+	}
+
+	{
+		sync::lock_guard l{kernel_addr_mutex};
+
+		memmanager_reserve_range_nodes();
+		space->user_ranges.release(USER_SPACE_BEGIN, KERNEL_SPLIT - USER_SPACE_BEGIN);
+
+		memmanager_register_space(space);
+	}
+
+	return space_pages;
+}
+
+//give dst_dir a copy of every user page table in the current space
+//pages this space owns are shared copy on write, kernel_addr_mutex must be held
+static bool memmanager_clone_user_tables(pte_t* dst_dir)
+{
+	for(size_t pd_index = get_page_dir_index(USER_SPACE_BEGIN);
+		pd_index < get_page_dir_index(KERNEL_SPLIT); pd_index++)
+	{
+		const pte_t pd_entry = current_page_directory[pd_index];
+
+		if(!(pd_entry & PAGE_PRESENT) || !(pd_entry & PAGE_USER))
+			continue;
+
+		//large pages only map memory the space doesn't own
+		if(pd_entry & PAGE_LARGE)
+		{
+			dst_dir[pd_index] = pd_entry;
+			continue;
+		}
+
+		phys_addr_t dst_table_phys = memmanager_allocate_physical_page();
+		if(!dst_table_phys)
+			return false;
+
+		pte_t* src_table = GET_PAGE_TABLE_ADDRESS(pd_index);
+		pte_t* dst_table = memmanager_map_temporary(dst_table_phys);
+
+		memset(dst_table, 0, PAGE_SIZE);
+
+		bool success = true;
+		for(size_t pt_index = 0; pt_index < PAGE_TABLE_SIZE; pt_index++)
+		{
+			pte_t& entry = src_table[pt_index];
+
+			//unmapped, mapped on access, or memory owned by someone else (shared buffers, vram)
+			if((entry & PAGE_ALLOCATED) != PAGE_ALLOCATED)
+			{
+				dst_table[pt_index] = entry;
+				continue;
+			}
+
+			const bool writable = entry & (PAGE_RW | PAGE_COPY_ON_WRITE);
+
+#ifdef __I386_ONLY
+			//the 386 ignores read only pages in ring 0, so kernel writes
+			//would go straight through a shared frame, copy it now instead
+			const bool copy_now = writable;
+#else
+			//a frame with as many sharers as its count holds, like the zero page, can't take another
+			const bool copy_now = memmanager_frame_refs(entry & PTE_ADDRESS_MASK) == (uint16_t)~0u;
+#endif
+
+			if(copy_now)
+			{
+				phys_addr_t copy = memmanager_allocate_physical_page();
+				if(!copy)
+				{
+					success = false;
+					break;
+				}
+
+				uintptr_t v_address = (pd_index << PAGE_DIR_SHIFT) + pt_index * PAGE_SIZE;
+				memmanager_copy_to_frame(copy, (const void*)v_address);
+
+				pte_t flags = entry & ~PTE_ADDRESS_MASK;
+				if(flags & PAGE_COPY_ON_WRITE)
+					flags = (flags & ~PAGE_COPY_ON_WRITE) | PAGE_RW;
+
+				dst_table[pt_index] = copy | flags;
+				continue;
+			}
+
+			if(writable)
+				entry = (entry & ~PAGE_RW) | PAGE_COPY_ON_WRITE;
+
+			memmanager_get_frame(entry & PTE_ADDRESS_MASK);
+			dst_table[pt_index] = entry;
+		}
+
+		memmanager_unmap_page_locked((uintptr_t)dst_table, PAGE_PRESENT);
+
+		dst_dir[pd_index] = dst_table_phys | (pd_entry & PAGE_FLAGS_MASK);
+
+		if(!success)
+			return false;
+	}
+
+	return true;
+}
+
+uintptr_t memmanager_clone_memory_space()
+{
+	uintptr_t process_page_dir = memmanager_new_memory_space();
+
+	if(process_page_dir == (uintptr_t)NULL)
+		return (uintptr_t)NULL;
+
+	bool success;
+	{
+		sync::lock_guard l{kernel_addr_mutex};
+
+		auto src = memmanager_current_space();
+		auto dst = memmanager_find_space((uintptr_t)memmanager_get_physical(process_page_dir));
+
+		dst->user_ranges.clear();
+		src->user_ranges.for_each([dst](uintptr_t start, size_t length) {
+			memmanager_reserve_range_nodes();
+			dst->user_ranges.release(start, length);
+		});
+
+		for(auto m = src->mappings; m != nullptr; m = m->next)
+		{
+			auto copy  = memmanager_new_mapping_node();
+			*copy	   = *m;
+			copy->next = dst->mappings;
+
+			dst->mappings = copy;
+			m->source->retain(m->data);
+		}
+
+		success = memmanager_clone_user_tables(memmanager_space_dirs(process_page_dir));
+
+		//the copy maps the same frames and is held to the same limits
+		dst->resident_pages		= src->resident_pages;
+		dst->max_resident_pages = src->max_resident_pages;
+		dst->max_virtual_pages	= src->max_virtual_pages;
+
+		//pages that became copy on write may still be writable in the tlb
+		__flush_tlb();
+	}
+
+	if(!success)
+	{
+		printf("not enough memory to clone address space\n");
+
+		//whatever was shared so far is released by destroying the copy
+		uintptr_t oldcr3 = (uintptr_t)get_page_directory();
+		memmanager_enter_memory_space(process_page_dir);
+		memmanager_destroy_memory_space(process_page_dir);
+		set_page_directory(oldcr3);
+
+		return (uintptr_t)NULL;
+	}
+
+	return process_page_dir;
+}
+
+bool memmanager_get_space_info(uintptr_t memspace, process_mem_info* info)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+
+	auto space = memmanager_lookup_space((uintptr_t)memmanager_get_physical(memspace));
+	if(!space)
+		return false;
+
+	info->resident_pages	 = space->resident_pages;
+	info->virtual_pages		 = memmanager_virtual_pages(space);
+	info->max_resident_pages = space->max_resident_pages;
+	info->max_virtual_pages	 = space->max_virtual_pages;
+	return true;
+}
+
+bool memmanager_set_space_limits(uintptr_t memspace, size_t max_resident_pages,
+								 size_t max_virtual_pages)
+{
+	sync::lock_guard l{kernel_addr_mutex};
+
+	auto space = memmanager_lookup_space((uintptr_t)memmanager_get_physical(memspace));
+	if(!space)
+		return false;
+
+	space->max_resident_pages = max_resident_pages;
+	space->max_virtual_pages  = max_virtual_pages;
+	return true;
+}
+
+void memmanager_enter_memory_space(uintptr_t memspace)
 {
-	uintptr_t* page_table = GET_PAGE_TABLE_ADDRESS(pd_index);
-
-	return page_table[get_page_tbl_index(virtual_address)];
+	set_page_directory((uintptr_t)memmanager_get_physical(memspace));
 }
 
-static uintptr_t memmanager_get_pt_entry(uintptr_t virtual_address)
+bool memmanager_destroy_memory_space(uintptr_t pdir)
 {
-	size_t pd_index = get_page_dir_index(virtual_address);
-	uintptr_t pd_entry = current_page_directory[pd_index];
-
-	if(!(pd_entry & PAGE_PRESENT)) //page table is not present
+	//nothing else runs in a space that's being destroyed, so the list can't change under us
+	file_mapping* to_sync;
 	{
-		return pd_entry;
+		sync::lock_guard l{kernel_addr_mutex};
+		to_sync = memmanager_current_space()->mappings;
 	}
 
-	return memmanager_get_pt_entry(virtual_address, pd_index);
-}
+	for(auto m = to_sync; m != nullptr; m = m->next)
+	{
+		if(m->source->write)
+			memmanager_sync_file_pages((void*)m->start, m->num_pages);
+	}
 
-uintptr_t memmanager_get_physical(uintptr_t virtual_address)
-{
-	return (memmanager_get_pt_entry(virtual_address) & PAGE_ADDRESS_MASK) +
-		(virtual_address & ~PAGE_ADDRESS_MASK);
-}
+	file_mapping* mappings;
+	{
+		sync::lock_guard l{kernel_addr_mutex};
 
-void memmanager_update_pt(uintptr_t* pt_ptr, uintptr_t new_value, uintptr_t v_address)
-{
-	__atomic_store(pt_ptr, &new_value, __ATOMIC_RELAXED);
-	__flush_tlb_page(v_address);
-}
+		auto space = memmanager_unregister_space((uintptr_t)memmanager_get_physical(pdir));
+		k_assert(space);
 
-static void memmanager_create_new_page_table(size_t pd_index, page_flags_t flags)
-{
-	flags &= ~(PAGE_RESERVED | PAGE_MAP_ON_ACCESS);
+		space->user_ranges.clear();
 
-	current_page_directory[pd_index] = memmanager_allocate_physical_page() | PAGE_PRESENT | PAGE_RW | flags;
+		mappings = space->mappings;
+		space->mappings = nullptr;
 
-	__flush_tlb();
+		//the page tables are freed later by the background thread, a bit at a time
+		space->dead_pages = pdir;
+		space->next		  = dead_spaces;
+		dead_spaces		  = space;
 
-	//printf("added new page table, %X\n", current_page_directory[pd_index]);
+		//nothing may run on the detached tables from here on
+		set_page_directory(kernel_page_directory);
+	}
 
-	uintptr_t* page_table = GET_PAGE_TABLE_ADDRESS(pd_index);
+	memmanager_free_mappings(mappings);
 
-	memset(page_table, 0, PAGE_SIZE);
+	return true;
 }
 
-static uintptr_t memmanager_get_unmapped_pages(const size_t num_pages, page_flags_t flags)
+//frees one page table of a destroyed address space, returns false if there's nothing left to do
+static bool memmanager_reap_dead_space()
 {
-	const uintptr_t first_pt = (flags & PAGE_USER) ? 0 : get_page_dir_index(KERNEL_SPLIT);
-	const uintptr_t last_pt = get_page_dir_index(MAXIMUM_ADDRESS);
+	memory_space* done = nullptr;
+	{
+		sync::lock_guard l{kernel_addr_mutex};
 
-	size_t pages_found = 0;
+		auto space = dead_spaces;
+		if(!space)
+			return false;
 
-	for(size_t pd_index = first_pt; pd_index < last_pt; pd_index++)
-	{
-		if(!(current_page_directory[pd_index] & PAGE_PRESENT))
-		{
-			memmanager_create_new_page_table(pd_index, flags);
+		pte_t* page_dir = memmanager_space_dirs(space->dead_pages);
 
-			if(num_pages <= PAGE_TABLE_SIZE)
-			{
-				return pd_index << 22;
-			}
+		//skip to the next user page table
+		while(space->reap_index < NUM_PAGE_TABLES &&
+			  (!(page_dir[space->reap_index] & PAGE_USER) ||
+			   (page_dir[space->reap_index] & PAGE_LARGE)))
+		{
+			space->reap_index++;
 		}
 
-		//if were looking for a user page, we need a user page table
-		//if were looking for a kernel page, we need a kernel page table
-		if((bool)(flags & PAGE_USER) != (bool)(current_page_directory[pd_index] & PAGE_USER))
+		if(space->reap_index == NUM_PAGE_TABLES)
 		{
-			pages_found = 0;
-			continue;
+			dead_spaces = space->next;
+			done		= space;
 		}
-
-		const uintptr_t* page_table = GET_PAGE_TABLE_ADDRESS(pd_index);
-
-		for(size_t i = 0; i < PAGE_TABLE_SIZE; i++)
+		else
 		{
-			if(page_table[i] & PAGE_ALLOCATED)
-			{
-				pages_found = 0;
-				continue;
-			}
+			phys_addr_t table_phys		= page_dir[space->reap_index] & PTE_ADDRESS_MASK;
+			page_dir[space->reap_index] = 0;
+			space->reap_index++;
 
-			pages_found++;
+			pte_t* page_table = memmanager_map_temporary(table_phys);
 
-			if(pages_found == num_pages)
+			for(size_t pt_index = 0; pt_index < PAGE_TABLE_SIZE; pt_index++)
 			{
-				return (pd_index << 22) + (i - (num_pages - 1)) * PAGE_SIZE;
+				//release frames that are still owned, possibly shared with a clone
+				if((page_table[pt_index] & PAGE_ALLOCATED) == PAGE_ALLOCATED)
+				{
+					memmanager_put_frame(page_table[pt_index] & PTE_ADDRESS_MASK);
+				}
 			}
+
+			memmanager_unmap_page_locked((uintptr_t)page_table, PAGE_PRESENT);
+			physical_memory_free(table_phys, PAGE_SIZE);
 		}
 	}
 
-	printf("couldn't find page, num_pages = %d, flags = %X\n", num_pages, flags);
-	k_assert(false);
+	if(done)
+	{
+		memmanager_free_pages((void*)done->dead_pages, SPACE_PAGES);
+		delete done;
+	}
 
-	return (uintptr_t)nullptr;
+	return true;
 }
 
-void memmanager_unmap_page_with_flags(uintptr_t virtual_address, page_flags_t flags)
+//a write to a page shared by memmanager_clone_memory_space
+static bool memmanager_handle_cow_fault(uintptr_t virtual_address)
 {
 	sync::lock_guard l{kernel_addr_mutex};
 
+	virtual_address &= PAGE_ADDRESS_MASK;
+
 	size_t pd_index = get_page_dir_index(virtual_address);
-	uintptr_t pd_entry = current_page_directory[pd_index];
 
-	if(pd_entry & PAGE_PRESENT)
+	if(!memmanager_has_page_table(pd_index))
 	{
-		auto& pt_entry = memmanager_get_pt_entry(virtual_address, pd_index);
-		if(pt_entry & flags)
-		{
-			//unmap the page
-			memmanager_update_pt(&pt_entry, 0, virtual_address);
-		}
+		return false;
 	}
-	else
+
+	pte_t& pt_entry = memmanager_get_pt_entry(virtual_address, pd_index);
+
+	if(!(pt_entry & PAGE_COPY_ON_WRITE))
 	{
-		printf("warning pdir not exists for %X!\n", virtual_address);
-		k_assert(false);
+		//another thread may have resolved it while we waited for the lock
+		return (pt_entry & (PAGE_PRESENT | PAGE_RW)) == (PAGE_PRESENT | PAGE_RW);
 	}
-}
 
-static bool memmanager_map_page(uintptr_t virtual_address, uintptr_t physical_address, page_flags_t flags)
-{
-	size_t pd_index = get_page_dir_index(virtual_address);
-	uintptr_t pd_entry = current_page_directory[pd_index];
+	const phys_addr_t frame = pt_entry & PTE_ADDRESS_MASK;
+	const page_flags_t flags =
+		(page_flags_t)(pt_entry & PAGE_FLAGS_MASK & ~PAGE_COPY_ON_WRITE) | PAGE_RW;
 
-	if(!(pd_entry & PAGE_PRESENT)) //page table is not present
+	if(memmanager_frame_refs(frame) == 0)
 	{
-		memmanager_create_new_page_table(pd_index, flags);
+		//everyone else already has their own copy
+		memmanager_update_pt(&pt_entry, memmanager_make_entry(virtual_address, frame, flags),
+							 virtual_address);
+		return true;
 	}
-	else if((flags & PAGE_USER) && !(pd_entry & PAGE_USER))
+
+#ifndef __I386_ONLY
+	//nothing to copy from the zero page
+	if(frame == zero_page)
 	{
-		printf("Page at %X does not match requested flags %X\n", virtual_address, pd_entry & PAGE_FLAGS_MASK);
-		return false;
+		if(phys_addr_t zeroed = memmanager_take_zeroed_page())
+		{
+			memmanager_update_pt(&pt_entry, memmanager_make_entry(virtual_address, zeroed, flags),
+								 virtual_address);
+			memmanager_put_frame(frame);
+			return true;
+		}
 	}
+#endif
 
-	uintptr_t& pt_entry = memmanager_get_pt_entry(virtual_address, pd_index);
-
-	if(pt_entry & PAGE_ALLOCATED)
+	phys_addr_t physical = memmanager_allocate_physical_page();
+	if(!physical)
 	{
-		printf("warning page already exists at %X!\n", virtual_address);
+		printf("Can't allocate physical page\n");
 		return false;
 	}
 
-	memmanager_update_pt(&pt_entry,
-						 (physical_address & PAGE_ADDRESS_MASK) | flags,
+	memmanager_copy_to_frame(physical, (const void*)virtual_address);
+	memmanager_update_pt(&pt_entry, memmanager_make_entry(virtual_address, physical, flags),
 						 virtual_address);
+	memmanager_put_frame(frame);
 
 	return true;
 }
 
-void* memmanager_map_to_new_pages(uintptr_t physical_address, size_t n, page_flags_t flags)
+//put a filled frame in place of a page that was mapped on access
+static void memmanager_install_page(uintptr_t virtual_address, phys_addr_t physical)
 {
 	sync::lock_guard l{kernel_addr_mutex};
 
-	uintptr_t virtual_address = memmanager_get_unmapped_pages(n, flags);
+	pte_t& pt_entry =
+		memmanager_get_pt_entry(virtual_address, get_page_dir_index(virtual_address));
 
-	for(size_t i = 0; i < n; i++)
+	if(!(pt_entry & PAGE_MAP_ON_ACCESS))
 	{
-		if(!memmanager_map_page(virtual_address + i * PAGE_SIZE, physical_address + i * PAGE_SIZE, flags))
-			return NULL;
+		//another thread got here first
+		physical_memory_free(physical, PAGE_SIZE);
+		return;
 	}
 
-	return (void*)virtual_address;
-}
+	page_flags_t flags = (page_flags_t)(pt_entry & (PAGE_FLAGS_MASK & ~PAGE_MAP_ON_ACCESS));
 
-uintptr_t memmanager_get_page_flags(uintptr_t virtual_address)
-{
-	return memmanager_get_pt_entry(virtual_address) & PAGE_FLAGS_MASK;
+	memmanager_update_pt(&pt_entry,
+						 memmanager_make_entry(virtual_address, physical, flags | PAGE_PRESENT),
+						 virtual_address);
 }
 
-void memmanager_set_page_flags(void* virtual_address, size_t num_pages, page_flags_t flags)
+static bool memmanager_handle_file_fault(const file_mapping& m, uintptr_t virtual_address,
+										 page_flags_t flags, uint32_t eflags)
 {
-	uintptr_t preserved = PAGE_PRESENT | PAGE_RESERVED | PAGE_MAP_ON_ACCESS;
+	//reading can wait on the disk, so let interrupts in if the faulting code allowed them
+	int_lock l = lock_interrupts();
+	unlock_interrupts(l | (eflags & 0x200));
 
-	for(size_t i = 0; i < num_pages; i++)
-	{
-		const uintptr_t v_address = (uintptr_t)virtual_address + i * PAGE_SIZE;
+	const size_t page_offset = virtual_address - m.start;
+	const uint64_t offset	 = m.offset + page_offset;
+	size_t file_bytes		 = (page_offset < m.file_bytes) ? m.file_bytes - page_offset : 0;
+	if(file_bytes > PAGE_SIZE) file_bytes = PAGE_SIZE;
 
-		const size_t pd_index = get_page_dir_index(v_address);
-		const uintptr_t pd_entry = current_page_directory[pd_index];
+	bool handled = false;
 
-		if(!(pd_entry & PAGE_PRESENT)) //page table is not present
+	if(!(flags & PAGE_RW) && file_bytes == PAGE_SIZE && m.source->get_frame)
+	{
+		if(phys_addr_t frame = m.source->get_frame(m.data, offset))
 		{
-			puts("page table not present, while attempting to set flags");
-			return;
+			//if another thread mapped the page first, or the frame is shared too much,
+			//it's read in below, where the first case is taken care of
+			handled = memmanager_map_shared_frame((void*)virtual_address, frame, flags);
 		}
-
-		uintptr_t& page_entry = memmanager_get_pt_entry(v_address, pd_index);
-
-		memmanager_update_pt(&page_entry,
-							 (page_entry & (PAGE_ADDRESS_MASK | preserved)) | flags,
-							 v_address);
 	}
-}
-
-static void* memmanager_alloc_page(page_flags_t flags)
-{
-	uintptr_t physical_address = memmanager_allocate_physical_page();
-
-	sync::lock_guard l{kernel_addr_mutex};
-
-	uintptr_t virtual_address = memmanager_get_unmapped_pages(1, flags);
-
-	if(!memmanager_map_page(virtual_address, physical_address, flags | PAGE_PRESENT))
-		return NULL;
-
-	return (void*)virtual_address;
-}
-
-void* memmanager_virtual_alloc(void* v_address, size_t n, page_flags_t flags)
-{
-	sync::lock_guard l{kernel_addr_mutex};
-
-	uintptr_t illegal = PAGE_RESERVED | PAGE_MAP_ON_ACCESS;
-
-	flags &= (PAGE_FLAGS_MASK & ~illegal);
-
-	uintptr_t virtual_address = (uintptr_t)v_address;
 
-	if(virtual_address == (uintptr_t)nullptr)
+	if(!handled)
 	{
-		virtual_address = memmanager_get_unmapped_pages(n, flags);
-
-		//if its still null then there were not enough contiguous unmapped pages
-		if(virtual_address == (uintptr_t)nullptr)
+		if(phys_addr_t physical = memmanager_allocate_physical_page_reclaiming())
 		{
-			printf("failure to get %d unmapped pages\n", n);
-			return nullptr;
-		}
-	}
-	else if((uintptr_t)virtual_address & PAGE_FLAGS_MASK)
-	{
-		printf("unaligned address %X\n", virtual_address);
-		return nullptr;
-	}
+			auto page = (uint8_t*)memmanager_map_to_new_pages(physical, 1, PAGE_PRESENT | PAGE_RW);
 
-	uintptr_t page_virtual_address = (uintptr_t)virtual_address;
+			size_t read = file_bytes ? m.source->read(m.data, offset, page, file_bytes) : 0;
+			memset(page + read, 0, PAGE_SIZE - read);
 
-	if(flags & PAGE_PRESENT)
-	{
-		page_flags_t pf = flags | PAGE_PRESENT;
-		for(size_t i = 0; i < n; i++)
-		{
-			auto r = memmanager_map_page(page_virtual_address,
-										 memmanager_allocate_physical_page(), pf);
-			k_assert(r);
+			memmanager_unmap_pages(page, 1);
+			memmanager_install_page(virtual_address, physical);
+			handled = true;
 		}
-	}
-	else
-	{
-		page_flags_t pf = flags | PAGE_RESERVED | PAGE_MAP_ON_ACCESS;
-		for(size_t i = 0; i < n; i++)
+		else
 		{
-			auto r = memmanager_map_page(page_virtual_address, 0, pf);
-			k_assert(r);
-
-			k_assert(memmanager_get_page_flags(page_virtual_address) & PAGE_RESERVED);
-			k_assert(!(memmanager_get_page_flags(page_virtual_address) & PAGE_PRESENT));
-			page_virtual_address += PAGE_SIZE;
+			printf("Can't allocate physical page\n");
 		}
 	}
 
-	return (void*)virtual_address;
-}
+	m.source->release(m.data);
 
-SYSCALL_HANDLER void* syscall_virtual_alloc(void* v_address, size_t n, page_flags_t flags)
-{
-	return memmanager_virtual_alloc(v_address, n, flags);
+	unlock_interrupts(l);
+	return handled;
 }
 
-static int memmanager_unmap_pages_with_flags(void* addr, size_t num_pages, page_flags_t flags)
+//zeroes one more frame for the pool, returns false if there was nothing to do
+static bool memmanager_fill_zero_pool()
 {
-	uintptr_t v_addr = (uintptr_t)addr;
-	while(num_pages--)
 	{
-		memmanager_unmap_page_with_flags(v_addr, flags); //unmap the page
-		v_addr += PAGE_SIZE; //next page
+		sync::interrupt_lock l{};
+		if(zero_pool_count == ZERO_POOL_SIZE)
+			return false;
 	}
-	return 0;
-}
 
-SYSCALL_HANDLER int syscall_unmap_user_pages(void* addr, size_t num_pages)
-{
-	return memmanager_unmap_pages_with_flags(addr, num_pages, PAGE_USER);
-}
+	if(physical_num_bytes_free() < ZERO_POOL_MIN_FREE)
+		return false;
 
-int memmanager_unmap_pages(void* addr, size_t num_pages)
-{
-	return memmanager_unmap_pages_with_flags(addr, num_pages, PAGE_ALLOCATED);
-}
+	phys_addr_t physical = physical_memory_allocate_page();
+	if(!physical)
+		return false;
 
-int memmanager_free_pages_with_flags(void* page, size_t num_pages, page_flags_t flags)
-{
-	uintptr_t virtual_address = (uintptr_t)page;
+	void* page = memmanager_map_to_new_pages(physical, 1, PAGE_PRESENT | PAGE_RW);
+	if(!page)
+	{
+		physical_memory_free(physical, PAGE_SIZE);
+		return false;
+	}
 
-	while(num_pages--)
+	memset(page, 0, PAGE_SIZE);
+	memmanager_unmap_pages(page, 1);
+
+	sync::interrupt_lock l{};
+	if(zero_pool_count == ZERO_POOL_SIZE)
 	{
-		uintptr_t physical_address = memmanager_get_pt_entry(virtual_address);
+		//the faults that would have emptied it didn't happen
+		physical_memory_free(physical, PAGE_SIZE);
+		return false;
+	}
 
-		memmanager_unmap_page_with_flags(virtual_address, flags); //unmap the page
+	zero_pool[zero_pool_count++] = physical;
+	return true;
+}
 
-		virtual_address += PAGE_SIZE; //next page
+//keeps free memory above the low watermark and the zero pool filled,
+//frees what's left of destroyed address spaces and runs other background work
+static void memmanager_background_thread(void*)
+{
+	for(;;)
+	{
+		bool busy = memmanager_reap_dead_space();
+		busy	  = page_reclaim_balance() || busy;
+		busy	  = memmanager_fill_zero_pool() || busy;
+		busy	  = background_work_run() || busy;
 
-		if(!(physical_address & PAGE_ALLOCATED))
+		if(!busy)
 		{
-			return -1; //the page was not allocated
+			//wait for memory to be used
+			__asm__ volatile("hlt");
 		}
 
-		if(physical_address & PAGE_PRESENT)
-		{
-			physical_memory_free(physical_address & PAGE_ADDRESS_MASK, PAGE_SIZE);
-		}
+		//only keep going while the foreground task is waiting on something
+		switch_to_active_task();
+		run_background_tasks();
 	}
-
-	return 0;
 }
 
-int memmanager_free_pages(void* page, size_t num_pages)
+void memmanager_start_background_thread(void)
 {
-	return memmanager_free_pages_with_flags(page, num_pages, PAGE_ALLOCATED);
+	spawn_kernel_thread(memmanager_background_thread, nullptr);
 }
 
-SYSCALL_HANDLER int syscall_free_pages(void* page, size_t num_pages)
+bool memmanager_is_user_address(uintptr_t address)
 {
-	if(!page) 
-		return -1;
-
-	return memmanager_free_pages_with_flags(page, num_pages, PAGE_USER);
+	return address >= USER_SPACE_BEGIN && address < KERNEL_SPLIT;
 }
 
-void memmanager_init_page_dir(__attribute__((nonnull)) uintptr_t* page_dir, uintptr_t physaddr)
+bool memmanager_prefault_user(const void* address, size_t size, bool write)
 {
-	//Mark pages not present
-	memset(page_dir, 0, PAGE_SIZE);
+	const uintptr_t begin = (uintptr_t)address;
+	if(size == 0)
+		return true;
 
-	//the last entry in the page dir is mapped to the page dir
-	page_dir[PAGE_TABLE_SIZE - 1] = physaddr | PAGE_PRESENT | PAGE_RW;
-}
-
-uintptr_t memmanager_new_memory_space()
-{
-	uintptr_t* process_page_dir = (uintptr_t*)memmanager_alloc_page(PAGE_RW);
+	if(!memmanager_is_user_address(begin) || size > KERNEL_SPLIT - begin)
+		return false;
 
-	if(process_page_dir == NULL)
+	for(uintptr_t page = begin & PAGE_ADDRESS_MASK; page < begin + size; page += PAGE_SIZE)
 	{
-		return (uintptr_t)NULL; //not enough free physical memory 
-	}
-
-	memmanager_init_page_dir(process_page_dir, memmanager_get_physical((uintptr_t)process_page_dir));
+		const pte_t entry = memmanager_get_pt_entry(page);
+		if((entry & PAGE_PRESENT) && !(entry & PAGE_USER))
+			return false;
 
-	for(size_t i = 0; i < PAGE_TABLE_SIZE - 1; i++)
-	{
-		//copy only the kernel page directories
-		if(!(current_page_directory[i] & PAGE_USER))
-		{
-			process_page_dir[i] = current_page_directory[i];
-		}
-	}
+		if((entry & PAGE_PRESENT) && (!write || (entry & PAGE_RW)))
+			continue;
 
-	return (uintptr_t)process_page_dir;
-}
+		//handled as if the program had touched it, so its limits apply
+		const page_flags_t err =
+			(page_flags_t)(PAGE_USER | (write ? PAGE_RW : 0) | (entry & PAGE_PRESENT));
 
-void memmanager_enter_memory_space(uintptr_t memspace)
-{
-	set_page_directory(memmanager_get_physical((uintptr_t)memspace));
-}
+		int_lock l = lock_interrupts();
+		const bool handled = memmanager_handle_page_fault(err, page, l);
+		unlock_interrupts(l);
 
-bool memmanager_destroy_memory_space(uintptr_t pdir)
-{
-	for(size_t i = 0; i < PAGE_TABLE_SIZE; i++)
-	{
-		//copy only the kernel page directories
-		if(current_page_directory[i] & PAGE_USER)
-		{
-			physical_memory_free(current_page_directory[i] & PAGE_ADDRESS_MASK,
-								 PAGE_SIZE);
-		}
+		if(!handled)
+			return false;
 	}
 
-	set_page_directory(kernel_page_directory);
-
-	memmanager_free_pages((void*)pdir, 1);
-
 	return true;
 }
 
-bool memmanager_handle_page_fault(page_flags_t err, uintptr_t virtual_address)
+bool memmanager_handle_page_fault(page_flags_t err, uintptr_t virtual_address, uint32_t eflags)
 {
 	if(err & PAGE_PRESENT)
 	{
-		return false;
+		return (err & PAGE_RW) && memmanager_handle_cow_fault(virtual_address);
 	}
 	size_t pd_index = get_page_dir_index(virtual_address);
 
-	if(current_page_directory[pd_index] & PAGE_PRESENT)
+	if(memmanager_has_page_table(pd_index))
 	{
-		uintptr_t& pt_entry = memmanager_get_pt_entry(virtual_address, pd_index);
+		pte_t& pt_entry = memmanager_get_pt_entry(virtual_address, pd_index);
 
 		if(pt_entry & PAGE_MAP_ON_ACCESS)
 		{
 			k_assert(pt_entry & PAGE_RESERVED);
 			k_assert(!(pt_entry & PAGE_PRESENT));
 
-			uintptr_t physical = memmanager_allocate_physical_page();
-			if(!physical)
-			{
-				printf("Can't allocate physical page\n");
+			//the kernel only touches a program's memory once a syscall has faulted it in,
+			//so a fault it takes after that mustn't fail over the limit
+			if((err & PAGE_USER) && virtual_address >= USER_SPACE_BEGIN &&
+			   virtual_address < KERNEL_SPLIT && !memmanager_can_add_resident(1))
 				return false;
+
+			file_mapping mapping;
+			if(virtual_address >= USER_SPACE_BEGIN && virtual_address < KERNEL_SPLIT &&
+			   memmanager_find_file_mapping(virtual_address & PAGE_ADDRESS_MASK, &mapping))
+			{
+				return memmanager_handle_file_fault(mapping,
+													virtual_address & PAGE_ADDRESS_MASK,
+													(page_flags_t)(pt_entry & PAGE_FLAGS_MASK), eflags);
 			}
 
 			virtual_address &= PAGE_ADDRESS_MASK;
 
-			page_flags_t flags = pt_entry & (PAGE_FLAGS_MASK & ~(PAGE_RESERVED | PAGE_MAP_ON_ACCESS));
+			page_flags_t flags = (page_flags_t)(pt_entry & (PAGE_FLAGS_MASK & ~PAGE_MAP_ON_ACCESS));
+
+#ifndef __I386_ONLY
+			//reading untouched user memory gets the shared zero page until it's written
+			if(!(err & PAGE_RW) && zero_page &&
+			   virtual_address >= USER_SPACE_BEGIN && virtual_address < KERNEL_SPLIT &&
+			   memmanager_frame_refs(zero_page) != (uint16_t)~0u)
+			{
+				memmanager_get_frame(zero_page);
+
+				if(flags & PAGE_RW)
+					flags = (flags & ~PAGE_RW) | PAGE_COPY_ON_WRITE;
+
+				memmanager_update_pt(&pt_entry,
+									 memmanager_make_entry(virtual_address, zero_page,
+														   flags | PAGE_PRESENT),
+									 virtual_address);
+				return true;
+			}
+#endif
+
+			if(phys_addr_t zeroed = memmanager_take_zeroed_page())
+			{
+				memmanager_update_pt(&pt_entry,
+									 memmanager_make_entry(virtual_address, zeroed,
+														   flags | PAGE_PRESENT),
+									 virtual_address);
+				return true;
+			}
 
-			uintptr_t page_value = physical | flags | PAGE_PRESENT;
+			phys_addr_t physical = memmanager_allocate_physical_page_reclaiming();
+			if(!physical)
+			{
+				printf("Can't allocate physical page\n");
+				return false;
+			}
 
-			memmanager_update_pt(&pt_entry, page_value | PAGE_RW, virtual_address);
+			memmanager_update_pt(&pt_entry,
+								 memmanager_make_entry(virtual_address, physical,
+													   flags | PAGE_PRESENT | PAGE_RW),
+								 virtual_address);
 
 			//security measure
 			memset((void*)virtual_address, 0, PAGE_SIZE);
 
 			if(!(flags & PAGE_RW))
 			{
-				memmanager_update_pt(&pt_entry, page_value, virtual_address);
+				memmanager_update_pt(&pt_entry,
+									 memmanager_make_entry(virtual_address, physical,
+														   flags | PAGE_PRESENT),
+									 virtual_address);
 			}
 
 			return true;
@@ -495,23 +2048,23 @@ bool memmanager_handle_page_fault(page_flags_t err, uintptr_t virtual_address)
 
 static void memmanager_print_all_mappings_to_physical_DEBUG()
 {
-	for(size_t pd_index = 0; pd_index < PAGE_TABLE_SIZE; pd_index++)
+	for(size_t pd_index = 0; pd_index < NUM_PAGE_TABLES; pd_index++)
 	{
-		if(current_page_directory[pd_index] & PAGE_PRESENT)
+		if(memmanager_has_page_table(pd_index))
 		{
-			uintptr_t* page_table = GET_PAGE_TABLE_ADDRESS(pd_index);
+			pte_t* page_table = GET_PAGE_TABLE_ADDRESS(pd_index);
 
 			for(size_t pt_index = 0; pt_index < PAGE_TABLE_SIZE; pt_index++)
 			{
 				if(page_table[pt_index] & PAGE_PRESENT)
 				{
-					uintptr_t physical_address = page_table[pt_index] & PAGE_ADDRESS_MASK;
+					phys_addr_t physical_address = page_table[pt_index] & PTE_ADDRESS_MASK;
 					//if((physical & PAGE_ADDRESS_MASK) == physical_address)
 					{
-						uintptr_t v = (pd_index << 22) + pt_index * PAGE_SIZE;
+						uintptr_t v = (pd_index << PAGE_DIR_SHIFT) + pt_index * PAGE_SIZE;
 						if(v != physical_address)
 						{
-							printf("%X mapped to %X\n", v, physical_address);
+							printf("%X mapped to %X\n", v, (uintptr_t)physical_address);
 						}
 					}
 				}
@@ -524,12 +2077,23 @@ extern uint8_t _IMAGE_END_;
 extern uint8_t _KERNEL_START_;
 
 extern "C" uintptr_t boot_mapper_map_mem(uintptr_t addr, size_t bytes);
-extern "C" void boot_mapper_remap_mem(uintptr_t virt, uintptr_t phys);
+extern "C" void boot_mapper_remap_mem(uintptr_t virt, phys_addr_t phys);
 
 RECLAIMABLE void memmanager_init(void)
 {
-	kernel_page_directory	   = memmanager_allocate_physical_page();
-	uintptr_t first_page_table = memmanager_allocate_physical_page();
+#ifdef __PAE
+	//the boot mapper already switched to PAE
+	cr4_bits |= CR4_PAE;
+
+	//has to be on before any entry has the bit set
+	no_execute_enabled = enable_no_execute();
+	if(no_execute_enabled)
+		efer_bits |= EFER_NXE;
+#endif
+
+	//these are contiguous so the boot mapper can map them all at once
+	kernel_page_directory = physical_memory_allocate(SPACE_PAGES * PAGE_SIZE, PAGE_SIZE);
+	phys_addr_t first_page_table = memmanager_allocate_physical_page();
 
 	if(first_page_table == 0 || kernel_page_directory == 0)
 	{
@@ -540,11 +2104,18 @@ RECLAIMABLE void memmanager_init(void)
 		return;
 	}
 
-	auto new_page_dir =
-		(uintptr_t*)boot_mapper_map_mem(kernel_page_directory, PAGE_SIZE);
-	auto new_page_tbl = (uintptr_t*)boot_mapper_map_mem(first_page_table, PAGE_SIZE);
+	uintptr_t space_pages = boot_mapper_map_mem(kernel_page_directory, SPACE_PAGES * PAGE_SIZE);
+	auto new_page_tbl = (pte_t*)boot_mapper_map_mem((uintptr_t)first_page_table, PAGE_SIZE);
 
-	memmanager_init_page_dir(new_page_dir, (uintptr_t)kernel_page_directory);
+	phys_addr_t dirs_phys[NUM_PAGE_DIRS];
+	for(size_t i = 0; i < NUM_PAGE_DIRS; i++)
+	{
+		dirs_phys[i] = kernel_page_directory + (SPACE_PAGES - NUM_PAGE_DIRS + i) * PAGE_SIZE;
+	}
+
+	memmanager_init_page_dir(space_pages, dirs_phys);
+
+	pte_t* new_page_dir = memmanager_space_dirs(space_pages);
 
 	//memset(new_page_tbl, 0, PAGE_SIZE);
 
@@ -559,14 +2130,19 @@ RECLAIMABLE void memmanager_init(void)
 
 	uintptr_t kernel_addr = boot_information.kernel_location & PAGE_ADDRESS_MASK;
 
-	uintptr_t* current_pt	  = new_page_tbl;
-	uintptr_t current_pt_phys = first_page_table;
+	pte_t* current_pt			= new_page_tbl;
+	phys_addr_t current_pt_phys = first_page_table;
+
+	//the kernel half is the same in every address space, so its tlb entries can survive a cr3 switch
+	kernel_page_flags = enable_global_pages() ? PAGE_GLOBAL : 0;
+	if(kernel_page_flags)
+		cr4_bits |= CR4_PGE;
 
 	for(size_t i = 0; i < num_k_pages; i++)
 	{
-		uintptr_t* pd_entry = &new_page_dir[get_page_dir_index(k_pg_start)];
+		pte_t* pd_entry = &new_page_dir[get_page_dir_index(k_pg_start)];
 
-		if(*pd_entry == (uintptr_t)nullptr)
+		if(*pd_entry == 0)
 		{
 			current_pt_phys = memmanager_allocate_physical_page();
 			boot_mapper_remap_mem((uintptr_t)current_pt, current_pt_phys);
@@ -577,7 +2153,7 @@ RECLAIMABLE void memmanager_init(void)
 
 		size_t pt_index = get_page_tbl_index(k_pg_start);
 
-		current_pt[pt_index] = kernel_addr | PAGE_PRESENT | PAGE_RW;
+		current_pt[pt_index] = kernel_addr | PAGE_PRESENT | PAGE_RW | kernel_page_flags;
 
 		kernel_addr += PAGE_SIZE;
 		k_pg_start += PAGE_SIZE;
@@ -587,8 +2163,44 @@ RECLAIMABLE void memmanager_init(void)
 
 	enable_paging();
 
+	large_pages_enabled = enable_large_pages();
+	if(large_pages_enabled)
+		cr4_bits |= CR4_PSE;
+
 	printf("paging enabled\n");
 
+	range_nodes.add_nodes(initial_range_nodes, sizeof(initial_range_nodes) / sizeof(range_node));
+
+	//everything in the kernel half except the kernel image is free
+	uintptr_t k_image_begin = (uintptr_t)&_KERNEL_START_ & PAGE_ADDRESS_MASK;
+	uintptr_t k_image_end = k_image_begin + num_k_pages * PAGE_SIZE;
+
+	kernel_ranges.release(KERNEL_SPLIT, k_image_begin - KERNEL_SPLIT);
+	kernel_ranges.release(k_image_end, (uintptr_t)last_pde_address - k_image_end);
+
+	kernel_space.page_dir_phys = kernel_page_directory;
+	kernel_space.user_ranges.release(USER_SPACE_BEGIN, KERNEL_SPLIT - USER_SPACE_BEGIN);
+	memmanager_register_space(&kernel_space);
+
+	//sized for the ram there is, PAE can address far more than fits in the kernel half
+	const size_t num_frames = (size_t)(physical_memory_end() / PAGE_SIZE);
+	frame_refs = (uint16_t*)memmanager_virtual_alloc(
+		nullptr, memmanager_minimum_pages(num_frames * sizeof(uint16_t)), PAGE_RW);
+
+#ifndef __I386_ONLY
+	if(phys_addr_t physical = memmanager_allocate_physical_page())
+	{
+		void* page = memmanager_map_to_new_pages(physical, 1, PAGE_PRESENT | PAGE_RW);
+		memset(page, 0, PAGE_SIZE);
+		memmanager_unmap_pages(page, 1);
+
+		//the memory manager keeps a reference of its own, so copy on write
+		//never hands the zero page to the last task mapping it
+		memmanager_get_frame(physical);
+		zero_page = physical;
+	}
+#endif
+
 	//create an identity mapping here, sometimes this is neccesary
 	memmanager_map_page(0x7000, 0x7000, PAGE_PRESENT | PAGE_RW);
 }
\ No newline at end of file
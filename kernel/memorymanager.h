@@ -9,9 +9,11 @@ extern "C" {
 
 #include <kernel/syscall.h>
 #include <kernel/sections.h>
+#include <kernel/physical_manager.h>
+#include <common/memory_info.h>
 
 void memmanager_init(void);
-uintptr_t memmanager_get_physical(uintptr_t virtual_address);
+phys_addr_t memmanager_get_physical(uintptr_t virtual_address);
 
 typedef uintptr_t page_flags_t;
 int memmanager_free_pages(void* page, size_t num_pages);
@@ -24,13 +26,67 @@ SYSCALL_HANDLER void* syscall_virtual_alloc(void* virtual_address, size_t n, pag
 int memmanager_unmap_pages(void* page, size_t num_pages);
 
 void memmanager_set_page_flags(void* virtual_address, size_t num_pages, page_flags_t flags);
-void* memmanager_map_to_new_pages(uintptr_t physical_address, size_t n, page_flags_t flags);
+void* memmanager_map_to_new_pages(phys_addr_t physical_address, size_t n, page_flags_t flags);
+
+//frames with more than one owner, each mapping made here holds its own reference
+bool memmanager_map_shared_frame(void* virtual_address, phys_addr_t physical_address, page_flags_t flags);
+void memmanager_release_frame(phys_addr_t physical_address);
+//frees a frame only if the caller holds the last reference, returns whether it did
+bool memmanager_release_unused_frame(phys_addr_t physical_address);
+
+//supplies the contents of file backed pages
+typedef struct
+{
+	//a frame that already holds the page at a page aligned offset, read only
+	//mappings map it shared instead of reading a copy, may be null or return 0
+	phys_addr_t (*get_frame)(void* data, uint64_t offset);
+	size_t (*read)(void* data, uint64_t offset, void* dst, size_t len);
+	//where dirty pages are written back to, null if the source is read only
+	size_t (*write)(void* data, uint64_t offset, const void* src, size_t len);
+	//these must not allocate, retain is called with the address space locked
+	void (*retain)(void* data);
+	void (*release)(void* data);
+} page_source;
+
+//back pages that were allocated with memmanager_virtual_alloc, but not touched yet,
+//with file_bytes of data read from source on first access, the rest are zeroed
+//the mapping takes over the caller's reference to data
+bool memmanager_map_file(void* virtual_address, size_t num_pages, const page_source* source,
+						 void* data, uint64_t offset, size_t file_bytes);
+
+//write modified file backed pages back to their source
+void memmanager_sync_file_pages(void* virtual_address, size_t num_pages);
+SYSCALL_HANDLER int syscall_sync_file_pages(void* virtual_address, size_t num_pages);
 
 uintptr_t memmanager_new_memory_space();
+uintptr_t memmanager_clone_memory_space();
 void memmanager_enter_memory_space(uintptr_t memspace);
+//memspace must be the current space, the kernel's is entered instead
+//and the memory is given back by the background thread bit by bit
 bool memmanager_destroy_memory_space(uintptr_t memspace);
 
-bool memmanager_handle_page_fault(page_flags_t err, uintptr_t page);
+//fills in everything but the pid, returns false if memspace doesn't exist
+bool memmanager_get_space_info(uintptr_t memspace, process_mem_info* info);
+//limits are in pages, 0 for no limit
+bool memmanager_set_space_limits(uintptr_t memspace, size_t max_resident_pages,
+								 size_t max_virtual_pages);
+
+bool memmanager_handle_page_fault(page_flags_t err, uintptr_t page, uint32_t eflags);
+//whether address is below the kernel's part of every address space
+bool memmanager_is_user_address(uintptr_t address);
+//faults in the program's pages a syscall is about to use, before it takes any locks,
+//false if some aren't the program's or can't be brought in
+bool memmanager_prefault_user(const void* address, size_t size, bool write);
+
+//starts the background thread that reclaims memory when it runs low,
+//and keeps a pool of zeroed frames for page faults
+void memmanager_start_background_thread(void);
+
+//called after a batch of pages was invalidated on this cpu, so other cpus can drop them too
+void memmanager_set_tlb_shootdown(void (*shootdown)(uintptr_t address, size_t num_pages));
+
+//cr4 and efer bits the boot cpu turned on, other cpus need them before they load cr3
+void memmanager_get_paging_bits(uint32_t* cr4_bits, uint32_t* efer_bits);
 
 inline uint32_t getcr2reg()
 {
@@ -43,17 +99,130 @@ inline void set_page_directory(uintptr_t address)
 	__asm__ __volatile__("mov %0, %%cr3\n" : : "a"(address));
 }
 
+#ifndef __I386_ONLY
+//WP makes ring 0 respect read only pages, copy on write relies on this
+#define CR0_PAGING_BITS "0x80010001"
+#else
+#define CR0_PAGING_BITS "0x80000001"
+#endif
+
 inline void enable_paging(void)
 {
 	__asm__ __volatile__(
 		"mov %%cr0, %%eax\n"
-		"or $0x80000001, %%eax\n"
+		"or $" CR0_PAGING_BITS ", %%eax\n"
 		"mov %%eax, %%cr0\n"
 		:
 		:
 		:);
 }
 
+//cpuid leaf 1 feature flags in edx, 0 if the cpu doesn't have cpuid
+inline uint32_t get_cpu_features(void)
+{
+#ifndef __I386_ONLY
+	uint32_t eflags, toggled;
+	//cpuid is only there if the ID flag in eflags can be changed
+	__asm__ __volatile__(
+		"pushfl\n"
+		"pop %0\n"
+		"mov %0, %1\n"
+		"xor $0x200000, %1\n"
+		"push %1\n"
+		"popfl\n"
+		"pushfl\n"
+		"pop %1\n"
+		"push %0\n"
+		"popfl\n"
+		: "=&r"(eflags), "=&r"(toggled)
+		:
+		: "cc");
+
+	if(!((eflags ^ toggled) & 0x200000))
+		return 0;
+
+	uint32_t eax = 1, ebx, ecx = 0, edx;
+	__asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+
+	return edx;
+#else
+	return 0; //the 386 has no cpuid
+#endif
+}
+
+#define CPU_FEATURE_PSE 0x08u
+#define CPU_FEATURE_PGE 0x2000u
+
+#define CR4_PSE 0x10u
+#define CR4_PAE 0x20u
+#define CR4_PGE 0x80u
+
+//sets a bit in cr4 if the cpu has the matching feature, returns whether it did
+inline bool enable_cr4_feature(uint32_t feature, uint32_t cr4_bit)
+{
+	if(!(get_cpu_features() & feature))
+		return false;
+
+	__asm__ __volatile__(
+		"mov %%cr4, %%eax\n"
+		"or %0, %%eax\n"
+		"mov %%eax, %%cr4\n"
+		:
+		: "r"(cr4_bit)
+		: "eax");
+	return true;
+}
+
+//4 MiB pages, 2 MiB with PAE
+inline bool enable_large_pages(void)
+{
+	return enable_cr4_feature(CPU_FEATURE_PSE, CR4_PSE);
+}
+
+//global pages stay in the tlb when cr3 is reloaded
+inline bool enable_global_pages(void)
+{
+	return enable_cr4_feature(CPU_FEATURE_PGE, CR4_PGE);
+}
+
+#define EFER_MSR 0xC0000080u
+#define EFER_NXE 0x800u
+
+#ifdef __PAE
+//cpuid leaf 0x80000001 feature flags in edx, every cpu with PAE has cpuid
+inline uint32_t get_cpu_ext_features(void)
+{
+	uint32_t eax = 0x80000000, ebx, ecx = 0, edx;
+	__asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+
+	if(eax < 0x80000001)
+		return 0;
+
+	eax = 0x80000001;
+	ecx = 0;
+	__asm__ __volatile__("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+	return edx;
+}
+
+#define CPU_EXT_FEATURE_NX 0x100000u
+
+//lets PAE page table entries mark pages as not executable
+inline bool enable_no_execute(void)
+{
+	if(!(get_cpu_ext_features() & CPU_EXT_FEATURE_NX))
+		return false;
+
+	__asm__ __volatile__(
+		"rdmsr\n"
+		"or %1, %%eax\n"
+		"wrmsr\n"
+		:
+		: "c"(EFER_MSR), "i"(EFER_NXE)
+		: "eax", "edx");
+	return true;
+}
+#endif
+
 inline void* get_page_directory()
 {
 	uint32_t cr3val;
@@ -70,16 +239,26 @@ enum page_flags
 	PAGE_PRESENT = 0x01u,
 	PAGE_RW = 0x02u,
 	PAGE_USER = 0x04u,
+	PAGE_DIRTY = 0x40u,
+	PAGE_LARGE = 0x80u, // 4 MiB page (2 MiB with PAE), only valid in a page directory entry
+	PAGE_GLOBAL = 0x100u,
 
 	// OS specific
 	PAGE_RESERVED = 0x800u, // bit 11
 	PAGE_MAP_ON_ACCESS = 0x400u, // bit 10
+	PAGE_COPY_ON_WRITE = 0x200u, // bit 9
 
 	PAGE_ALLOCATED = PAGE_RESERVED | PAGE_PRESENT
 };
 
 #define PAGE_SIZE 0x1000u
+
+#ifdef __PAE
+//entries are 64 bits wide, so a table only holds half as many
+#define PAGE_TABLE_SIZE 0x200u
+#else
 #define PAGE_TABLE_SIZE 0x400u
+#endif
 
 inline size_t memmanager_minimum_pages(size_t bytes)
 {
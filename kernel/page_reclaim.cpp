@@ -0,0 +1,128 @@
+#include <kernel/page_reclaim.h>
+#include <kernel/physical_manager.h>
+#include <kernel/locks.h>
+#include <kernel/task.h>
+
+#include <vector>
+#include <algorithm>
+
+struct reclaimer
+{
+	reclaim_func reclaim;
+	void* data;
+
+	bool operator==(const reclaimer& other) const
+	{
+		return reclaim == other.reclaim && data == other.data;
+	}
+};
+
+static std::vector<reclaimer> reclaimers;
+static constinit sync::mutex reclaimers_mutex{};
+
+static int pressure_level = MEMORY_PRESSURE_NONE;
+
+//counts every time the pressure reached a level, so waiters can't miss a short spike
+static size_t pressure_events[MEMORY_PRESSURE_CRITICAL + 1]{};
+
+static void page_reclaim_set_pressure(int level)
+{
+	sync::interrupt_lock l{};
+
+	pressure_level = level;
+	if(level != MEMORY_PRESSURE_NONE)
+		pressure_events[level]++;
+}
+
+static size_t page_reclaim_events_since(int level)
+{
+	sync::interrupt_lock l{};
+
+	size_t events = 0;
+	for(int i = level; i <= MEMORY_PRESSURE_CRITICAL; i++)
+	{
+		events += pressure_events[i];
+	}
+	return events;
+}
+
+void page_reclaim_add(reclaim_func reclaim, void* data)
+{
+	sync::lock_guard l{reclaimers_mutex};
+	reclaimers.push_back(reclaimer{reclaim, data});
+}
+
+void page_reclaim_remove(reclaim_func reclaim, void* data)
+{
+	sync::lock_guard l{reclaimers_mutex};
+
+	auto it = std::find(reclaimers.begin(), reclaimers.end(), reclaimer{reclaim, data});
+	if(it != reclaimers.end())
+		reclaimers.erase(it);
+}
+
+size_t page_reclaim_run(size_t num_bytes)
+{
+	//someone else is already at it, or this is a fault from inside a reclaimer
+	if(!reclaimers_mutex.try_lock())
+		return 0;
+
+	size_t freed = 0;
+	for(auto& r : reclaimers)
+	{
+		if(freed >= num_bytes)
+			break;
+
+		freed += r.reclaim(r.data, num_bytes - freed);
+	}
+
+	reclaimers_mutex.unlock();
+	return freed;
+}
+
+bool page_reclaim_balance(void)
+{
+	const size_t free = physical_num_bytes_free();
+
+	if(free >= RECLAIM_LOW_WATERMARK)
+	{
+		if(pressure_level != MEMORY_PRESSURE_NONE)
+			page_reclaim_set_pressure(MEMORY_PRESSURE_NONE);
+		return false;
+	}
+
+	const size_t freed = page_reclaim_run(RECLAIM_HIGH_WATERMARK - free);
+
+	page_reclaim_set_pressure(freed != 0 ? MEMORY_PRESSURE_LOW : MEMORY_PRESSURE_CRITICAL);
+	return freed != 0;
+}
+
+void page_reclaim_out_of_memory(void)
+{
+	page_reclaim_set_pressure(MEMORY_PRESSURE_CRITICAL);
+}
+
+int memory_pressure(void)
+{
+	return pressure_level;
+}
+
+SYSCALL_HANDLER int syscall_wait_memory_pressure(int level)
+{
+	if(level <= MEMORY_PRESSURE_NONE)
+		return memory_pressure();
+
+	if(level > MEMORY_PRESSURE_CRITICAL)
+		level = MEMORY_PRESSURE_CRITICAL;
+
+	const size_t seen = page_reclaim_events_since(level);
+
+	while(memory_pressure() < level && page_reclaim_events_since(level) == seen)
+	{
+		switch_to_active_task();
+		run_background_tasks();
+	}
+
+	const int current = memory_pressure();
+	return current > level ? current : level;
+}
@@ -0,0 +1,41 @@
+#ifndef PAGE_RECLAIM_H
+#define PAGE_RECLAIM_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include <kernel/syscall.h>
+#include <common/memory_info.h>
+
+//below this much free memory caches start being dropped, until there's this much again
+#define RECLAIM_LOW_WATERMARK 0x100000u
+#define RECLAIM_HIGH_WATERMARK 0x200000u
+
+//frees up to about num_bytes of cached data that can be read back later, and returns how
+//much it freed, this can be called from a page fault so it should only try its locks
+typedef size_t (*reclaim_func)(void* data, size_t num_bytes);
+
+void page_reclaim_add(reclaim_func reclaim, void* data);
+void page_reclaim_remove(reclaim_func reclaim, void* data);
+
+//asks the caches to give memory back, returns how many bytes were freed
+size_t page_reclaim_run(size_t num_bytes);
+
+//frees memory if there's less than the low watermark left, returns whether it did anything
+bool page_reclaim_balance(void);
+
+//an allocation failed even after reclaiming
+void page_reclaim_out_of_memory(void);
+
+int memory_pressure(void);
+
+//blocks until the memory pressure reaches level, returns the level it reached
+SYSCALL_HANDLER int syscall_wait_memory_pressure(int level);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
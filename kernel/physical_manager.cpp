@@ -1,4 +1,5 @@
 #include <kernel/physical_manager.h>
+#include <kernel/memorymanager.h>
 #include <kernel/sections.h>
 #include <kernel/bootstrap/boot_info.h>
 #include <kernel/kassert.h>
@@ -9,8 +10,8 @@
 
 typedef struct
 {
-	uintptr_t offset;
-	size_t length;
+	phys_addr_t offset;
+	phys_addr_t length; //blocks above 4 GiB can be bigger than size_t
 } memory_block;
 
 #define MAX_NUM_MEMORY_BLOCKS 128
@@ -72,7 +73,7 @@ struct block_list
 		return it;
 	}
 
-	constexpr void claim_from_block(iterator& it, uintptr_t offset, size_t size) noexcept
+	constexpr void claim_from_block(iterator& it, phys_addr_t offset, size_t size) noexcept
 	{
 		auto length = it->length - (size + offset);
 		if(length == 0)
@@ -121,7 +122,21 @@ private:
 
 constinit block_list memory_map{};
 
-void physical_memory_reserve(uintptr_t address, size_t size)
+static constinit phys_addr_t memory_end = 0;
+
+//drivers get memory they can reach with 32 bit addresses
+static bool is_low_memory(phys_addr_t address, size_t size)
+{
+#ifdef __PAE
+	return address + size <= 0x100000000ull;
+#else
+	(void)address;
+	(void)size;
+	return true;
+#endif
+}
+
+void physical_memory_reserve(phys_addr_t address, size_t size)
 {
 	for(auto it = memory_map.begin(); it != memory_map.end(); it++)
 	{
@@ -133,18 +148,18 @@ void physical_memory_reserve(uintptr_t address, size_t size)
 
 		if(it->offset > address)
 		{
-			size -= it->offset - address;
+			size -= (size_t)(it->offset - address);
 			address = it->offset;
 		}
 
 		size_t claimed_space = size;
-		size_t available_space = it->length - (address - it->offset);
+		phys_addr_t available_space = it->length - (address - it->offset);
 		if(available_space < claimed_space)
 		{
-			claimed_space = available_space;
+			claimed_space = (size_t)available_space;
 		}
 
-		size_t padding = address - it->offset;
+		phys_addr_t padding = address - it->offset;
 		if(it->length >= claimed_space + padding)
 		{
 			memory_map.claim_from_block(it, padding, claimed_space);
@@ -160,8 +175,13 @@ void physical_memory_reserve(uintptr_t address, size_t size)
 	}
 }
 
-void physical_memory_free(uintptr_t physical_address, size_t size)
+void physical_memory_free(phys_addr_t physical_address, size_t size)
 {
+	if(physical_address + size > memory_end)
+	{
+		memory_end = physical_address + size;
+	}
+
 	for(auto it = memory_map.begin(); it != memory_map.end(); it++)
 	{
 		if(it->offset + it->length < physical_address)
@@ -206,10 +226,14 @@ uintptr_t physical_memory_allocate(size_t size, size_t align)
 {
 	for(auto it = memory_map.begin(); it != memory_map.end(); it++)
 	{
-		uintptr_t aligned_addr = align_addr(it->offset, align);
+		//blocks are sorted, so nothing after this is low enough either
+		if(!is_low_memory(it->offset, 0))
+			break;
 
-		size_t padding = aligned_addr - it->offset;
-		if(it->length >= size + padding)
+		uintptr_t aligned_addr = align_addr((uintptr_t)it->offset, align);
+
+		size_t padding = aligned_addr - (uintptr_t)it->offset;
+		if(it->length >= size + padding && is_low_memory(aligned_addr, size))
 		{
 			memory_map.claim_from_block(it, padding, size);
 			return aligned_addr;
@@ -220,11 +244,38 @@ uintptr_t physical_memory_allocate(size_t size, size_t align)
 	return 0;
 }
 
+phys_addr_t physical_memory_allocate_page(void)
+{
+#ifdef __PAE
+	//take from the top, memory below 4 GiB is kept for what can't go anywhere else
+	for(auto it = memory_map.end(); it != memory_map.begin();)
+	{
+		--it;
+
+		const phys_addr_t top = (it->offset + it->length) & ~(phys_addr_t)(PAGE_SIZE - 1);
+		if(top < it->offset + PAGE_SIZE)
+			continue;
+
+		const phys_addr_t page = top - PAGE_SIZE;
+		memory_map.claim_from_block(it, page - it->offset, PAGE_SIZE);
+		return page;
+	}
+
+	printf("could not allocate enough pages\n");
+	return 0;
+#else
+	return physical_memory_allocate(PAGE_SIZE, PAGE_SIZE);
+#endif
+}
+
 uintptr_t physical_memory_allocate_in_range(uintptr_t start, uintptr_t end, size_t size, size_t align)
 {
 	for(auto it = memory_map.begin(); it != memory_map.end(); it++)
 	{
-		uintptr_t aligned_addr = align_addr(it->offset, align);
+		if(it->offset >= end)
+			break;
+
+		uintptr_t aligned_addr = align_addr((uintptr_t)it->offset, align);
 
 		if(aligned_addr < start)
 		{
@@ -238,7 +289,7 @@ uintptr_t physical_memory_allocate_in_range(uintptr_t start, uintptr_t end, size
 		if(aligned_addr + size > end)
 			return 0;
 
-		size_t padding = aligned_addr - it->offset;
+		size_t padding = aligned_addr - (uintptr_t)it->offset;
 		if(it->length >= size + padding)
 		{
 			memory_map.claim_from_block(it, padding, size);
@@ -252,23 +303,34 @@ uintptr_t physical_memory_allocate_in_range(uintptr_t start, uintptr_t end, size
 
 SYSCALL_HANDLER size_t physical_num_bytes_free(void)
 {
-	size_t sum = 0;
+	phys_addr_t sum = 0;
 
 	for(size_t i = 0; i < memory_map.size(); i++)
 	{
 		sum += memory_map[i].length;
 	}
 
-	return sum;
+	//saturate rather than wrap when there's more than fits in a size_t
+	return (sum > (size_t)~0u) ? (size_t)~0u : (size_t)sum;
+}
+
+phys_addr_t physical_memory_end(void)
+{
+	return memory_end;
 }
 
 extern "C" void print_free_map()
 {
 	for(size_t i = 0; i < memory_map.size(); i++)
 	{
-		printf("Available \t%8X - %8X\n",
-			   memory_map[i].offset,
-			   memory_map[i].offset + memory_map[i].length);
+		const phys_addr_t begin = memory_map[i].offset;
+		const phys_addr_t end	= memory_map[i].offset + memory_map[i].length;
+#ifdef __PAE
+		printf("Available \t%X%08X - %X%08X\n",
+			   (uint32_t)(begin >> 32), (uint32_t)begin, (uint32_t)(end >> 32), (uint32_t)end);
+#else
+		printf("Available \t%8X - %8X\n", begin, end);
+#endif
 	}
 }
 
@@ -10,17 +10,33 @@
 extern "C" {
 #endif
 
+//physical addresses can be wider than pointers with PAE
+#ifdef __PAE
+typedef uint64_t phys_addr_t;
+#define PHYSICAL_ADDRESS_LIMIT 0x1000000000ull //36 bits
+#else
+typedef uintptr_t phys_addr_t;
+#define PHYSICAL_ADDRESS_LIMIT 0x100000000ull
+#endif
+
 void physical_memory_init(void);
 
 SYSCALL_HANDLER size_t physical_num_bytes_free(void);
 size_t physical_mem_size(void);
 
 uintptr_t physical_memory_allocate_in_range(uintptr_t start, uintptr_t end, size_t size, size_t align);
+//these always return memory below 4 GiB, so it can be used for dma
 uintptr_t physical_memory_allocate(size_t size, size_t align);
 
-void physical_memory_free(uintptr_t physical_address, size_t size);
+//a single page for anything that's only accessed through paging, may be above 4 GiB
+phys_addr_t physical_memory_allocate_page(void);
+
+void physical_memory_free(phys_addr_t physical_address, size_t size);
+
+void physical_memory_reserve(phys_addr_t address, size_t size);
 
-void physical_memory_reserve(uintptr_t address, size_t size);
+//one past the highest address of usable ram
+phys_addr_t physical_memory_end(void);
 
 #ifdef __cplusplus
 }
@@ -2,6 +2,7 @@
 #include <kernel/locks.h>
 #include <kernel/physical_manager.h>
 #include <kernel/memorymanager.h>
+#include <kernel/task.h>
 
 #include <kernel/shared_mem.h>
 
@@ -16,76 +17,196 @@ struct shared_buffer
 };
 
 using shared_map = hash_map<std::string, shared_buffer>;
-using buf_map = hash_map<void*, shared_buffer*>;
 
+//only creating, opening and freeing a buffer use the names, handles are looked up per process
 constinit sync::shared_mutex map_mtx;
 shared_map shared_buffers;
 
-SYSCALL_HANDLER uintptr_t create_shared_buffer(const char* name_data, size_t name_len, size_t size)
+static void shared_buffer_retain(void* object)
 {
-	std::string_view name{name_data, name_len};
+	auto data = (shared_buffer*)object;
+
+	sync::lock_guard l{data->mtx};
+	data->num_refs++;
+}
+
+static void shared_buffer_release(void* object)
+{
+	auto data = (shared_buffer*)object;
+
+	{
+		sync::lock_guard l{data->mtx};
+		if(--data->num_refs != 0)
+			return;
+	}
+
+	//open skips buffers without references, so nobody can take a new one now
+	physical_memory_free(data->physical, data->num_pages * PAGE_SIZE);
 
 	sync::unique_lock map_lock{map_mtx};
+	shared_buffers.remove(data->name);
+}
 
-	auto data = shared_buffers.emplace(name);
-	if(!data)
-		return 0; //could not create new buffer, likely already exists
+static constexpr handle_ops shared_buffer_ops{shared_buffer_retain, shared_buffer_release};
 
-	sync::lock_guard l{data->mtx};
+//hands the caller's reference over to a new handle
+static uintptr_t shared_buffer_handle(shared_buffer* data)
+{
+	auto handle = process_add_handle(data, &shared_buffer_ops);
+	if(!handle)
+		shared_buffer_release(data);
 
-	map_lock.unlock();
+	return handle;
+}
+
+SYSCALL_HANDLER uintptr_t create_shared_buffer(const char* name_data, size_t name_len, size_t size)
+{
+	std::string_view name{name_data, name_len};
 
-	data->name = name;
-	data->size = size;
-	data->num_pages = memmanager_minimum_pages(size);
-	data->physical = physical_memory_allocate(data->num_pages * PAGE_SIZE, PAGE_SIZE);
-	data->num_refs = 1;
+	shared_buffer* data;
+	{
+		sync::unique_lock map_lock{map_mtx};
+
+		data = shared_buffers.emplace(name);
+		if(!data)
+			return 0; //could not create new buffer, likely already exists
+
+		data->name		= name;
+		data->size		= size;
+		data->num_pages = memmanager_minimum_pages(size);
+		data->physical	= physical_memory_allocate(data->num_pages * PAGE_SIZE, PAGE_SIZE);
+		data->num_refs	= 1;
+
+		if(!data->physical)
+		{
+			shared_buffers.remove(name);
+			return 0;
+		}
+	}
 
-	return !!(data->physical) ? (uintptr_t)data : 0;
+	return shared_buffer_handle(data);
 }
 
 SYSCALL_HANDLER uintptr_t open_shared_buffer(const char* name, size_t name_len)
 {
-	sync::shared_lock map_lock{map_mtx};
-
-	if(auto data = shared_buffers.lookup(std::string_view{name, name_len}))
+	shared_buffer* data;
 	{
+		sync::shared_lock map_lock{map_mtx};
+
+		data = shared_buffers.lookup(std::string_view{name, name_len});
+		if(!data)
+			return 0; //buffer does not exist
+
 		sync::lock_guard l{data->mtx};
 
-		data->num_refs++;
+		//the last reference is being dropped
+		if(data->num_refs == 0)
+			return 0;
 
-		return (uintptr_t)data;
+		data->num_refs++;
 	}
 
-	return 0; //buffer does not exist
+	return shared_buffer_handle(data);
 }
 
 SYSCALL_HANDLER void close_shared_buffer(uintptr_t buf_handle)
 {
-	auto data = (shared_buffer*)buf_handle;
+	if(auto data = process_remove_handle(buf_handle, &shared_buffer_ops))
+		shared_buffer_release(data);
+}
 
-	sync::unique_lock map_lock{map_mtx};
+SYSCALL_HANDLER void* map_shared_buffer(uintptr_t buf_handle, size_t size, page_flags_t flags)
+{
+	auto data = (shared_buffer*)process_get_handle(buf_handle, &shared_buffer_ops);
+	if(!data)
+		return nullptr;
 
-	sync::lock_guard l{data->mtx};
+	void* pages = nullptr;
+	if(size <= data->size)
+	{
+		pages = memmanager_map_to_new_pages(data->physical, memmanager_minimum_pages(size),
+											PAGE_USER | PAGE_PRESENT | flags);
+	}
+
+	shared_buffer_release(data);
+	return pages;
+}
+
+
+//a task blocked in futex_wait, lives on its stack until a wake takes it off the list
+struct futex_waiter
+{
+	phys_addr_t key;
+	volatile bool woken;
+	futex_waiter* next;
+};
+
+static constinit sync::mutex futex_mtx{};
+static futex_waiter* futex_waiters = nullptr;
+
+//waits are keyed by the frame, so processes that map the same buffer at
+//different addresses still meet on the same word
+static phys_addr_t futex_key(const uint32_t* address)
+{
+	if((uintptr_t)address % sizeof(uint32_t) || !memmanager_is_user_address((uintptr_t)address))
+		return 0;
+
+	//faulted in for writing, a read could leave the zero page or a frame still shared
+	//after a fork mapped, and the waker's first store would move the word to another frame
+	if(!memmanager_prefault_user(address, sizeof(uint32_t), true))
+		return 0;
+
+	return memmanager_get_physical((uintptr_t)address);
+}
+
+SYSCALL_HANDLER int futex_wait(const uint32_t* address, uint32_t expected)
+{
+	futex_waiter w{futex_key(address), false, nullptr};
+	if(!w.key)
+		return -1;
 
-	if(--data->num_refs == 0)
 	{
-		physical_memory_free(data->physical, data->num_pages * PAGE_SIZE);
+		sync::lock_guard l{futex_mtx};
 
-		shared_buffers.remove(data->name);
+		//changed before we got here, the wake we'd wait for already happened
+		if(__atomic_load_n(address, __ATOMIC_SEQ_CST) != expected)
+			return 1;
+
+		w.next		  = futex_waiters;
+		futex_waiters = &w;
+	}
+
+	while(!w.woken)
+	{
+		switch_to_active_task();
+		run_background_tasks();
 	}
+
+	return 0;
 }
 
-SYSCALL_HANDLER void* map_shared_buffer(uintptr_t buf_handle, size_t size, page_flags_t flags)
+SYSCALL_HANDLER int futex_wake(const uint32_t* address, size_t num_waiters)
 {
-	auto data = (shared_buffer*)buf_handle;
+	const phys_addr_t key = futex_key(address);
+	if(!key)
+		return -1;
 
-	sync::lock_guard l{data->mtx};
+	sync::lock_guard l{futex_mtx};
 
-	if(data->size < size)
-		return nullptr;
+	int num_woken = 0;
+	for(auto it = &futex_waiters; *it != nullptr && (size_t)num_woken < num_waiters;)
+	{
+		auto w = *it;
+		if(w->key != key)
+		{
+			it = &w->next;
+			continue;
+		}
+
+		*it		 = w->next;
+		w->woken = true;
+		num_woken++;
+	}
 
-	return memmanager_map_to_new_pages(data->physical,
-									   memmanager_minimum_pages(size), 
-									   PAGE_USER | PAGE_PRESENT | flags);
-}
\ No newline at end of file
+	return num_woken;
+}
@@ -13,6 +13,11 @@ extern "C" {
 	SYSCALL_HANDLER void close_shared_buffer(uintptr_t buf_handle);
 	SYSCALL_HANDLER void* map_shared_buffer(uintptr_t buf_handle, size_t size, page_flags_t flags);
 
+	//blocks until woken if the word at address still holds expected, returns 1 if it didn't
+	SYSCALL_HANDLER int futex_wait(const uint32_t* address, uint32_t expected);
+	//wakes up to num_waiters tasks waiting on address, returns how many it woke
+	SYSCALL_HANDLER int futex_wake(const uint32_t* address, size_t num_waiters);
+
 #ifdef __cplusplus
 }
 #endif
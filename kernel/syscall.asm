@@ -49,3 +49,23 @@ __regcall3__iopl:
 	mov [esp + FRAME.eflags], ecx
 	xor eax, eax
 	ret
+
+[extern fork_current_process]
+global __regcall3__fork_process
+
+;the child returns through a copy of this frame, so save the user's registers too
+__regcall3__fork_process:
+	push ebp
+	push edi
+	push esi
+	push ebx
+	mov ecx, esp
+	push eax			;flags
+	push ecx			;syscall_frame
+	call fork_current_process
+	add esp, 8
+	pop ebx
+	pop esi
+	pop edi
+	pop ebp
+	ret
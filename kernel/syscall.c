@@ -4,11 +4,13 @@
 #include <kernel/task.h>
 #include <kernel/memorymanager.h>
 #include <kernel/physical_manager.h>
+#include <kernel/page_reclaim.h>
 #include <kernel/sysclock.h>
 #include <kernel/display.h>
 #include <kernel/shared_mem.h>
 #include <kernel/driver_loader.h>
 #include <kernel/input.h>
+#include <kernel/io_ring.h>
 
 //A syscall is accomplished by
 //putting the arguments into EAX, ECX, EDX, EDI, ESI
@@ -73,6 +75,22 @@ const void* syscall_table[] =
 	diagnostic_print,
 	get_process_info,
 	set_tls_addr,
+	fork_process,
+	syscall_map_file,
+	syscall_sync_file_pages,
+	syscall_wait_memory_pressure,
+	get_process_mem_info,
+	set_process_mem_limit,
+	futex_wait,
+	futex_wake,
+	syscall_sync_file,
+	syscall_sync,
+	syscall_read_file_vec,
+	syscall_write_file_vec,
+	syscall_read_file_multi,
+	io_ring_setup,
+	io_ring_enter,
+	syscall_get_disk_stats,
 };
 
 const size_t num_syscalls = sizeof(syscall_table) / sizeof(void*);
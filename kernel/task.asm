@@ -75,6 +75,15 @@ run_user_code:
 	push ebx 				;address of the user function
 	iret
 
+global fork_child_return
+fork_child_return:
+	xor eax, eax			;fork returns 0 in the child
+	pop gs
+	pop fs
+	pop es
+	pop ds
+	iret
+
 [extern current_task_TCB] 
 
 global switch_task_no_return
@@ -10,6 +10,7 @@
 #include <kernel/dynamic_object.h>
 #include <kernel/kassert.h>
 #include <kernel/cpu.h>
+#include <kernel/io_ring.h>
 #include <vector>
 #include <memory>
 #include <algorithm>
@@ -43,6 +44,12 @@ struct process
 	task_id pid;
 	std::vector<task*> tasks;
 	sync::mutex mtx;
+
+	handle_table handles;
+	sync::mutex handles_mtx;
+
+	//not inherited by a fork, the child starts without one
+	io_ring* ring = nullptr;
 };
 
 class task : public TCB
@@ -68,6 +75,7 @@ public:
 };
 
 extern "C" [[noreturn]] void run_user_code(void* address, void* stack);
+extern "C" void fork_child_return();
 extern "C" [[noreturn]] void switch_task_no_return(TCB* t);
 extern "C" void switch_task(TCB* t);
 alignas(4096) constinit uint8_t init_stack[PAGE_SIZE];
@@ -317,20 +325,18 @@ SYSCALL_HANDLER void exit_thread(int val)
 	__builtin_unreachable();
 }
 
-[[noreturn]] void end_last_task(task* current)
+[[noreturn]] void end_last_task(task* current, uintptr_t memspace)
 {
 	memmanager_free_pages((void*)current->user_stack_top, 1);
 
 	run_on_new_stack_no_return(
-		[current]()
+		[current, memspace]()
 		{
 			memmanager_free_pages((void*)current->kernel_stack_top, 1);
 
 			int_lock l = lock_interrupts();
 
-			//we need to clean up before re-enabling interupts or else we might never get it done
-			uint32_t memspace = current->p_data->address_space;
-			//delete current_process;
+			//only detaches the space, the background thread frees it
 			memmanager_destroy_memory_space(memspace);
 			unlock_interrupts(l);
 
@@ -367,6 +373,9 @@ SYSCALL_HANDLER void exit_process(int val)
 		break;
 	}
 
+	if(current_process->ring)
+		io_ring_destroy(current_process->ring);
+
 	for(auto&& object : current_process->objects)
 	{
 		for(auto&& seg : object->segments)
@@ -381,11 +390,65 @@ SYSCALL_HANDLER void exit_process(int val)
 		cleanup_elf(object.get());
 	}
 
+	//nothing else can use them now, the other tasks are gone
+	current_process->handles.for_each([](void* object, const handle_ops* ops)
+									  { ops->release(object); });
+
 	auto last_task = current_process->tasks[0];
+	auto memspace  = current_process->address_space;
 
 	delete current_process;
 
-	end_last_task(last_task);
+	end_last_task(last_task, memspace);
+}
+
+uintptr_t process_add_handle(void* object, const handle_ops* ops)
+{
+	auto p = get_running_task()->p_data;
+
+	sync::lock_guard l{p->handles_mtx};
+	return p->handles.insert(object, ops);
+}
+
+void* process_get_handle(uintptr_t handle, const handle_ops* ops)
+{
+	auto p = get_running_task()->p_data;
+
+	sync::lock_guard l{p->handles_mtx};
+
+	void* object = p->handles.lookup(handle, ops);
+	if(object)
+		ops->retain(object);
+
+	return object;
+}
+
+void* process_remove_handle(uintptr_t handle, const handle_ops* ops)
+{
+	auto p = get_running_task()->p_data;
+
+	sync::lock_guard l{p->handles_mtx};
+	return p->handles.remove(handle, ops);
+}
+
+io_ring* process_get_io_ring()
+{
+	auto p = get_running_task()->p_data;
+
+	sync::lock_guard l{p->mtx};
+	return p->ring;
+}
+
+bool process_set_io_ring(io_ring* ring)
+{
+	auto p = get_running_task()->p_data;
+
+	sync::lock_guard l{p->mtx};
+	if(p->ring)
+		return false;
+
+	p->ring = ring;
+	return true;
 }
 
 SYSCALL_HANDLER void get_process_info(process_info* data)
@@ -396,6 +459,54 @@ SYSCALL_HANDLER void get_process_info(process_info* data)
 	};
 }
 
+SYSCALL_HANDLER task_id get_process_mem_info(task_id pid, process_mem_info* info)
+{
+	//the process with the lowest pid from pid on, so callers can walk all of them
+	task_id found_pid	  = INVALID_TASK_ID;
+	uintptr_t found_space = 0;
+
+	tasks.for_each(
+		[pid, &found_pid, &found_space](task_id, task* t)
+		{
+			auto p = t->p_data;
+			if(p->address_space && p->pid >= pid && p->pid < found_pid)
+			{
+				found_pid	= p->pid;
+				found_space = p->address_space;
+			}
+		});
+
+	//filled in under the memory manager's lock
+	if(!memmanager_prefault_user(info, sizeof(process_mem_info), true))
+		return INVALID_TASK_ID;
+
+	if(found_pid == INVALID_TASK_ID || !memmanager_get_space_info(found_space, info))
+		return INVALID_TASK_ID;
+
+	info->pid = found_pid;
+	return found_pid;
+}
+
+SYSCALL_HANDLER int set_process_mem_limit(task_id pid, size_t max_resident_pages,
+										  size_t max_virtual_pages)
+{
+	auto current = get_running_task()->p_data;
+
+	auto target = tasks.lookup(pid);
+	if(!target)
+		return -1;
+
+	auto p = (*target)->p_data;
+
+	//a process can only limit itself and its children
+	if(p != current && p->parent_pid != current->pid)
+		return -1;
+
+	return memmanager_set_space_limits(p->address_space, max_resident_pages, max_virtual_pages)
+			   ? 0
+			   : -1;
+}
+
 SYSCALL_HANDLER void set_tls_addr(void* ptr)
 {
 	auto tls_ptr = std::bit_cast<uintptr_t>(ptr);
@@ -455,6 +566,79 @@ extern "C" SYSCALL_HANDLER task_id spawn_thread(void* function_ptr, void* tls_pt
 	return new_task->tid;
 }
 
+task_id spawn_kernel_thread(void (*function)(void*), void* arg)
+{
+	uintptr_t kernel_stack_top =
+		(uintptr_t)memmanager_virtual_alloc(nullptr, 1, PAGE_RW | PAGE_PRESENT);
+
+	auto new_task = new task{generate_tid(), &init_process, 0, kernel_stack_top, 0};
+
+	new_task->regs.esp = new_task->regs.esp0 - sizeof(kernel_thread_stack_items);
+
+	*(kernel_thread_stack_items*)new_task->regs.esp = kernel_thread_stack_items{
+		.flags		= 0x0200, //interrupts on
+		.eip		= (uintptr_t)function,
+		.return_eip = 0,
+		.arg		= (uintptr_t)arg,
+	};
+
+	{
+		sync::lock_guard l{init_process.mtx};
+		init_process.tasks.push_back(new_task);
+	}
+
+	//lock tasks
+	tasks.emplace(new_task->tid, new_task);
+	//unlock tasks
+
+	runnable.push_back(new_task);
+
+	return new_task->tid;
+}
+
+struct background_work
+{
+	background_work_func work;
+	void* data;
+};
+
+static std::vector<background_work> background_work_list;
+static constinit sync::mutex background_work_mutex{};
+
+void background_work_add(background_work_func work, void* data)
+{
+	sync::lock_guard l{background_work_mutex};
+	background_work_list.push_back(background_work{work, data});
+}
+
+void background_work_remove(background_work_func work, void* data)
+{
+	sync::lock_guard l{background_work_mutex};
+
+	auto it = std::find_if(background_work_list.begin(), background_work_list.end(),
+						   [work, data](const background_work& w) {
+							   return w.work == work && w.data == data;
+						   });
+	if(it != background_work_list.end())
+		background_work_list.erase(it);
+}
+
+bool background_work_run(void)
+{
+	//whoever holds it is adding work, it'll get done next time
+	if(!background_work_mutex.try_lock())
+		return true;
+
+	bool busy = false;
+	for(auto& w : background_work_list)
+	{
+		busy = w.work(w.data) || busy;
+	}
+
+	background_work_mutex.unlock();
+	return busy;
+}
+
 extern "C" SYSCALL_HANDLER void yield_to(task_id tid)
 {
 	if(auto is_active = this_task_is_active(); tasks.contains(tid) && is_active)
@@ -471,6 +655,30 @@ extern "C" SYSCALL_HANDLER void yield_to(task_id tid)
 	}
 }
 
+static task_id start_process(task* new_task, int flags)
+{
+	auto new_pid = new_task->tid;
+
+	runnable.push_back(new_task);
+
+	if(flags & WAIT_FOR_PROCESS)
+	{
+		int_lock l = lock_interrupts();
+		
+		if(this_task_is_active())
+		{
+			active_process = new_pid;
+		}
+		
+		//unlock tasks
+		unlock_interrupts(l);
+
+		switch_task(new_task);
+	}
+
+	return new_pid;
+}
+
 extern "C" SYSCALL_HANDLER task_id spawn_process(const file_handle* file,
 												 const void* arg_ptr,
 												 size_t args_size,
@@ -506,8 +714,8 @@ extern "C" SYSCALL_HANDLER task_id spawn_process(const file_handle* file,
 	if(!load_elf(file, new_process->objects[0].get(), true, cwd.get_ptr()))
 	{
 		delete new_process;
-		set_page_directory(oldcr3);
 		memmanager_destroy_memory_space(address_space);
+		set_page_directory(oldcr3);
 		return INVALID_TASK_ID;
 	}
 
@@ -522,30 +730,104 @@ extern "C" SYSCALL_HANDLER task_id spawn_process(const file_handle* file,
 				   2 * sizeof(size_t)),
 		   &args_buf[0], args_buf.size());
 
-	auto new_pid = new_task->tid;
-
-	new_process->pid = new_pid;
+	new_process->pid = new_task->tid;
 
 	set_page_directory(oldcr3);
 
-	runnable.push_back(new_task);
+	return start_process(new_task, flags);
+}
 
-	if(flags & WAIT_FOR_PROCESS)
+//the user side of this is in syscall.asm, it passes us the caller's registers
+extern "C" task_id fork_current_process(const syscall_frame* frame, int flags)
+{
+	auto current = get_running_task();
+	auto parent	 = current->p_data;
+
+	auto address_space = memmanager_clone_memory_space();
+	if(!address_space)
+		return INVALID_TASK_ID;
+
+	//the ring isn't inherited, its frames are freed with the parent's
 	{
-		int_lock l = lock_interrupts();
-		
-		if(this_task_is_active())
+		sync::lock_guard l{parent->mtx};
+		if(parent->ring)
 		{
-			active_process = new_pid;
+			uintptr_t oldcr3 = (uintptr_t)get_page_directory();
+
+			memmanager_enter_memory_space(address_space);
+			io_ring_unmap_user(parent->ring);
+			set_page_directory(oldcr3);
 		}
-		
-		//unlock tasks
-		unlock_interrupts(l);
+	}
 
-		switch_task(new_task);
+	process* new_process = new process{};
+
+	new_process->parent_pid	   = parent->pid;
+	new_process->address_space = address_space;
+
+	for(auto&& object : parent->objects)
+	{
+		//the symbol maps are only used while linking, which is already done
+		auto& copy = new_process->objects.emplace_back(
+			std::make_unique<dynamic_object>(
+				new dynamic_object::sym_map(),
+				new dynamic_object::sym_map(),
+				new dynamic_object::sym_map()
+			));
+
+		copy->entry_point = object->entry_point;
+		copy->segments	  = object->segments;
+		copy->tls_image	  = object->tls_image;
 	}
 
-	return new_pid;
+	{
+		//the child gets the same handles, each with its own reference
+		sync::lock_guard l{parent->handles_mtx};
+
+		new_process->handles = parent->handles;
+		new_process->handles.for_each([](void* object, const handle_ops* ops)
+									  { ops->retain(object); });
+	}
+
+	uintptr_t kernel_stack_top =
+		(uintptr_t)memmanager_virtual_alloc(nullptr, 1, PAGE_RW | PAGE_PRESENT);
+
+	//the user stack is at the same address in the copy
+	auto new_task = new task{generate_tid(), new_process, current->user_stack_top,
+							 kernel_stack_top, 0,
+							 (uintptr_t)memmanager_get_physical(address_space)};
+
+	new_task->regs.tls_gdt_hi  = current->regs.tls_gdt_hi;
+	new_task->regs.tls_base_lo = current->regs.tls_base_lo;
+	new_task->regs.esp = new_task->regs.esp0 - sizeof(fork_stack_items);
+
+	//the child returns from this syscall too, with the same registers
+	*(fork_stack_items*)new_task->regs.esp = fork_stack_items{
+		.ebp		= frame->ebp,
+		.edi		= frame->edi,
+		.esi		= frame->esi,
+		.ebx		= frame->ebx,
+		.flags		= 0x0200,
+		.return_eip = (uintptr_t)fork_child_return,
+		.gs			= frame->gs,
+		.fs			= frame->fs,
+		.es			= frame->es,
+		.ds			= frame->ds,
+		.eip		= frame->eip,
+		.cs			= frame->cs,
+		.eflags		= frame->eflags,
+		.esp		= frame->esp,
+		.ss			= frame->ss,
+	};
+
+	new_process->pid = new_task->tid;
+	new_process->tasks.push_back(new_task);
+
+	//lock tasks
+	tasks.emplace(new_task->tid, new_task);
+	//unlock tasks
+
+	return start_process(new_task, flags);
 }
 
 void switch_to_task(task_id tid)
@@ -6,6 +6,7 @@
 #include <kernel/syscall.h>
 #include <kernel/filesystem.h>
 #include <common/task_data.h>
+#include <common/memory_info.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,6 +21,7 @@ typedef struct dynamic_object dynamic_object;
 SYSCALL_HANDLER task_id spawn_process(const file_handle* file,
 									  const void* arg_ptr, size_t args_size,
 									  int flags);
+SYSCALL_HANDLER task_id fork_process(int flags);
 SYSCALL_HANDLER void exit_process(int val);
 
 SYSCALL_HANDLER task_id spawn_thread(void* function_ptr, void* tls_ptr);
@@ -29,6 +31,25 @@ SYSCALL_HANDLER void yield_to(task_id task);
 SYSCALL_HANDLER void get_process_info(process_info* data);
 SYSCALL_HANDLER void set_tls_addr(void* tls_ptr);
 
+//fills info for the process with the lowest pid at or after pid, and returns its pid,
+//INVALID_TASK_ID if there are none left
+SYSCALL_HANDLER task_id get_process_mem_info(task_id pid, process_mem_info* info);
+//limits are in pages, 0 for no limit
+SYSCALL_HANDLER int set_process_mem_limit(task_id pid, size_t max_resident_pages,
+										  size_t max_virtual_pages);
+
+//runs function in the kernel, in the background, it must never return
+task_id spawn_kernel_thread(void (*function)(void*), void* arg);
+
+//done by the kernel's background thread while the foreground task waits, it should
+//do a small piece at a time and return whether there was anything to do
+typedef bool (*background_work_func)(void* data);
+
+void background_work_add(background_work_func work, void* data);
+void background_work_remove(background_work_func work, void* data);
+//runs every piece of work once, returns whether any of it was busy
+bool background_work_run(void);
+
 void run_next_task();
 void run_background_tasks();
 void setup_first_task();
@@ -45,5 +66,19 @@ void cpu_entry_point(size_t id, uint8_t* spinlock);
 
 #ifdef __cplusplus
 }
+
+#include <kernel/util/handle_table.h>
+
+//handles owned by the running process, returns 0 if it has too many
+uintptr_t process_add_handle(void* object, const handle_ops* ops);
+//both retain the object for the caller, who releases it when done, null if the handle is stale
+void* process_get_handle(uintptr_t handle, const handle_ops* ops);
+void* process_remove_handle(uintptr_t handle, const handle_ops* ops);
+
+struct io_ring;
+//the running process's io ring, null if it hasn't set one up
+io_ring* process_get_io_ring();
+//returns false if the process already has one
+bool process_set_io_ring(io_ring* ring);
 #endif
 #endif
\ No newline at end of file
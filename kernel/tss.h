@@ -65,6 +65,61 @@ struct __attribute__((packed)) user_transition_stack_items
 	uintptr_t stack_addr;
 };
 
+//what handle_syscall leaves on the kernel stack, plus the callee saved
+//registers pushed by fork_process, these still hold the user's values
+struct __attribute__((packed)) syscall_frame
+{
+	uint32_t ebx;
+	uint32_t esi;
+	uint32_t edi;
+	uint32_t ebp;
+	uintptr_t handler_eip;
+	uint32_t gs;
+	uint32_t fs;
+	uint32_t es;
+	uint32_t ds;
+	uintptr_t eip;
+	uint32_t cs;
+	uint32_t eflags;
+	uintptr_t esp;
+	uint32_t ss;
+};
+
+//the initial kernel stack of a forked task, switch_task pops the first half
+//and fork_child_return the rest
+struct __attribute__((packed)) fork_stack_items
+{
+	uint32_t ebp;
+	uint32_t edi;
+	uint32_t esi;
+	uint32_t ebx;
+	uint32_t flags;
+	uint32_t return_eip;
+	uint32_t gs;
+	uint32_t fs;
+	uint32_t es;
+	uint32_t ds;
+	uintptr_t eip;
+	uint32_t cs;
+	uint32_t eflags;
+	uintptr_t esp;
+	uint32_t ss;
+};
+
+//the initial kernel stack of a kernel thread, switch_task pops it and
+//returns straight into the thread function
+struct __attribute__((packed)) kernel_thread_stack_items
+{
+	uint32_t ebp;
+	uint32_t edi;
+	uint32_t esi;
+	uint32_t ebx;
+	uint32_t flags;
+	uintptr_t eip;
+	uintptr_t return_eip; //thread functions never return
+	uintptr_t arg;
+};
+
 constexpr saved_regs init_tcb_regs(uintptr_t stack_top, uintptr_t page_dir,
 								   uintptr_t tls_ptr)
 {
@@ -0,0 +1,129 @@
+#ifndef HANDLE_TABLE_H
+#define HANDLE_TABLE_H
+#ifdef __cplusplus
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+//what kind of object a handle refers to, handles only match the ops they were made with
+struct handle_ops
+{
+	void (*retain)(void* object);
+	void (*release)(void* object);
+};
+
+//Hands out small numbers for kernel objects, so userspace never sees a kernel pointer.
+//A handle is the slot index + 1 in the low 16 bits and the slot's generation in the high 16,
+//the generation changes whenever a slot is freed, so a stale handle doesn't find what reuses it.
+//Lookups are an index into an array, nothing here locks.
+class handle_table
+{
+public:
+	using handle = uintptr_t;
+
+	constexpr handle_table() = default;
+
+	//returns 0 if the table is full
+	handle insert(void* object, const handle_ops* ops)
+	{
+		size_t index;
+		if(m_free != NO_SLOT)
+		{
+			index  = m_free;
+			m_free = m_slots[index].next_free;
+		}
+		else
+		{
+			if(m_slots.size() == MAX_SLOTS)
+				return 0;
+
+			index = m_slots.size();
+			m_slots.push_back(slot{});
+		}
+
+		auto& s	 = m_slots[index];
+		s.object = object;
+		s.ops	 = ops;
+
+		return (handle)(index + 1) | ((handle)s.generation << 16);
+	}
+
+	void* lookup(handle h, const handle_ops* ops) const
+	{
+		auto s = find(h, ops);
+		return s ? s->object : nullptr;
+	}
+
+	//returns the object the handle referred to, or null if it's stale
+	void* remove(handle h, const handle_ops* ops)
+	{
+		auto s = find(h, ops);
+		if(!s)
+			return nullptr;
+
+		void* object = s->object;
+
+		s->object	 = nullptr;
+		s->ops		 = nullptr;
+		s->generation++;
+		s->next_free = m_free;
+		m_free		 = (size_t)(s - m_slots.data());
+
+		return object;
+	}
+
+	//calls f(object, ops) for every open handle
+	template<typename F>
+	void for_each(F&& f) const
+	{
+		for(auto& s : m_slots)
+		{
+			if(s.ops)
+				f(s.object, s.ops);
+		}
+	}
+
+	void clear()
+	{
+		m_slots.clear();
+		m_free = NO_SLOT;
+	}
+
+private:
+	static constexpr size_t NO_SLOT	  = ~(size_t)0;
+	static constexpr size_t MAX_SLOTS = 0xFFFF;
+
+	struct slot
+	{
+		void* object		  = nullptr;
+		const handle_ops* ops = nullptr;
+		uint16_t generation	  = 0;
+		size_t next_free	  = NO_SLOT;
+	};
+
+	const slot* find(handle h, const handle_ops* ops) const
+	{
+		const size_t index = (h & 0xFFFF) - 1;
+		if(index >= m_slots.size())
+			return nullptr;
+
+		auto& s = m_slots[index];
+		if(s.ops != ops || s.generation != (uint16_t)(h >> 16))
+			return nullptr;
+
+		return &s;
+	}
+
+	slot* find(handle h, const handle_ops* ops)
+	{
+		return const_cast<slot*>(static_cast<const handle_table*>(this)->find(h, ops));
+	}
+
+	std::vector<slot> m_slots;
+	size_t m_free = NO_SLOT;
+};
+
+#endif
+#endif
@@ -144,6 +144,19 @@ public:
 		}
 	}
 
+	//calls f(key, data) for every entry, in no particular order
+	template<typename F>
+	void for_each(F&& f)
+	{
+		for(auto entry : buckets)
+		{
+			for(; entry != nullptr; entry = entry->next)
+			{
+				f(entry->key, entry->data);
+			}
+		}
+	}
+
 private:
 	constexpr static uint32_t hash(uint32_t x)
 	{
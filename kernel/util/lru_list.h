@@ -0,0 +1,113 @@
+#ifndef LRU_LIST_H
+#define LRU_LIST_H
+#ifdef __cplusplus
+
+#include <stddef.h>
+
+struct lru_node
+{
+	lru_node* prev = nullptr;
+	lru_node* next = nullptr;
+	bool active	   = false;
+};
+
+//Entries start on the inactive list and move to the active list when they are used again.
+//The active list is aged back into the inactive one whenever it gets bigger, so a burst of
+//entries that are used once can't push out the ones that are used over and over.
+//Nodes are embedded in the entries, nothing here allocates.
+class lru_list
+{
+public:
+	constexpr lru_list() = default;
+
+	lru_list(const lru_list&) = delete;
+	lru_list& operator=(const lru_list&) = delete;
+
+	void insert(lru_node* n)
+	{
+		n->active = false;
+		push_front(m_inactive, n);
+	}
+
+	//n was used again
+	void touch(lru_node* n)
+	{
+		unlink(n);
+		n->active = true;
+		push_front(m_active, n);
+	}
+
+	void remove(lru_node* n)
+	{
+		unlink(n);
+	}
+
+	//the entry that went unused the longest, or null if there are none
+	lru_node* oldest()
+	{
+		while(m_active.size > m_inactive.size)
+		{
+			lru_node* n = m_active.tail;
+			unlink(n);
+			n->active = false;
+			push_front(m_inactive, n);
+		}
+		return m_inactive.tail;
+	}
+
+	size_t size() const
+	{
+		return m_active.size + m_inactive.size;
+	}
+
+	size_t num_active() const
+	{
+		return m_active.size;
+	}
+
+private:
+	struct list
+	{
+		lru_node* head = nullptr;
+		lru_node* tail = nullptr;
+		size_t size	   = 0;
+	};
+
+	static void push_front(list& l, lru_node* n)
+	{
+		n->prev = nullptr;
+		n->next = l.head;
+
+		if(l.head)
+			l.head->prev = n;
+		else
+			l.tail = n;
+
+		l.head = n;
+		l.size++;
+	}
+
+	void unlink(lru_node* n)
+	{
+		list& l = n->active ? m_active : m_inactive;
+
+		if(n->prev)
+			n->prev->next = n->next;
+		else
+			l.head = n->next;
+
+		if(n->next)
+			n->next->prev = n->prev;
+		else
+			l.tail = n->prev;
+
+		n->prev = n->next = nullptr;
+		l.size--;
+	}
+
+	list m_active;
+	list m_inactive;
+};
+
+#endif
+#endif
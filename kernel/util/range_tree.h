@@ -0,0 +1,346 @@
+#ifndef RANGE_TREE_H
+#define RANGE_TREE_H
+#ifdef __cplusplus
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+struct range_node
+{
+	uintptr_t start;
+	size_t length;
+	size_t max_length; //largest length in this subtree
+	range_node* left;
+	range_node* right;
+	int height;
+};
+
+//AVL tree of disjoint, coalesced free ranges ordered by start address.
+//Each node is augmented with the largest range in its subtree so a first-fit
+//search only has to descend one path.
+//Nodes come from Pool, which must provide allocate() and deallocate(),
+//this lets the tree be used before (and underneath) the heap.
+template<class Pool>
+class range_tree
+{
+public:
+	constexpr range_tree(Pool& pool) noexcept : m_pool(&pool) {}
+
+	range_tree(const range_tree&) = delete;
+	range_tree& operator=(const range_tree&) = delete;
+
+	~range_tree()
+	{
+		clear();
+	}
+
+	//returns the lowest aligned address of a free range of at least length,
+	//or 0 if no such range exists
+	uintptr_t allocate(size_t length, size_t align = 1)
+	{
+		assert(length);
+
+		const size_t needed = length + (align - 1);
+		if(needed < length) return 0;
+
+		range_node* n = find_fit(m_root, needed);
+		if(!n) return 0;
+
+		const uintptr_t start	= n->start;
+		const uintptr_t end		= n->start + n->length;
+		const uintptr_t aligned = (start + (align - 1)) & ~(uintptr_t)(align - 1);
+
+		m_root = remove(m_root, start);
+
+		if(aligned != start)
+		{
+			m_root = insert(m_root, start, aligned - start);
+		}
+		if(aligned + length != end)
+		{
+			m_root = insert(m_root, aligned + length, end - (aligned + length));
+		}
+
+		m_free -= length;
+		return aligned;
+	}
+
+	//marks [start, start + length) as used, any part that was already in use is ignored
+	void reserve(uintptr_t start, size_t length)
+	{
+		const uintptr_t end = start + length;
+
+		while(range_node* n = find_floor(m_root, end - 1))
+		{
+			const uintptr_t n_start = n->start;
+			const uintptr_t n_end	= n->start + n->length;
+
+			if(n_end <= start) break;
+
+			m_root = remove(m_root, n_start);
+
+			if(n_start < start)
+			{
+				m_root = insert(m_root, n_start, start - n_start);
+			}
+			if(n_end > end)
+			{
+				m_root = insert(m_root, end, n_end - end);
+			}
+
+			const uintptr_t lo = n_start < start ? start : n_start;
+			const uintptr_t hi = n_end > end ? end : n_end;
+			m_free -= hi - lo;
+		}
+	}
+
+	//returns [start, start + length) to the tree, merging with its neighbours
+	void release(uintptr_t start, size_t length)
+	{
+		assert(length);
+
+		m_free += length;
+
+		if(range_node* prev = find_floor(m_root, start))
+		{
+			assert(prev->start + prev->length <= start);
+			if(prev->start + prev->length == start)
+			{
+				start = prev->start;
+				length += prev->length;
+				m_root = remove(m_root, start);
+			}
+		}
+
+		if(range_node* next = find_exact(m_root, start + length))
+		{
+			length += next->length;
+			m_root = remove(m_root, next->start);
+		}
+
+		m_root = insert(m_root, start, length);
+	}
+
+	bool contains(uintptr_t address) const
+	{
+		const range_node* n = find_floor(m_root, address);
+		return n && address < n->start + n->length;
+	}
+
+	size_t largest() const
+	{
+		return m_root ? m_root->max_length : 0;
+	}
+
+	size_t bytes_free() const
+	{
+		return m_free;
+	}
+
+	void clear()
+	{
+		destroy(m_root);
+		m_root = nullptr;
+		m_free = 0;
+	}
+
+	//calls f(start, length) for every free range in ascending order
+	template<typename F>
+	void for_each(F&& f) const
+	{
+		visit(m_root, f);
+	}
+
+private:
+	static int height(const range_node* n)
+	{
+		return n ? n->height : 0;
+	}
+
+	static size_t max_length(const range_node* n)
+	{
+		return n ? n->max_length : 0;
+	}
+
+	static void update(range_node* n)
+	{
+		const int hl = height(n->left);
+		const int hr = height(n->right);
+		n->height	 = 1 + (hl > hr ? hl : hr);
+
+		size_t m = n->length;
+		if(max_length(n->left) > m) m = max_length(n->left);
+		if(max_length(n->right) > m) m = max_length(n->right);
+		n->max_length = m;
+	}
+
+	static range_node* rotate_right(range_node* n)
+	{
+		range_node* l = n->left;
+		n->left		  = l->right;
+		l->right	  = n;
+		update(n);
+		update(l);
+		return l;
+	}
+
+	static range_node* rotate_left(range_node* n)
+	{
+		range_node* r = n->right;
+		n->right	  = r->left;
+		r->left		  = n;
+		update(n);
+		update(r);
+		return r;
+	}
+
+	static range_node* balance(range_node* n)
+	{
+		update(n);
+
+		const int diff = height(n->left) - height(n->right);
+		if(diff > 1)
+		{
+			if(height(n->left->left) < height(n->left->right))
+			{
+				n->left = rotate_left(n->left);
+			}
+			return rotate_right(n);
+		}
+		if(diff < -1)
+		{
+			if(height(n->right->right) < height(n->right->left))
+			{
+				n->right = rotate_right(n->right);
+			}
+			return rotate_left(n);
+		}
+		return n;
+	}
+
+	range_node* insert(range_node* t, uintptr_t start, size_t length)
+	{
+		if(!t)
+		{
+			range_node* n = m_pool->allocate();
+			assert(n);
+			*n = range_node{start, length, length, nullptr, nullptr, 1};
+			return n;
+		}
+
+		if(start < t->start)
+			t->left = insert(t->left, start, length);
+		else
+			t->right = insert(t->right, start, length);
+
+		return balance(t);
+	}
+
+	static range_node* detach_min(range_node* t, range_node** min)
+	{
+		if(!t->left)
+		{
+			*min = t;
+			return t->right;
+		}
+		t->left = detach_min(t->left, min);
+		return balance(t);
+	}
+
+	range_node* remove(range_node* t, uintptr_t start)
+	{
+		assert(t);
+
+		if(start < t->start)
+		{
+			t->left = remove(t->left, start);
+		}
+		else if(start > t->start)
+		{
+			t->right = remove(t->right, start);
+		}
+		else
+		{
+			range_node* l = t->left;
+			range_node* r = t->right;
+			m_pool->deallocate(t);
+
+			if(!r) return l;
+
+			range_node* min;
+			r			= detach_min(r, &min);
+			min->left	= l;
+			min->right	= r;
+			return balance(min);
+		}
+		return balance(t);
+	}
+
+	//leftmost node whose length is at least length
+	static range_node* find_fit(range_node* t, size_t length)
+	{
+		while(t && t->max_length >= length)
+		{
+			if(max_length(t->left) >= length)
+				t = t->left;
+			else if(t->length >= length)
+				return t;
+			else
+				t = t->right;
+		}
+		return nullptr;
+	}
+
+	//node with the greatest start <= address
+	static range_node* find_floor(range_node* t, uintptr_t address)
+	{
+		range_node* best = nullptr;
+		while(t)
+		{
+			if(t->start <= address)
+			{
+				best = t;
+				t	 = t->right;
+			}
+			else
+			{
+				t = t->left;
+			}
+		}
+		return best;
+	}
+
+	static range_node* find_exact(range_node* t, uintptr_t address)
+	{
+		while(t && t->start != address)
+		{
+			t = address < t->start ? t->left : t->right;
+		}
+		return t;
+	}
+
+	template<typename F>
+	static void visit(const range_node* t, F& f)
+	{
+		if(!t) return;
+		visit(t->left, f);
+		f(t->start, t->length);
+		visit(t->right, f);
+	}
+
+	void destroy(range_node* t)
+	{
+		if(!t) return;
+		destroy(t->left);
+		destroy(t->right);
+		m_pool->deallocate(t);
+	}
+
+	Pool* m_pool;
+	range_node* m_root = nullptr;
+	size_t m_free = 0;
+};
+
+#endif
+#endif
@@ -132,6 +132,80 @@ static void list_directory(const file_handle* dir_handle)
 	print_strings(" Bytes\n\n");
 }
 
+static void print_top_memory_users(size_t count)
+{
+	std::vector<process_mem_info> infos;
+
+	process_mem_info info;
+	for(task_id pid = 0; (pid = get_process_mem_info(pid, &info)) != INVALID_TASK_ID; pid++)
+	{
+		infos.push_back(info);
+	}
+
+	std::sort(infos.begin(), infos.end(), [](auto&& a, auto&& b)
+			  { return a.resident_pages > b.resident_pages; });
+
+	print_strings("\n   PID  Resident    Virtual      Limit\n");
+
+	for(size_t i = 0; i < infos.size() && i < count; i++)
+	{
+		const auto& p = infos[i];
+
+		padded_print(p.pid, ' ', 6);
+		padded_print(p.resident_pages * 4, ' ', 10);
+		print_strings(" K");
+		padded_print(p.virtual_pages * 4, ' ', 9);
+		print_strings(" K");
+
+		if(p.max_resident_pages)
+		{
+			padded_print(p.max_resident_pages * 4, ' ', 9);
+			print_strings(" K");
+		}
+		else
+		{
+			print_chars(' ', 10);
+			print_strings('-');
+		}
+		print_strings('\n');
+	}
+}
+
+static void print_disk_stats(size_t index, const disk_stats& s)
+{
+	print_strings("\nDisk ", index, ": ", s.num_blocks, " blocks of ", s.block_size, " B\n");
+
+	const size_t lookups = s.cache_hits + s.cache_misses;
+	print_strings("  cache    ", s.cached_entries, " of ", s.cache_entries, " entries of ",
+				  s.cache_entry_size, " B in use, ", s.dirty_entries, " dirty\n");
+	print_strings("           ", s.cache_hits, " hits, ", s.cache_misses, " misses");
+	if(lookups)
+	{
+		print_strings(" (", s.cache_hits * 100 / lookups, "% hit)");
+	}
+	print_strings('\n');
+	print_strings("           ", s.evictions, " evicted, ", s.dirty_evictions,
+				  " written back to evict, ", s.written_back, " flushed\n");
+
+	print_strings("  reads    ", s.read_requests, " requests in ", s.read_transfers,
+				  " transfers, ", s.blocks_read, " blocks\n");
+	print_strings("  writes   ", s.write_requests, " requests in ", s.write_transfers,
+				  " transfers, ", s.blocks_written, " blocks\n");
+
+	print_strings("  latency ");
+	for(size_t i = 0; i < DISK_LATENCY_BUCKETS; i++)
+	{
+		if(!s.latency[i])
+			continue;
+
+		if(i == DISK_LATENCY_BUCKETS - 1)
+			print_strings(" >=", 1u << (i - 1), "ms:", s.latency[i]);
+		else
+			print_strings(" <", 1u << i, "ms:", s.latency[i]);
+	}
+	print_strings('\n');
+}
+
 struct command
 {
 	std::string_view name;
@@ -322,7 +396,33 @@ constexpr std::array builtin_commands = []()
 							   ? 0
 							   : -1;
 				}},
-		command{"mem", "", "Shows the amount of free memory", 1,
+		command{"iostat", "[disk]", "Shows the block cache and transfer counts of the disks", 1,
+				[](const auto& keywords)
+				{
+					disk_stats stats;
+
+					if(keywords.size() > 1)
+					{
+						size_t index = 0;
+						std::from_chars(keywords[1].cbegin(), keywords[1].cend(), index);
+
+						if(get_disk_stats(index, &stats) != 0)
+						{
+							print_strings("No disk ", index, '\n');
+							return -1;
+						}
+
+						print_disk_stats(index, stats);
+						return 0;
+					}
+
+					for(size_t i = 0; get_disk_stats(i, &stats) == 0; i++)
+					{
+						print_disk_stats(i, stats);
+					}
+					return 0;
+				}},
+		command{"mem", "", "Shows free memory and the processes using the most", 1,
 				[](const auto& keywords)
 				{
 					auto mem = get_free_memory();
@@ -345,6 +445,30 @@ constexpr std::array builtin_commands = []()
 					{
 						print_strings('\t', Bs, " B(s)\n");
 					}
+
+					print_top_memory_users(5);
+					return 0;
+				}},
+		command{"memlimit", "pid pages [virtual_pages]",
+				"Limits the memory of a process, 0 for no limit", 3,
+				[](const auto& keywords)
+				{
+					task_id pid = 0;
+					std::from_chars(keywords[1].cbegin(), keywords[1].cend(), pid);
+					size_t pages = 0;
+					std::from_chars(keywords[2].cbegin(), keywords[2].cend(), pages);
+					size_t virtual_pages = 0;
+					if(keywords.size() > 3)
+					{
+						std::from_chars(keywords[3].cbegin(), keywords[3].cend(),
+										virtual_pages);
+					}
+
+					if(set_process_mem_limit(pid, pages, virtual_pages) != 0)
+					{
+						print_strings("Could not set the limit of process ", pid, '\n');
+						return -1;
+					}
 					return 0;
 				}},
 		command{"mode", "width height",